@@ -1,42 +1,311 @@
+#include <errno.h>
 #include <inttypes.h>
 #include <malloc.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <new>
+
+#include "Allocators.h"
 #include "MemorySystem.h"
+#include "LargeAllocator/LargeAllocator.h"
+#include "SizeClassProfiler/SizeClassProfiler.h"
+#include "ThreadCache/ThreadCache.h"
+#include "Utilities/VirtualMemory.h"
+
+
+// Allocates from this thread's cache of the size class of i_size, spilling a bounded number of classes up.
+// nullptr if i_size is too big for FixedSizeAllocators or the classes are exhausted
+static void * sizeClassAlloc(size_t i_size)
+{
+	const unsigned int sizeClass = GetSizeClassIndex(i_size);
+	for (unsigned int i = sizeClass; i < g_FixedSizeAllocatorsCount && i <= sizeClass + FSA_OVERFLOW_SPILL_CLASSES; i++)
+	{
+		void* ptr = ThreadCacheAlloc(i);
+		if (ptr != nullptr)
+			return ptr;
+	}
+	return nullptr;
+}
+
+// Allocates i_size bytes aligned to i_alignment, a power of 2
+static void * alignedAlloc(size_t i_size, size_t i_alignment)
+{
+	if (i_alignment <= MALLOC_MIN_ALIGNMENT)
+		return malloc(i_size);
 
+	if (g_bRecordSizeHistogram.load(std::memory_order_relaxed))
+		RecordRequestSize(i_size);
+
+	// Size class blocks of a cache line or more are cache line aligned, so they serve any alignment up to that
+	if (i_alignment <= FSA_CACHE_LINE_SIZE)
+	{
+		void* ptr = sizeClassAlloc(i_size > FSA_CACHE_LINE_SIZE ? i_size : FSA_CACHE_LINE_SIZE);
+		if (ptr != nullptr)
+			return ptr;
+	}
+
+	// Mappings start on a page
+	if (IsLargeAllocationSize(i_size) && i_alignment <= GetVirtualMemoryPageSize())
+	{
+		void* ptr = LargeAlloc(i_size);
+		if (ptr != nullptr)
+			return ptr;
+	}
+
+	return AllocFromHeap(i_size, i_alignment);
+}
+
+// Frees a block the caller knows the size of. Beyond the size classes only the HeapManager, an arena (or a mapping of its
+// own, for large sizes) can own it, so the page map isn't asked. Smaller blocks may have spilled into a larger class or the heap,
+// they go through free
+static void sizedFree(void * i_ptr, size_t i_size)
+{
+	if (i_ptr != nullptr && GetSizeClassIndex(i_size) == g_FixedSizeAllocatorsCount)
+	{
+		// Large sizes fall back to the heap when no mapping was to be had
+		if (IsLargeAllocationSize(i_size) && LargeFree(i_ptr))
+			return;
+
+		if (FreeToHeapArena(i_ptr))
+			return;
+
+		ScopedSpinLock lock(g_HeapManagerLock);
+		g_pHeapManager->Free(i_ptr);
+		return;
+	}
+
+	free(i_ptr);
+}
 
 void * __cdecl malloc(size_t i_size)
 {
-	// Try to allocate memory from FixedSizeAllocators
-	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+	if (g_bRecordSizeHistogram.load(std::memory_order_relaxed))
+		RecordRequestSize(i_size);
+
+	void* ptr = sizeClassAlloc(i_size);
+	if (ptr != nullptr)
+		return ptr;
+
+	// Large requests get a mapping of their own and keep the heap for medium sized ones
+	if (IsLargeAllocationSize(i_size))
+	{
+		ptr = LargeAlloc(i_size);
+		if (ptr != nullptr)
+			return ptr;
+	}
+
+	// Too big for FixedSizeAllocators, try HeapManager and its arenas
+	return AllocFromHeap(i_size, MALLOC_MIN_ALIGNMENT);
+}
+
+void __cdecl free(void * i_ptr)
+{
+	// The page map knows which allocator owns the pointer
+	const unsigned char owner = GetPageOwner(i_ptr);
+
+	if (owner < g_FixedSizeAllocatorsCount)
+	{
+		ThreadCacheFree(owner, i_ptr);
+	}
+	else if (owner == PAGE_OWNER_HEAP_MANAGER)
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		g_pHeapManager->Free(i_ptr);
+	}
+	else if (i_ptr != nullptr)
 	{
-		if (i_size <= g_pFixedSizeAllocators[i]->m_blockSize)
+		// Outside the memory system's region, an arena's block, a large allocation or a pointer that isn't ours
+		if (!FreeToHeapArena(i_ptr))
+			LargeFree(i_ptr);
+	}
+}
+
+void * __cdecl calloc(size_t i_count, size_t i_size)
+{
+	if (i_size != 0 && i_count > SIZE_MAX / i_size)
+		return nullptr;
+
+	// Fresh mappings come zeroed from the OS
+	const size_t size = i_count * i_size;
+	if (IsLargeAllocationSize(size))
+	{
+		bool bZeroed;
+		void * ptr = LargeAlloc(size, &bZeroed);
+		if (ptr != nullptr)
 		{
-			void* ptr = g_pFixedSizeAllocators[i]->Alloc();
-			if (ptr != nullptr)
-				return ptr;
+			if (!bZeroed)
+				memset(ptr, 0, size);
+			return ptr;
 		}
 	}
 
-	// Too big for FixedSizeAllocators, try HeapManager
-	return g_pHeapManager->Alloc(i_size, 4);
+	// Blocks are recycled from the same heap memory, none of them is known to be zero
+	void * ptr = malloc(size);
+	if (ptr != nullptr)
+		memset(ptr, 0, size);
+	return ptr;
 }
 
-void __cdecl free(void * i_ptr)
+void * __cdecl realloc(void * i_ptr, size_t i_size)
 {
-	// Try to free memory from FixedSizeAllocators
-	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+	if (i_ptr == nullptr)
+		return malloc(i_size);
+
+	if (i_size == 0)
 	{
-		if (g_pFixedSizeAllocators[i]->Contains(i_ptr))
+		free(i_ptr);
+		return nullptr;
+	}
+
+	const unsigned char owner = GetPageOwner(i_ptr);
+	HeapManager* pHeap = nullptr;
+	size_t blockSize = 0;
+	if (owner >= g_FixedSizeAllocatorsCount)
+	{
+		// Grows into the free block after it or shrinks in place, moves within its heap if it can't, and to another
+		// heap only if its own is full. An arena's block is resized under its thread arena's lock, whichever thread asks
+		unsigned int threadArena = 0;
+		pHeap = owner == PAGE_OWNER_HEAP_MANAGER ? g_pHeapManager : FindHeapArena(i_ptr, &threadArena);
+		if (pHeap != nullptr)
 		{
-			g_pFixedSizeAllocators[i]->Free(i_ptr);
-			return;
+			ScopedSpinLock lock(pHeap == g_pHeapManager ? g_HeapManagerLock : g_ThreadArenas[threadArena].m_lock);
+			void * pNewPtr = pHeap->Realloc(i_ptr, i_size);
+			if (pNewPtr != nullptr || !pHeap->IsAllocated(i_ptr))
+				return pNewPtr;
+
+			blockSize = pHeap->GetUsableSize(i_ptr);
 		}
 	}
 
-	// Try to free memory from HeapManager
-	g_pHeapManager->Free(i_ptr);
+	// Anything up to the block size of its class still fits the block it has. A mapping keeps anything up to its size
+	// that is still a large allocation, smaller sizes move out so the mapping can go
+	bool bFits = false;
+	if (owner < g_FixedSizeAllocatorsCount)
+	{
+		blockSize = g_pFixedSizeAllocators[owner]->m_blockSize;
+		bFits = i_size <= blockSize;
+	}
+	else if (pHeap == nullptr)
+	{
+		blockSize = GetLargeAllocationSize(i_ptr);
+		if (blockSize == 0)
+			return nullptr;
+		bFits = i_size <= blockSize && IsLargeAllocationSize(i_size);
+	}
+
+	if (bFits)
+		return i_ptr;
+
+	void * pNewPtr = malloc(i_size);
+	if (pNewPtr != nullptr)
+	{
+		memcpy(pNewPtr, i_ptr, i_size < blockSize ? i_size : blockSize);
+		free(i_ptr);
+	}
+	return pNewPtr;
+}
+
+void * __cdecl aligned_alloc(size_t i_alignment, size_t i_size)
+{
+	if (i_alignment == 0 || (i_alignment & (i_alignment - 1)) != 0)
+		return nullptr;
+
+	return alignedAlloc(i_size, i_alignment);
+}
+
+int __cdecl posix_memalign(void ** o_ptr, size_t i_alignment, size_t i_size)
+{
+	if (i_alignment < sizeof(void *) || (i_alignment & (i_alignment - 1)) != 0)
+		return EINVAL;
+
+	void * ptr = alignedAlloc(i_size, i_alignment);
+	if (ptr == nullptr)
+		return ENOMEM;
+
+	*o_ptr = ptr;
+	return 0;
+}
+
+size_t __cdecl malloc_usable_size(void * i_ptr)
+{
+	return i_ptr != nullptr ? GetUsableSize(i_ptr) : 0;
+}
+
+#if _WIN32
+size_t __cdecl _msize(void * i_ptr)
+{
+	return malloc_usable_size(i_ptr);
+}
+#endif
+
+size_t malloc_batch(size_t i_size, void ** o_ptrs, size_t i_count)
+{
+	if (g_bRecordSizeHistogram.load(std::memory_order_relaxed))
+	{
+		for (size_t i = 0; i < i_count; i++)
+			RecordRequestSize(i_size);
+	}
+
+	// The whole batch comes straight from the size class's allocator in one critical section, the thread cache only
+	// pays off for single blocks
+	size_t allocCount = 0;
+	const unsigned int sizeClass = GetSizeClassIndex(i_size);
+	if (sizeClass < g_FixedSizeAllocatorsCount)
+	{
+		ScopedSpinLock lock(g_FixedSizeAllocatorLocks[sizeClass]);
+		allocCount = g_pFixedSizeAllocators[sizeClass]->AllocBatch(o_ptrs, i_count);
+	}
+
+	// Too big for FixedSizeAllocators or the class ran out, carve the rest out of HeapManager
+	if (allocCount < i_count)
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		allocCount += g_pHeapManager->AllocBatch(i_size, i_count - allocCount, o_ptrs + allocCount);
+	}
+
+	// HeapManager is full, the rest comes from its arenas one chunk at a time
+	while (allocCount < i_count && (o_ptrs[allocCount] = AllocFromHeap(i_size, MALLOC_MIN_ALIGNMENT)) != nullptr)
+		allocCount++;
+
+	return allocCount;
+}
+
+void free_batch(void * const * i_ptrs, size_t i_count)
+{
+	size_t runStart = 0;
+	while (runStart < i_count)
+	{
+		// Consecutive pointers owned by the same allocator are freed under a single lock
+		const unsigned char owner = GetPageOwner(i_ptrs[runStart]);
+		size_t runEnd = runStart + 1;
+		while (runEnd < i_count && GetPageOwner(i_ptrs[runEnd]) == owner)
+			runEnd++;
+
+		if (owner < g_FixedSizeAllocatorsCount)
+		{
+			ScopedSpinLock lock(g_FixedSizeAllocatorLocks[owner]);
+			g_pFixedSizeAllocators[owner]->FreeBatch(i_ptrs + runStart, runEnd - runStart);
+		}
+		else if (owner == PAGE_OWNER_HEAP_MANAGER)
+		{
+			ScopedSpinLock lock(g_HeapManagerLock);
+			for (size_t i = runStart; i < runEnd; i++)
+				g_pHeapManager->Free(i_ptrs[i]);
+		}
+		else
+		{
+			for (size_t i = runStart; i < runEnd; i++)
+			{
+				if (i_ptrs[i] != nullptr && !FreeToHeapArena(i_ptrs[i]))
+					LargeFree(i_ptrs[i]);
+			}
+		}
+
+		runStart = runEnd;
+	}
 }
 
 void * operator new(size_t i_size)
@@ -57,4 +326,46 @@ void * operator new[](size_t i_size)
 void operator delete [](void * i_ptr)
 {
 	free(i_ptr);
-}
\ No newline at end of file
+}
+
+void operator delete(void * i_ptr, size_t i_size)
+{
+	sizedFree(i_ptr, i_size);
+}
+
+void operator delete [](void * i_ptr, size_t i_size)
+{
+	sizedFree(i_ptr, i_size);
+}
+
+#ifdef __cpp_aligned_new
+void * operator new(size_t i_size, std::align_val_t i_alignment)
+{
+	return alignedAlloc(i_size, static_cast<size_t>(i_alignment));
+}
+
+void * operator new[](size_t i_size, std::align_val_t i_alignment)
+{
+	return alignedAlloc(i_size, static_cast<size_t>(i_alignment));
+}
+
+void operator delete(void * i_ptr, std::align_val_t)
+{
+	free(i_ptr);
+}
+
+void operator delete [](void * i_ptr, std::align_val_t)
+{
+	free(i_ptr);
+}
+
+void operator delete(void * i_ptr, size_t i_size, std::align_val_t)
+{
+	sizedFree(i_ptr, i_size);
+}
+
+void operator delete [](void * i_ptr, size_t i_size, std::align_val_t)
+{
+	sizedFree(i_ptr, i_size);
+}
+#endif // __cpp_aligned_new
\ No newline at end of file
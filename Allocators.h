@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+// The CRT on Windows has no aligned_alloc, posix_memalign or malloc_usable_size, Allocators.cpp provides them everywhere.
+// Elsewhere it defines them against the C declarations of <stdlib.h> and <malloc.h>, so they replace the C library's
+#if _WIN32
+void * __cdecl aligned_alloc(size_t i_alignment, size_t i_size);
+int __cdecl posix_memalign(void ** o_ptr, size_t i_alignment, size_t i_size);
+size_t __cdecl malloc_usable_size(void * i_ptr);
+#endif
+
+// Batch entry points next to the malloc and free overrides in Allocators.cpp, for callers that allocate and free
+// many blocks of one size at a time. Each takes the lock of an allocator once per batch instead of once per block.
+
+// malloc_batch - allocate i_count blocks of i_size bytes into o_ptrs, returns how many were allocated (fewer only when out of memory)
+size_t malloc_batch(size_t i_size, void ** o_ptrs, size_t i_count);
+
+// free_batch - free the i_count blocks in i_ptrs, runs of blocks of the same allocator are freed together
+void free_batch(void * const * i_ptrs, size_t i_count);
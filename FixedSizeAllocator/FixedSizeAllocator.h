@@ -1,34 +1,574 @@
 ﻿#pragma once
 
+#include "FixedSizeAllocatorPolicies.h"
+#include "../Utilities/Atomics.h"
 #include "../Utilities/BitArray.h"
+#include "../Utilities/BitScan.h"
 
-class FixedSizeAllocator
+// BlockSize of a BasicFixedSizeAllocator that only learns its block size at runtime, from CreateFixedSizeAllocator
+const size_t FSA_DYNAMIC_BLOCK_SIZE = 0;
+
+// Blocks of at least this size are aligned to at least this, enough for any fundamental type and for 16 byte SIMD loads
+const size_t FSA_MIN_BLOCK_ALIGNMENT = alignof(std::max_align_t) > 16 ? alignof(std::max_align_t) : 16;
+
+// Blocks of at least a cache line are aligned to one, so none of them straddles more cache lines than it has to.
+// The blocks also start on a fresh cache line, away from the allocator's counters and BitArray
+const size_t FSA_CACHE_LINE_SIZE = 64;
+
+// Offset, in BitArray elements, of the calling thread's search start from the shared hint of a concurrent allocator
+size_t GetConcurrentSearchOffset();
+
+/**
+ * @class BasicFixedSizeAllocator
+ *
+ * @brief Hands out blocks of a single size, tracking which are taken in a BitArray.
+ *
+ * The block size and the policies are template parameters. With a compile-time BlockSize the distance between blocks
+ * is a constant, so finding a block's index is a shift when it is a power of 2; FSA_DYNAMIC_BLOCK_SIZE reads it from
+ * m_blockSize instead. Every block is aligned as GetBlockAlignment says, guardbands or not. Policy picks the guardbands, fill patterns and stats (see FixedSizeAllocatorPolicies.h), and
+ * the allocator derives from its stats policy so the empty ones take no space.
+ */
+template <size_t BlockSize, class Policy = DefaultFixedSizeAllocatorPolicy>
+class BasicFixedSizeAllocator : public Policy::Stats
 {
 public:
-    FixedSizeAllocator(
+    BasicFixedSizeAllocator(
         const BitArray& bitArray, 
         size_t blockNum = 0, size_t freeBlockNum = 0, 
         size_t blockSize = 0, size_t bitArraySize = 0,
         void* blockBaseAddr = nullptr);
     
-    ~FixedSizeAllocator();
+    ~BasicFixedSizeAllocator();
     
     size_t m_blockNum;
     size_t m_freeBlockNum;
     size_t m_blockSize;
     size_t m_bitArraySize;
+    size_t m_firstFreeBlockHint;    // Every block below this index is allocated (concurrent: where threads start searching)
+    bool m_bConcurrent;             // Alloc and Free may be called from any number of threads at once
+    BasicFixedSizeAllocator* m_pNextSlab;   // Slab list links when this is a slab of a GrowableFixedSizeAllocator
+    BasicFixedSizeAllocator* m_pPrevSlab;
+    bool m_bReservedSlab;           // Slab its GrowableFixedSizeAllocator keeps for its whole lifetime
     void* m_blockBaseAddr;
-    BitArray m_BitArray;
+    BitArray m_BitArray;            // Must stay last, the bit storage is placed right after it
+
+    /**
+     * @brief Returns the number of bytes Create carves out of heapBaseAddr:
+     *        the allocator itself, its BitArray storage and all of its blocks (guardbands included).
+     */
+    static size_t GetSize(size_t blockSize, size_t blockNum);
+
+    /**
+     * @brief Creates an allocator at heapBaseAddr, taking GetSize(blockSize, blockNum) bytes. blockSize must be BlockSize
+     *        unless that is FSA_DYNAMIC_BLOCK_SIZE.
+     */
+    static BasicFixedSizeAllocator* Create(size_t blockSize, size_t blockNum, void* heapBaseAddr, bool bConcurrent);
+
+    // FSA_CACHE_LINE_SIZE for blocks of a cache line or more, FSA_MIN_BLOCK_ALIGNMENT for blocks of at least that size,
+    // smaller blocks are aligned to their size rounded up to a power of 2
+    static size_t GetBlockAlignment(size_t blockSize)
+    {
+        blockSize = BlockSize == FSA_DYNAMIC_BLOCK_SIZE ? blockSize : BlockSize;
+        if (blockSize >= FSA_CACHE_LINE_SIZE)
+        {
+            return FSA_CACHE_LINE_SIZE;
+        }
+        if (blockSize >= FSA_MIN_BLOCK_ALIGNMENT)
+        {
+            return FSA_MIN_BLOCK_ALIGNMENT;
+        }
+
+        size_t alignment = 1;
+        while (alignment < blockSize)
+        {
+            alignment <<= 1;
+        }
+        return alignment;
+    }
+
+    // Where a block starts within its stride: the front guardband sits right in front of it, padded up to the alignment
+    static size_t GetBlockOffset(size_t blockSize)
+    {
+        const size_t alignment = GetBlockAlignment(blockSize);
+        return (Policy::Guardband::Size + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Distance between two consecutive blocks, guardbands and alignment padding included. A constant unless the block
+    // size is dynamic
+    static size_t GetBlockStride(size_t blockSize)
+    {
+        const size_t alignment = GetBlockAlignment(blockSize);
+        blockSize = BlockSize == FSA_DYNAMIC_BLOCK_SIZE ? blockSize : BlockSize;
+        return (GetBlockOffset(blockSize) + blockSize + Policy::Guardband::Size + alignment - 1) & ~(alignment - 1);
+    }
     
     bool Contains(const void* ptr) const;
 
+    // True if ptr is an address Alloc hands out, whether or not that block is allocated right now
+    bool IsBlockAddress(const void* ptr) const;
+
     bool IsAllocated(const void* ptr) const;
 
     void* Alloc();
     
     bool Free(void* ptr);
 
+    /**
+     * @brief Allocates up to i_count blocks into o_ptrs and returns how many it got, fewer only if the allocator ran out.
+     *
+     * Blocks are claimed a whole BitArray element at a time, up to 64 of them per bit operation, and the free count is
+     * updated once per element instead of once per block.
+     */
+    size_t AllocBatch(void** o_ptrs, size_t i_count);
+
+    /**
+     * @brief Frees the i_count blocks in i_ptrs and returns how many of them were freed.
+     *
+     * Every pointer is checked like Free checks it. Runs of blocks in the same BitArray element are cleared with a
+     * single bit operation, so batches sorted by address (or freed in the order AllocBatch returned them) are cheapest.
+     */
+    size_t FreeBatch(void* const* i_ptrs, size_t i_count);
+
     void Destroy() const;
+
+private:
+    size_t getBlockSize() const
+    {
+        return BlockSize == FSA_DYNAMIC_BLOCK_SIZE ? m_blockSize : BlockSize;
+    }
+
+    /**
+     * @brief Claims a free block for Alloc in concurrent mode, without taking a lock.
+     *
+     * A block is first reserved by decrementing m_freeBlockNum with a CAS, then the first clear bit is claimed with a
+     * CAS on its BitArray element. Every thread starts searching its own number of elements past the shared hint, so
+     * threads allocating at the same time work on different elements instead of all competing for the first free one.
+     */
+    bool claimBlockConcurrent(size_t& o_blockIndex);
+
+    /**
+     * @brief Reserves up to i_count blocks like claimBlockConcurrent, then claims them a BitArray element at a time.
+     *
+     * @return The number of blocks claimed, their pointers written to o_ptrs.
+     */
+    size_t claimBlocksConcurrent(void** o_ptrs, size_t i_count);
+
+    // Writes the guardband and fill pattern of a freshly claimed block and returns the address handed out for it
+    void* initBlock(size_t blockIndex);
+
+    // Initializes the blocks of the bits set in i_bits of BitArray element i_elementIndex, writing their pointers to o_ptrs
+    size_t initBlocks(size_t i_elementIndex, t_BitData i_bits, void** o_ptrs);
+
+    // Clears the bits of blocks FreeBatch collected in one BitArray element, returns how many were actually freed
+    size_t releaseBlocks(size_t i_elementIndex, t_BitData i_bits);
 };
 
-FixedSizeAllocator* CreateFixedSizeAllocator(size_t blockSize, size_t blockNum, void* heapBaseAddr);
+// The allocator the memory system is built from: block size chosen at runtime, checks only in debug builds
+typedef BasicFixedSizeAllocator<FSA_DYNAMIC_BLOCK_SIZE, DefaultFixedSizeAllocatorPolicy> FixedSizeAllocator;
+
+template <size_t BlockSize, class Policy>
+size_t BasicFixedSizeAllocator<BlockSize, Policy>::GetSize(size_t blockSize, size_t blockNum)
+{
+    // The BitArray object is already part of the allocator, only its storage and the padding up to the first block's
+    // cache line come on top
+    return sizeof(BasicFixedSizeAllocator) - sizeof(BitArray) + GetBitArraySize(blockNum) + FSA_CACHE_LINE_SIZE - 1 + GetBlockStride(blockSize) * blockNum;
+}
+
+template <size_t BlockSize, class Policy>
+BasicFixedSizeAllocator<BlockSize, Policy>* BasicFixedSizeAllocator<BlockSize, Policy>::Create(size_t blockSize, size_t blockNum, void* heapBaseAddr, bool bConcurrent)
+{
+    BasicFixedSizeAllocator* pFixedSizeAllocator = static_cast<BasicFixedSizeAllocator*>(heapBaseAddr);
+
+    pFixedSizeAllocator->m_blockSize = blockSize;
+    pFixedSizeAllocator->m_blockNum = blockNum;
+    pFixedSizeAllocator->m_freeBlockNum = blockNum;
+    pFixedSizeAllocator->m_firstFreeBlockHint = 0;
+    pFixedSizeAllocator->m_bConcurrent = bConcurrent;
+    pFixedSizeAllocator->m_pNextSlab = nullptr;
+    pFixedSizeAllocator->m_pPrevSlab = nullptr;
+    pFixedSizeAllocator->m_bReservedSlab = false;
+    pFixedSizeAllocator->ResetStats();
+    CreateBitArray(&pFixedSizeAllocator->m_BitArray, blockNum, true);
+    pFixedSizeAllocator->m_bitArraySize = GetBitArraySize(blockNum);
+    pFixedSizeAllocator->m_blockBaseAddr = PointerAlignUp(PointerAdd(&pFixedSizeAllocator->m_BitArray, pFixedSizeAllocator->m_bitArraySize), FSA_CACHE_LINE_SIZE);
+    return pFixedSizeAllocator;
+}
+
+template <size_t BlockSize, class Policy>
+BasicFixedSizeAllocator<BlockSize, Policy>::BasicFixedSizeAllocator(
+    const BitArray& bitArray, 
+    size_t blockNum, size_t freeBlockNum, 
+    size_t blockSize, size_t bitArraySize,
+    void* blockBaseAddr)
+    : m_blockNum(blockNum), m_freeBlockNum(freeBlockNum), m_blockSize(blockSize),
+      m_bitArraySize(bitArraySize), m_firstFreeBlockHint(0), m_bConcurrent(false), m_pNextSlab(nullptr), m_pPrevSlab(nullptr), m_bReservedSlab(false), m_blockBaseAddr(blockBaseAddr), m_BitArray(bitArray)
+{
+    this->ResetStats();
+}
+
+template <size_t BlockSize, class Policy>
+BasicFixedSizeAllocator<BlockSize, Policy>::~BasicFixedSizeAllocator()
+= default;
+
+template <size_t BlockSize, class Policy>
+bool BasicFixedSizeAllocator<BlockSize, Policy>::Contains(const void* ptr) const
+{
+    return (ptr >= m_blockBaseAddr) && 
+           (ptr < static_cast<char*>(m_blockBaseAddr) + GetBlockStride(m_blockSize) * m_blockNum);
+}
+
+template <size_t BlockSize, class Policy>
+bool BasicFixedSizeAllocator<BlockSize, Policy>::IsBlockAddress(const void* ptr) const
+{
+    if (!Contains(ptr))
+    {
+        return false;
+    }
+
+    // Only the address right after the front guardband of a block is ever handed out
+    const size_t offset = static_cast<const char*>(ptr) - static_cast<const char*>(m_blockBaseAddr);
+    return offset % GetBlockStride(m_blockSize) == GetBlockOffset(m_blockSize);
+}
+
+template <size_t BlockSize, class Policy>
+bool BasicFixedSizeAllocator<BlockSize, Policy>::IsAllocated(const void* ptr) const
+{
+    if (!IsBlockAddress(ptr))
+    {
+        return false;
+    }
+
+    const size_t blockIndex = (static_cast<const char*>(ptr) - static_cast<const char*>(m_blockBaseAddr)) / GetBlockStride(m_blockSize);
+    return m_bConcurrent ? m_BitArray.AtomicIsBitSet(blockIndex) : m_BitArray.IsBitSet(blockIndex);
+}
+
+template <size_t BlockSize, class Policy>
+void* BasicFixedSizeAllocator<BlockSize, Policy>::Alloc()
+{
+    size_t blockIndex;
+    if (m_bConcurrent)
+    {
+        if (!claimBlockConcurrent(blockIndex))
+        {
+            return nullptr;
+        }
+    }
+    else
+    {
+        if (m_freeBlockNum == 0)
+        {
+            return nullptr;
+        }
+
+        // Everything below the hint is known to be allocated, so the word scan starts at the first candidate
+        if (!m_BitArray.FindFirstClearBit(m_firstFreeBlockHint, blockIndex))
+        {
+            return nullptr; // No free block found
+        }
+
+        m_BitArray.SetBit(blockIndex);
+        m_freeBlockNum--;
+        m_firstFreeBlockHint = blockIndex + 1;
+    }
+
+    this->OnAlloc();
+    return initBlock(blockIndex);
+}
+
+template <size_t BlockSize, class Policy>
+size_t BasicFixedSizeAllocator<BlockSize, Policy>::AllocBatch(void** o_ptrs, size_t i_count)
+{
+    size_t allocCount = 0;
+    if (m_bConcurrent)
+    {
+        allocCount = claimBlocksConcurrent(o_ptrs, i_count);
+    }
+    else
+    {
+        size_t blockIndex;
+        while (allocCount < i_count && m_freeBlockNum > 0 && m_BitArray.FindFirstClearBit(m_firstFreeBlockHint, blockIndex))
+        {
+            // The lowest clear bits of the element are claimed, every bit below the last of them is set afterwards
+            const size_t elementIndex = blockIndex / m_BitArray.bitsPerElement;
+            const t_BitData claimedBits = m_BitArray.SetClearBits(elementIndex, i_count - allocCount);
+            const size_t claimedCount = initBlocks(elementIndex, claimedBits, o_ptrs + allocCount);
+
+            allocCount += claimedCount;
+            m_freeBlockNum -= claimedCount;
+            m_firstFreeBlockHint = elementIndex * m_BitArray.bitsPerElement + FindHighestSetBit(claimedBits) + 1;
+        }
+    }
+
+    this->OnAlloc(allocCount);
+    return allocCount;
+}
+
+template <size_t BlockSize, class Policy>
+bool BasicFixedSizeAllocator<BlockSize, Policy>::Free(void* ptr)
+{
+    if (!IsAllocated(ptr))
+    {
+        this->OnBadFree();
+        return false;
+    }
+
+    const size_t blockIndex = (static_cast<char*>(ptr) - static_cast<char*>(m_blockBaseAddr)) / GetBlockStride(m_blockSize);
+
+    if (!Policy::Guardband::Check(static_cast<char*>(ptr) - Policy::Guardband::Size, getBlockSize()))
+    {
+        this->OnBadFree();
+        return false;
+    }
+
+    Policy::Fill::OnFree(ptr, getBlockSize());
+
+    if (m_bConcurrent)
+    {
+        // Of two threads freeing the same block at once, only the one that actually cleared the bit counts it
+        if (!m_BitArray.AtomicClearBit(blockIndex))
+        {
+            this->OnBadFree();
+            return false;
+        }
+        AsAtomic(m_freeBlockNum).fetch_add(1, std::memory_order_release);
+        this->OnFree();
+        return true;
+    }
+
+    m_BitArray.ClearBit(blockIndex);
+    m_freeBlockNum++;
+
+    if (blockIndex < m_firstFreeBlockHint)
+    {
+        m_firstFreeBlockHint = blockIndex;
+    }
+    this->OnFree();
+    return true;
+}
+
+template <size_t BlockSize, class Policy>
+size_t BasicFixedSizeAllocator<BlockSize, Policy>::FreeBatch(void* const* i_ptrs, size_t i_count)
+{
+    const size_t bitsPerElement = m_BitArray.bitsPerElement;
+
+    // Bits of consecutive pointers that fall into the same element are collected and cleared together
+    size_t pendingElement = 0;
+    t_BitData pendingBits = 0;
+    size_t lowestBlockIndex = m_blockNum;
+    size_t freeCount = 0;
+
+    for (size_t i = 0; i < i_count; i++)
+    {
+        void* ptr = i_ptrs[i];
+        if (!IsAllocated(ptr) || !Policy::Guardband::Check(static_cast<char*>(ptr) - Policy::Guardband::Size, getBlockSize()))
+        {
+            this->OnBadFree();
+            continue;
+        }
+
+        const size_t blockIndex = (static_cast<char*>(ptr) - static_cast<char*>(m_blockBaseAddr)) / GetBlockStride(m_blockSize);
+        const size_t elementIndex = blockIndex / bitsPerElement;
+        const t_BitData bit = static_cast<t_BitData>(1) << (blockIndex % bitsPerElement);
+
+        if (elementIndex != pendingElement && pendingBits != 0)
+        {
+            freeCount += releaseBlocks(pendingElement, pendingBits);
+            pendingBits = 0;
+        }
+        pendingElement = elementIndex;
+
+        // Its bit is still set until the element is released, so a block listed twice in a row is only caught here
+        if (pendingBits & bit)
+        {
+            this->OnBadFree();
+            continue;
+        }
+
+        Policy::Fill::OnFree(ptr, getBlockSize());
+        pendingBits |= bit;
+        if (blockIndex < lowestBlockIndex)
+        {
+            lowestBlockIndex = blockIndex;
+        }
+    }
+
+    if (pendingBits != 0)
+    {
+        freeCount += releaseBlocks(pendingElement, pendingBits);
+    }
+
+    if (m_bConcurrent)
+    {
+        AsAtomic(m_freeBlockNum).fetch_add(freeCount, std::memory_order_release);
+    }
+    else
+    {
+        m_freeBlockNum += freeCount;
+        if (lowestBlockIndex < m_firstFreeBlockHint)
+        {
+            m_firstFreeBlockHint = lowestBlockIndex;
+        }
+    }
+
+    this->OnFree(freeCount);
+    return freeCount;
+}
+
+template <size_t BlockSize, class Policy>
+size_t BasicFixedSizeAllocator<BlockSize, Policy>::releaseBlocks(size_t i_elementIndex, t_BitData i_bits)
+{
+    if (!m_bConcurrent)
+    {
+        m_BitArray.ClearBits(i_elementIndex, i_bits);
+        return CountSetBits(i_bits);
+    }
+
+    // Of two threads freeing the same block at once, only the one that actually cleared the bit counts it
+    const t_BitData clearedBits = m_BitArray.AtomicClearBits(i_elementIndex, i_bits);
+    if (clearedBits != i_bits)
+    {
+        this->OnBadFree(CountSetBits(i_bits & ~clearedBits));
+    }
+    return CountSetBits(clearedBits);
+}
+
+template <size_t BlockSize, class Policy>
+void* BasicFixedSizeAllocator<BlockSize, Policy>::initBlock(size_t blockIndex)
+{
+    char* blockPtr = static_cast<char*>(m_blockBaseAddr) + blockIndex * GetBlockStride(m_blockSize);
+    char* userPtr = blockPtr + GetBlockOffset(m_blockSize);     // The actual block, after the front guardband
+
+    Policy::Guardband::Write(userPtr - Policy::Guardband::Size, getBlockSize());
+    Policy::Fill::OnAlloc(userPtr, getBlockSize());
+
+    return userPtr;
+}
+
+template <size_t BlockSize, class Policy>
+size_t BasicFixedSizeAllocator<BlockSize, Policy>::initBlocks(size_t i_elementIndex, t_BitData i_bits, void** o_ptrs)
+{
+    size_t count = 0;
+    for (; i_bits != 0; i_bits &= i_bits - 1)
+    {
+        o_ptrs[count++] = initBlock(i_elementIndex * m_BitArray.bitsPerElement + FindLowestSetBit(i_bits));
+    }
+    return count;
+}
+
+template <size_t BlockSize, class Policy>
+bool BasicFixedSizeAllocator<BlockSize, Policy>::claimBlockConcurrent(size_t& o_blockIndex)
+{
+    // Reserve a block first: as long as the reservation holds, at least one bit is guaranteed to be clear
+    std::atomic<size_t>& freeBlockNum = AsAtomic(m_freeBlockNum);
+    size_t expectedFreeBlockNum = freeBlockNum.load(std::memory_order_relaxed);
+    do
+    {
+        if (expectedFreeBlockNum == 0)
+        {
+            return false;
+        }
+    } while (!freeBlockNum.compare_exchange_weak(expectedFreeBlockNum, expectedFreeBlockNum - 1, std::memory_order_acquire, std::memory_order_relaxed));
+
+    const size_t elementCount = m_BitArray.m_elementCount;
+    const size_t bitsPerElement = m_BitArray.bitsPerElement;
+    const size_t searchOffset = GetConcurrentSearchOffset() % elementCount;
+    const size_t startElement = (AsAtomic(m_firstFreeBlockHint).load(std::memory_order_relaxed) / bitsPerElement + searchOffset) % elementCount;
+
+    // The clear bit may be taken and another one freed behind the search, in which case it goes around again
+    while (!m_BitArray.AtomicSetFirstClearBit(startElement * bitsPerElement, o_blockIndex))
+    {
+    }
+
+    // The start element was full, move the shared hint so this thread starts at the element it just found next time
+    const size_t foundElement = o_blockIndex / bitsPerElement;
+    if (foundElement != startElement)
+    {
+        AsAtomic(m_firstFreeBlockHint).store(((foundElement + elementCount - searchOffset) % elementCount) * bitsPerElement, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+template <size_t BlockSize, class Policy>
+size_t BasicFixedSizeAllocator<BlockSize, Policy>::claimBlocksConcurrent(void** o_ptrs, size_t i_count)
+{
+    // Reserve as many blocks as are free, up to i_count, so the element scan below is guaranteed to find them all
+    std::atomic<size_t>& freeBlockNum = AsAtomic(m_freeBlockNum);
+    size_t expectedFreeBlockNum = freeBlockNum.load(std::memory_order_relaxed);
+    size_t reservedCount;
+    do
+    {
+        reservedCount = expectedFreeBlockNum < i_count ? expectedFreeBlockNum : i_count;
+        if (reservedCount == 0)
+        {
+            return 0;
+        }
+    } while (!freeBlockNum.compare_exchange_weak(expectedFreeBlockNum, expectedFreeBlockNum - reservedCount, std::memory_order_acquire, std::memory_order_relaxed));
+
+    const size_t elementCount = m_BitArray.m_elementCount;
+    const size_t bitsPerElement = m_BitArray.bitsPerElement;
+    const size_t searchOffset = GetConcurrentSearchOffset() % elementCount;
+    const size_t startElement = (AsAtomic(m_firstFreeBlockHint).load(std::memory_order_relaxed) / bitsPerElement + searchOffset) % elementCount;
+
+    // Walk the elements from the start, wrapping around, until every reserved block is claimed
+    size_t claimedCount = 0;
+    size_t elementIndex = startElement;
+    while (claimedCount < reservedCount)
+    {
+        const t_BitData claimedBits = m_BitArray.AtomicSetClearBits(elementIndex, reservedCount - claimedCount);
+        claimedCount += initBlocks(elementIndex, claimedBits, o_ptrs + claimedCount);
+
+        if (claimedCount < reservedCount && ++elementIndex == elementCount)
+        {
+            elementIndex = 0;
+        }
+    }
+
+    if (elementIndex != startElement)
+    {
+        AsAtomic(m_firstFreeBlockHint).store(((elementIndex + elementCount - searchOffset) % elementCount) * bitsPerElement, std::memory_order_relaxed);
+    }
+
+    return claimedCount;
+}
+
+template <size_t BlockSize, class Policy>
+void BasicFixedSizeAllocator<BlockSize, Policy>::Destroy() const
+{
+    // Cleanup
+    m_BitArray.ClearAll();
+}
+
+// Compiled once in FixedSizeAllocator.cpp
+extern template class BasicFixedSizeAllocator<FSA_DYNAMIC_BLOCK_SIZE, DefaultFixedSizeAllocatorPolicy>;
+
+/**
+ * @brief Returns the number of bytes CreateFixedSizeAllocator carves out of heapBaseAddr:
+ *        the allocator itself, its BitArray storage and all of its blocks (guardbands included).
+ */
+size_t GetFixedSizeAllocatorSize(size_t blockSize, size_t blockNum);
+
+template <size_t BlockSize, class Policy = DefaultFixedSizeAllocatorPolicy>
+size_t GetFixedSizeAllocatorSize(size_t blockNum)
+{
+    return BasicFixedSizeAllocator<BlockSize, Policy>::GetSize(BlockSize, blockNum);
+}
+
+/**
+ * @brief Creates a FixedSizeAllocator at heapBaseAddr, taking GetFixedSizeAllocatorSize(blockSize, blockNum) bytes.
+ *
+ * A concurrent allocator can be used from any number of threads without a lock: Alloc claims a block with a CAS on a
+ * word of its BitArray and Free releases it with a single atomic AND. A regular one has to be locked by its users.
+ */
+FixedSizeAllocator* CreateFixedSizeAllocator(size_t blockSize, size_t blockNum, void* heapBaseAddr, bool bConcurrent = false);
+
+/**
+ * @brief Creates a BasicFixedSizeAllocator with a compile-time block size at heapBaseAddr, taking
+ *        GetFixedSizeAllocatorSize<BlockSize, Policy>(blockNum) bytes.
+ */
+template <size_t BlockSize, class Policy = DefaultFixedSizeAllocatorPolicy>
+BasicFixedSizeAllocator<BlockSize, Policy>* CreateFixedSizeAllocator(size_t blockNum, void* heapBaseAddr, bool bConcurrent = false)
+{
+    static_assert(BlockSize != FSA_DYNAMIC_BLOCK_SIZE, "Pass the block size at runtime instead");
+    return BasicFixedSizeAllocator<BlockSize, Policy>::Create(BlockSize, blockNum, heapBaseAddr, bConcurrent);
+}
@@ -0,0 +1,106 @@
+﻿#pragma once
+
+#include "../Utilities/Atomics.h"
+
+#include <cstddef>
+#include <cstring>
+
+/**
+ * Compile-time policies of a BasicFixedSizeAllocator.
+ *
+ * Every policy is a set of static or empty inline functions, so an allocator instantiated with the No* policies
+ * carries no trace of them: no extra bytes per block, no extra members and no extra instructions.
+ */
+
+// Guardband policies: bytes written in front of and behind every block when it is allocated, checked when it is freed
+
+struct NoGuardbands
+{
+    static const size_t Size = 0;
+
+    static void Write(char*, size_t) {}
+    static bool Check(const char*, size_t) { return true; }
+};
+
+struct Guardbands
+{
+    static const size_t Size = 4;
+    static const unsigned int Pattern = 0xDEADBEEF;
+
+    // i_pBlock points at the front guardband, i_blockSize bytes of block follow it
+    static void Write(char* i_pBlock, size_t i_blockSize)
+    {
+        const unsigned int pattern = Pattern;
+        memcpy(i_pBlock, &pattern, Size);
+        memcpy(i_pBlock + Size + i_blockSize, &pattern, Size);
+    }
+
+    static bool Check(const char* i_pBlock, size_t i_blockSize)
+    {
+        const unsigned int pattern = Pattern;
+        return memcmp(i_pBlock, &pattern, Size) == 0 && memcmp(i_pBlock + Size + i_blockSize, &pattern, Size) == 0;
+    }
+};
+
+// Fill policies: what the bytes of a block are set to when it is handed out and when it is given back
+
+struct NoFill
+{
+    static void OnAlloc(void*, size_t) {}
+    static void OnFree(void*, size_t) {}
+};
+
+// The CRT's debug heap patterns by default: uninitialized reads show up as 0xCD, use after free as 0xDD
+template <unsigned char AllocPattern = 0xCD, unsigned char FreePattern = 0xDD>
+struct FillPattern
+{
+    static void OnAlloc(void* i_pBlock, size_t i_blockSize) { memset(i_pBlock, AllocPattern, i_blockSize); }
+    static void OnFree(void* i_pBlock, size_t i_blockSize) { memset(i_pBlock, FreePattern, i_blockSize); }
+};
+
+// Stats policies: the allocator derives from them, so an empty one takes no space
+
+struct NoStats
+{
+    void ResetStats() {}
+    void OnAlloc(size_t = 1) {}
+    void OnFree(size_t = 1) {}
+    void OnBadFree(size_t = 1) {}
+};
+
+struct CountingStats
+{
+    size_t m_allocCount;
+    size_t m_freeCount;
+    size_t m_badFreeCount;      // Frees of pointers that weren't allocated, double frees and overwritten guardbands
+
+    void ResetStats()
+    {
+        m_allocCount = 0;
+        m_freeCount = 0;
+        m_badFreeCount = 0;
+    }
+
+    // Relaxed atomics, concurrent allocators count from any number of threads
+    void OnAlloc(size_t i_count = 1) { AsAtomic(m_allocCount).fetch_add(i_count, std::memory_order_relaxed); }
+    void OnFree(size_t i_count = 1) { AsAtomic(m_freeCount).fetch_add(i_count, std::memory_order_relaxed); }
+    void OnBadFree(size_t i_count = 1) { AsAtomic(m_badFreeCount).fetch_add(i_count, std::memory_order_relaxed); }
+};
+
+template <class GuardbandPolicy, class FillPolicy, class StatsPolicy>
+struct FixedSizeAllocatorPolicy
+{
+    typedef GuardbandPolicy Guardband;
+    typedef FillPolicy Fill;
+    typedef StatsPolicy Stats;
+};
+
+typedef FixedSizeAllocatorPolicy<Guardbands, FillPattern<>, CountingStats> DebugFixedSizeAllocatorPolicy;
+typedef FixedSizeAllocatorPolicy<NoGuardbands, NoFill, NoStats> ReleaseFixedSizeAllocatorPolicy;
+
+// Checks cost nothing in release builds
+#ifdef _DEBUG
+typedef DebugFixedSizeAllocatorPolicy DefaultFixedSizeAllocatorPolicy;
+#else
+typedef ReleaseFixedSizeAllocatorPolicy DefaultFixedSizeAllocatorPolicy;
+#endif
@@ -0,0 +1,342 @@
+#include "GrowableFixedSizeAllocator.h"
+
+#include <cassert>
+
+// Unlinks a slab from the list it is in
+static void unlinkSlab(FixedSizeAllocator*& io_pList, FixedSizeAllocator* pSlab)
+{
+    if (pSlab->m_pPrevSlab)
+    {
+        pSlab->m_pPrevSlab->m_pNextSlab = pSlab->m_pNextSlab;
+    }
+    else
+    {
+        io_pList = pSlab->m_pNextSlab;
+    }
+
+    if (pSlab->m_pNextSlab)
+    {
+        pSlab->m_pNextSlab->m_pPrevSlab = pSlab->m_pPrevSlab;
+    }
+}
+
+// Pushes a slab onto the front of a list
+static void pushSlab(FixedSizeAllocator*& io_pList, FixedSizeAllocator* pSlab)
+{
+    pSlab->m_pPrevSlab = nullptr;
+    pSlab->m_pNextSlab = io_pList;
+    if (io_pList)
+    {
+        io_pList->m_pPrevSlab = pSlab;
+    }
+    io_pList = pSlab;
+}
+
+GrowableFixedSizeAllocator* CreateGrowableFixedSizeAllocator(void* pMemory, size_t blockSize, size_t slabSize, unsigned int owner, const SlabSource& slabSource)
+{
+    assert((slabSize & (slabSize - 1)) == 0);
+
+    GrowableFixedSizeAllocator* pAllocator = static_cast<GrowableFixedSizeAllocator*>(pMemory);
+
+    // As many blocks as fit the slab next to the FixedSizeAllocator and its BitArray
+    const size_t usableSlabSize = slabSize - slabSource.m_slabTailReserve;
+    size_t slabBlockNum = usableSlabSize / blockSize;
+    while (slabBlockNum > 0 && GetFixedSizeAllocatorSize(blockSize, slabBlockNum) > usableSlabSize)
+    {
+        slabBlockNum--;
+    }
+    assert(slabBlockNum > 0);
+
+    pAllocator->m_blockSize = blockSize;
+    pAllocator->m_slabSize = slabSize;
+    pAllocator->m_slabBlockNum = slabBlockNum;
+    pAllocator->m_blockNum = 0;
+    pAllocator->m_freeBlockNum = 0;
+    pAllocator->m_slabCount = 0;
+    pAllocator->m_reservedSlabCount = 0;
+    pAllocator->m_emptySlabCount = 0;
+    pAllocator->m_owner = owner;
+    pAllocator->m_slabSource = slabSource;
+    pAllocator->m_pPartialSlabs = nullptr;
+    pAllocator->m_pFullSlabs = nullptr;
+    pAllocator->m_pReleaseCursor = nullptr;
+    return pAllocator;
+}
+
+bool GrowableFixedSizeAllocator::Reserve(size_t i_blockNum)
+{
+    while (m_blockNum < i_blockNum)
+    {
+        if (!addSlab())
+        {
+            return false;
+        }
+    }
+
+    FixedSizeAllocator* lists[] = { m_pPartialSlabs, m_pFullSlabs };
+    for (FixedSizeAllocator* pSlab : lists)
+    {
+        for (; pSlab; pSlab = pSlab->m_pNextSlab)
+        {
+            if (!pSlab->m_bReservedSlab)
+            {
+                pSlab->m_bReservedSlab = true;
+                m_reservedSlabCount++;
+                if (pSlab->m_freeBlockNum == pSlab->m_blockNum)
+                {
+                    m_emptySlabCount--;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool GrowableFixedSizeAllocator::IsBlockAddress(const void* ptr) const
+{
+    return getSlab(ptr)->IsBlockAddress(ptr);
+}
+
+bool GrowableFixedSizeAllocator::IsAllocated(const void* ptr) const
+{
+    return getSlab(ptr)->IsAllocated(ptr);
+}
+
+void* GrowableFixedSizeAllocator::Alloc()
+{
+    FixedSizeAllocator* pSlab = m_pPartialSlabs;
+    if (pSlab == nullptr)
+    {
+        // Every slab is full, grow
+        pSlab = addSlab();
+        if (pSlab == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    if (!pSlab->m_bReservedSlab && pSlab->m_freeBlockNum == pSlab->m_blockNum)
+    {
+        m_emptySlabCount--;
+    }
+
+    void* ptr = pSlab->Alloc();
+    assert(ptr);
+    m_freeBlockNum--;
+
+    // Full slabs move out of the way, the next Alloc finds a free block in the first slab again
+    if (pSlab->m_freeBlockNum == 0)
+    {
+        unlinkPartialSlab(pSlab);
+        pushSlab(m_pFullSlabs, pSlab);
+    }
+
+    return ptr;
+}
+
+bool GrowableFixedSizeAllocator::Free(void* ptr)
+{
+    FixedSizeAllocator* pSlab = getSlab(ptr);
+    const bool bWasFull = pSlab->m_freeBlockNum == 0;
+
+    if (!pSlab->Free(ptr))
+    {
+        return false;
+    }
+    m_freeBlockNum++;
+
+    onBlocksFreed(pSlab, bWasFull);
+    return true;
+}
+
+size_t GrowableFixedSizeAllocator::AllocBatch(void** o_ptrs, size_t i_count)
+{
+    size_t allocCount = 0;
+    while (allocCount < i_count)
+    {
+        FixedSizeAllocator* pSlab = m_pPartialSlabs;
+        if (pSlab == nullptr)
+        {
+            pSlab = addSlab();
+            if (pSlab == nullptr)
+            {
+                break;
+            }
+        }
+
+        if (!pSlab->m_bReservedSlab && pSlab->m_freeBlockNum == pSlab->m_blockNum)
+        {
+            m_emptySlabCount--;
+        }
+
+        // Takes as many blocks of the slab as it has, the loop only moves on to the next slab once this one is full
+        const size_t count = pSlab->AllocBatch(o_ptrs + allocCount, i_count - allocCount);
+        assert(count > 0);
+        allocCount += count;
+        m_freeBlockNum -= count;
+
+        if (pSlab->m_freeBlockNum == 0)
+        {
+            unlinkPartialSlab(pSlab);
+            pushSlab(m_pFullSlabs, pSlab);
+        }
+    }
+
+    return allocCount;
+}
+
+size_t GrowableFixedSizeAllocator::FreeBatch(void* const* i_ptrs, size_t i_count)
+{
+    size_t freeCount = 0;
+    size_t runStart = 0;
+    while (runStart < i_count)
+    {
+        // Consecutive blocks of the same slab go to it in one FreeBatch
+        FixedSizeAllocator* pSlab = getSlab(i_ptrs[runStart]);
+        size_t runEnd = runStart + 1;
+        while (runEnd < i_count && getSlab(i_ptrs[runEnd]) == pSlab)
+        {
+            runEnd++;
+        }
+
+        const bool bWasFull = pSlab->m_freeBlockNum == 0;
+        const size_t count = pSlab->FreeBatch(i_ptrs + runStart, runEnd - runStart);
+        if (count > 0)
+        {
+            freeCount += count;
+            m_freeBlockNum += count;
+            onBlocksFreed(pSlab, bWasFull);
+        }
+
+        runStart = runEnd;
+    }
+
+    return freeCount;
+}
+
+void GrowableFixedSizeAllocator::ReleaseEmptySlabs()
+{
+    FixedSizeAllocator* pSlab = m_pPartialSlabs;
+    while (pSlab)
+    {
+        FixedSizeAllocator* pNextSlab = pSlab->m_pNextSlab;
+        if (!pSlab->m_bReservedSlab && pSlab->m_freeBlockNum == pSlab->m_blockNum)
+        {
+            releaseSlab(pSlab);
+        }
+        pSlab = pNextSlab;
+    }
+}
+
+bool GrowableFixedSizeAllocator::ReleaseEmptySlabs(size_t i_maxSlabs, size_t& o_slabsVisited)
+{
+    o_slabsVisited = 0;
+
+    FixedSizeAllocator* pSlab = m_pReleaseCursor ? m_pReleaseCursor : m_pPartialSlabs;
+    while (pSlab && o_slabsVisited < i_maxSlabs)
+    {
+        FixedSizeAllocator* pNextSlab = pSlab->m_pNextSlab;
+        if (!pSlab->m_bReservedSlab && pSlab->m_freeBlockNum == pSlab->m_blockNum)
+        {
+            releaseSlab(pSlab);
+        }
+        o_slabsVisited++;
+        pSlab = pNextSlab;
+    }
+
+    m_pReleaseCursor = pSlab;
+    return pSlab == nullptr;
+}
+
+void GrowableFixedSizeAllocator::Destroy()
+{
+    FixedSizeAllocator* lists[] = { m_pPartialSlabs, m_pFullSlabs };
+    for (FixedSizeAllocator* pSlab : lists)
+    {
+        while (pSlab)
+        {
+            FixedSizeAllocator* pNextSlab = pSlab->m_pNextSlab;
+            pSlab->Destroy();
+            m_slabSource.m_pFreeSlab(pSlab, m_slabSize);
+            pSlab = pNextSlab;
+        }
+    }
+
+    m_pPartialSlabs = nullptr;
+    m_pFullSlabs = nullptr;
+    m_pReleaseCursor = nullptr;
+    m_slabCount = 0;
+    m_reservedSlabCount = 0;
+    m_emptySlabCount = 0;
+    m_blockNum = 0;
+    m_freeBlockNum = 0;
+}
+
+FixedSizeAllocator* GrowableFixedSizeAllocator::getSlab(const void* ptr) const
+{
+    // Slabs are aligned to their size and start with their FixedSizeAllocator
+    return reinterpret_cast<FixedSizeAllocator*>(reinterpret_cast<uintptr_t>(ptr) & ~(static_cast<uintptr_t>(m_slabSize) - 1));
+}
+
+FixedSizeAllocator* GrowableFixedSizeAllocator::addSlab()
+{
+    void* pSlabMemory = m_slabSource.m_pAllocSlab(m_slabSize, m_owner);
+    if (pSlabMemory == nullptr)
+    {
+        return nullptr;
+    }
+    assert((reinterpret_cast<uintptr_t>(pSlabMemory) & (m_slabSize - 1)) == 0);
+
+    FixedSizeAllocator* pSlab = CreateFixedSizeAllocator(m_blockSize, m_slabBlockNum, pSlabMemory);
+    pushSlab(m_pPartialSlabs, pSlab);
+
+    m_slabCount++;
+    m_emptySlabCount++;
+    m_blockNum += m_slabBlockNum;
+    m_freeBlockNum += m_slabBlockNum;
+    return pSlab;
+}
+
+void GrowableFixedSizeAllocator::unlinkPartialSlab(FixedSizeAllocator* pSlab)
+{
+    if (pSlab == m_pReleaseCursor)
+    {
+        m_pReleaseCursor = pSlab->m_pNextSlab;
+    }
+    unlinkSlab(m_pPartialSlabs, pSlab);
+}
+
+void GrowableFixedSizeAllocator::onBlocksFreed(FixedSizeAllocator* pSlab, bool bWasFull)
+{
+    if (bWasFull)
+    {
+        unlinkSlab(m_pFullSlabs, pSlab);
+        pushSlab(m_pPartialSlabs, pSlab);
+    }
+
+    if (!pSlab->m_bReservedSlab && pSlab->m_freeBlockNum == pSlab->m_blockNum)
+    {
+        m_emptySlabCount++;
+
+        // Hysteresis: only give slabs back once more than a few are sitting empty
+        if (m_emptySlabCount > FSA_MAX_EMPTY_SLABS)
+        {
+            releaseSlab(pSlab);
+        }
+    }
+}
+
+void GrowableFixedSizeAllocator::releaseSlab(FixedSizeAllocator* pSlab)
+{
+    assert(!pSlab->m_bReservedSlab && pSlab->m_freeBlockNum == pSlab->m_blockNum);
+
+    unlinkPartialSlab(pSlab);
+
+    m_slabCount--;
+    m_emptySlabCount--;
+    m_blockNum -= m_slabBlockNum;
+    m_freeBlockNum -= m_slabBlockNum;
+
+    pSlab->Destroy();
+    m_slabSource.m_pFreeSlab(pSlab, m_slabSize);
+}
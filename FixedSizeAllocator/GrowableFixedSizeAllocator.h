@@ -0,0 +1,124 @@
+#pragma once
+
+#include "FixedSizeAllocator.h"
+
+// Empty slabs a GrowableFixedSizeAllocator keeps around before it gives them back, so a workload hovering
+// around a slab boundary doesn't allocate and release the same slab over and over
+const size_t FSA_MAX_EMPTY_SLABS = 1;
+
+/**
+ * @brief Where a GrowableFixedSizeAllocator gets its slabs from and gives them back to.
+ */
+struct SlabSource
+{
+    // Returns i_slabSize - m_slabTailReserve bytes aligned to i_slabSize for the allocator identified by i_owner,
+    // nullptr if there is no memory left
+    void* (*m_pAllocSlab)(size_t i_slabSize, unsigned int i_owner);
+
+    // Takes back a slab m_pAllocSlab returned
+    void (*m_pFreeSlab)(void* i_pSlab, size_t i_slabSize);
+
+    // Bytes at the end of every slab the source keeps for itself, e.g. for the header of whatever follows the slab,
+    // so that slabs can sit back to back
+    size_t m_slabTailReserve;
+};
+
+/**
+ * @class GrowableFixedSizeAllocator
+ *
+ * @brief A FixedSizeAllocator that grows by adding slabs of the same block size instead of running out.
+ *
+ * Every slab is a FixedSizeAllocator placed at the start of a block of m_slabSize bytes that is aligned to
+ * m_slabSize, so the slab of any block is found by masking its address. Slabs that still have free blocks are kept
+ * at the front of the slab list, so Alloc takes the first slab in O(1) and only asks the SlabSource for a new slab
+ * when every slab is full. Slabs that become completely empty are given back once more than FSA_MAX_EMPTY_SLABS of
+ * them pile up, except for the slabs added by Reserve, which stay where they were placed.
+ *
+ * Not thread-safe, users lock it the same way as a FixedSizeAllocator.
+ */
+class GrowableFixedSizeAllocator
+{
+public:
+    size_t m_blockSize;
+    size_t m_slabSize;
+    size_t m_slabBlockNum;              // Blocks per slab
+    size_t m_blockNum;                  // Over all slabs
+    size_t m_freeBlockNum;              // Over all slabs
+    size_t m_slabCount;
+    size_t m_reservedSlabCount;         // Slabs reserved up front, never given back
+    size_t m_emptySlabCount;            // Empty slabs that may be given back
+    unsigned int m_owner;               // Passed on to the SlabSource
+    SlabSource m_slabSource;
+    FixedSizeAllocator* m_pPartialSlabs;    // Slabs with free blocks, linked through m_pNextSlab / m_pPrevSlab
+    FixedSizeAllocator* m_pFullSlabs;
+    FixedSizeAllocator* m_pReleaseCursor;   // Partial slab the next bounded ReleaseEmptySlabs starts at, nullptr for the front
+
+    /**
+     * @brief Adds slabs until at least i_blockNum blocks exist and keeps all of them for the allocator's lifetime.
+     *
+     * @return false if the SlabSource ran out of memory first.
+     */
+    bool Reserve(size_t i_blockNum);
+
+    bool IsBlockAddress(const void* ptr) const;
+
+    bool IsAllocated(const void* ptr) const;
+
+    void* Alloc();
+
+    bool Free(void* ptr);
+
+    /**
+     * @brief Allocates up to i_count blocks into o_ptrs a slab at a time, see FixedSizeAllocator::AllocBatch.
+     *
+     * @return The number of blocks allocated, fewer than i_count only if the SlabSource ran out of memory.
+     */
+    size_t AllocBatch(void** o_ptrs, size_t i_count);
+
+    /**
+     * @brief Frees the i_count blocks in i_ptrs, handing every run of blocks from the same slab to it in one FreeBatch.
+     *
+     * @return The number of blocks freed.
+     */
+    size_t FreeBatch(void* const* i_ptrs, size_t i_count);
+
+    /**
+     * @brief Gives every empty slab above the reserved ones back to the SlabSource, hysteresis or not.
+     */
+    void ReleaseEmptySlabs();
+
+    /**
+     * @brief Like ReleaseEmptySlabs, but looks at no more than i_maxSlabs partial slabs, continuing where the last call stopped.
+     *
+     * @param o_slabsVisited Receives the number of slabs looked at.
+     * @return true if the end of the partial slab list was reached, the next call starts over at its front.
+     */
+    bool ReleaseEmptySlabs(size_t i_maxSlabs, size_t& o_slabsVisited);
+
+    /**
+     * @brief Gives every slab back to the SlabSource, blocks still allocated or not.
+     */
+    void Destroy();
+
+private:
+    FixedSizeAllocator* getSlab(const void* ptr) const;
+
+    FixedSizeAllocator* addSlab();
+
+    // Unlinks a slab from the partial list, moving m_pReleaseCursor past it
+    void unlinkPartialSlab(FixedSizeAllocator* pSlab);
+
+    // Moves a slab some blocks were just freed from back to the partial list and gives it back if it is now empty
+    void onBlocksFreed(FixedSizeAllocator* pSlab, bool bWasFull);
+
+    void releaseSlab(FixedSizeAllocator* pSlab);
+};
+
+/**
+ * @brief Creates a GrowableFixedSizeAllocator without any slabs at pMemory, which must hold
+ *        sizeof(GrowableFixedSizeAllocator) bytes.
+ *
+ * @param slabSize Size and alignment of every slab, a power of 2 large enough for a FixedSizeAllocator with at least one block.
+ * @param owner Identifies the allocator to the SlabSource.
+ */
+GrowableFixedSizeAllocator* CreateGrowableFixedSizeAllocator(void* pMemory, size_t blockSize, size_t slabSize, unsigned int owner, const SlabSource& slabSource);
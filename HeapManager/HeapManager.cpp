@@ -1,18 +1,41 @@
 #include "HeapManager.h"
+#include "../Utilities/BitScan.h"
 #include "../Utilities/PointerMath.h"
+#include "../Utilities/VirtualMemory.h"
 #include <cstdio>
-#include <tuple>
+#include <cstring>
 
 # define HEAP_MANAGER_OVERHEAD sizeof(HeapManager)
 # define MEMORY_BLOCK_OVERHEAD sizeof(MemoryBlock)
 
+// Number of slots of the descriptor table: at most every descriptor is allocated, so the table stays at most half full
+// and probes stay short
+static size_t getDescriptorTableSize(unsigned int numDescriptors)
+{
+	size_t tableSize = 1;
+	while (tableSize < 2 * static_cast<size_t>(numDescriptors))
+	{
+		tableSize <<= 1;
+	}
+	return tableSize;
+}
+
+// Rounds a size up to the next multiple of alignment, which must be a power of 2
+inline size_t alignSizeUp(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
 HeapManager* CreateHeapManager(void* pHeapBaseAddress, size_t heapSize, unsigned int numDescriptors)
 {
 	assert(pHeapBaseAddress != nullptr);
 	assert(heapSize > 0);
-	
+
 	HeapManager* pHeapManager = static_cast<HeapManager*>(pHeapBaseAddress);
-	pHeapManager->Init(pHeapBaseAddress, heapSize, numDescriptors);
+	if (!pHeapManager->Init(pHeapBaseAddress, heapSize, numDescriptors))
+	{
+		return nullptr;
+	}
 
 	return pHeapManager;
 }
@@ -24,17 +47,59 @@ HeapManager::HeapManager()
 HeapManager::~HeapManager()
 = default;
 
-void HeapManager::Init(void* pHeapBaseAddress, size_t heapSize, unsigned numDescriptors)
+bool HeapManager::Init(void* pHeapBaseAddress, size_t heapSize, unsigned numDescriptors)
 {
 	m_pHeapBaseAddress = pHeapBaseAddress;
 	m_heapSize = heapSize;
-	
-	// Initialize the linked list of free memory blocks
-	MemoryBlock* pFirstMemoryBlock = createNewBlock(PointerAdd(pHeapBaseAddress, HEAP_MANAGER_OVERHEAD), heapSize - HEAP_MANAGER_OVERHEAD - MEMORY_BLOCK_OVERHEAD);
-	m_pFreeMemoryBlockList = pFirstMemoryBlock;
+
+	// The descriptor pool, if there is one, sits between the HeapManager and the first block's data
+	void* pFirstBlockAddress = PointerAdd(pHeapBaseAddress, HEAP_MANAGER_OVERHEAD);
+	m_pDescriptorPool = nullptr;
+	m_pFreeDescriptors = nullptr;
+	m_pDescriptorTable = nullptr;
+	m_descriptorTableMask = 0;
+	m_blockOverhead = MEMORY_BLOCK_OVERHEAD;
+	const uintptr_t heapEnd = reinterpret_cast<uintptr_t>(pHeapBaseAddress) + heapSize;
+	if (numDescriptors > 0)
+	{
+		const size_t poolSize = alignof(BlockDescriptor) - 1 + numDescriptors * sizeof(BlockDescriptor) + getDescriptorTableSize(numDescriptors) * sizeof(MemoryBlock*);
+		if (heapSize < HEAP_MANAGER_OVERHEAD + poolSize)
+		{
+			return false;
+		}
+		pFirstBlockAddress = initDescriptorPool(pFirstBlockAddress, numDescriptors);
+		m_blockOverhead = 0;
+	}
+	pFirstBlockAddress = PointerAlignUp(pFirstBlockAddress, HEAP_BLOCK_GRANULARITY);
+	if (reinterpret_cast<uintptr_t>(pFirstBlockAddress) + m_blockOverhead + HEAP_MIN_BLOCK_SIZE > heapEnd)
+	{
+		return false;
+	}
+
+	// All bins start out empty
+	m_freeBlockSize = 0;
+	m_pCollectCursor = nullptr;
+	m_pNextArena = nullptr;
+	m_emptyDecayCount = 0;
+	m_firstLevelBitmap = 0;
+	for (unsigned int fl = 0; fl < HEAP_FL_INDEX_COUNT; fl++)
+	{
+		m_secondLevelBitmap[fl] = 0;
+		for (unsigned int sl = 0; sl < HEAP_SL_INDEX_COUNT; sl++)
+		{
+			m_pFreeBlockLists[fl][sl] = nullptr;
+		}
+	}
+
+	// The whole heap after the HeapManager starts out as one free block
+	const size_t firstBlockSize = (heapEnd - reinterpret_cast<uintptr_t>(pFirstBlockAddress) - m_blockOverhead) & ~(HEAP_BLOCK_GRANULARITY - 1);
+	m_pFirstBlock = createNewBlock(pFirstBlockAddress, firstBlockSize, nullptr);
+	insertFreeBlock(m_pFirstBlock);
 
 	// Initialize the linked list of outstanding allocations (empty at the start)
 	m_pOutstandingAllocationList = nullptr;
+	m_outstandingBlockSize = 0;
+	return true;
 }
 
 void* HeapManager::Alloc(size_t size, size_t alignment)
@@ -46,174 +111,302 @@ void* HeapManager::Alloc(size_t size, size_t alignment)
 	{
 		alignment = 1; // Treat as no alignment requirement
 	}
-	
-	MemoryBlock* pSuitableBlock;
-	MemoryBlock* pPreviousBlock;
-	std::tie(pSuitableBlock, pPreviousBlock) = findSuitableBlock(size + MEMORY_BLOCK_OVERHEAD, alignment);
-	
-	//If no suitable block is found, attempt to de-fragment the heap
+	assert((alignment & (alignment - 1)) == 0);
+
+	// Keep every block, and so every MemoryBlock, HEAP_BLOCK_GRANULARITY aligned
+	size = alignSizeUp(size, HEAP_BLOCK_GRANULARITY);
+
+	// Free merges blocks right away, so if no block is large enough now, none will be after collecting either
+	MemoryBlock* pSuitableBlock = findSuitableBlock(size, alignment);
 	if (!pSuitableBlock)
 	{
-		Collect();
-		std::tie(pSuitableBlock, pPreviousBlock) = findSuitableBlock(size + MEMORY_BLOCK_OVERHEAD, alignment);
+		return nullptr;
 	}
 
-	// If a suitable block is still not found after defragmentation, return nullptr
-	if (!pSuitableBlock)
+	removeFreeBlock(pSuitableBlock);
+
+	// Place the data at the first suitably aligned address of the block that leaves a usable gap (or none)
+	const uintptr_t rawAddress = reinterpret_cast<uintptr_t>(getBlockData(pSuitableBlock));
+	const size_t adjustment = getAlignmentAdjustment(rawAddress, alignment);
+
+	MemoryBlock* pNewBlock = pSuitableBlock;
+	if (adjustment > 0)
 	{
-		return nullptr;
+		// The alignment gap becomes a free block of its own, the allocation starts right after it
+		pNewBlock = createNewBlock(reinterpret_cast<void*>(rawAddress + adjustment - m_blockOverhead), pSuitableBlock->GetBlockSize() - adjustment, pSuitableBlock);
+		if (!pNewBlock)
+		{
+			// No descriptor left for the block after the gap
+			insertFreeBlock(pSuitableBlock);
+			return nullptr;
+		}
+		pSuitableBlock->SetBlockSize(adjustment - m_blockOverhead);
+		insertFreeBlock(pSuitableBlock);
+		linkNextPhysicalBlock(pNewBlock);
 	}
-	
-	// Calculate the raw address of suitable block before alignment
-	char* rawAddress = static_cast<char*>(pSuitableBlock->pBaseAddress) - pSuitableBlock->AlignmentAdjustment;
 
-	// Calculate the adjustment for new block adjustment
-	const size_t adjustment = (alignment - (reinterpret_cast<uintptr_t>(rawAddress) & (alignment - 1))) % alignment;
+	// Give the tail back to the bins if it is big enough
+	shrinkBlock(pNewBlock, size);
 
-	// Adjust the new block size to include the alignment adjustment
-	const size_t totalSize = size + adjustment;
+	return markAllocated(pNewBlock);
+}
 
-	// Shrink the suitable block by need
-	shrinkBlock(pSuitableBlock, pPreviousBlock, totalSize);
+size_t HeapManager::AllocBatch(size_t size, size_t count, void** o_ptrs)
+{
+	assert(size > 0);
 
-	// Calculate the final address for the allocated block
-	char* finalAddress = rawAddress + adjustment - MEMORY_BLOCK_OVERHEAD;
+	size = alignSizeUp(size, HEAP_BLOCK_GRANULARITY);
+	const size_t chunkStride = size + m_blockOverhead;
+	const size_t maxChunkCount = m_heapSize / chunkStride;
 
-	// Create allocated block
-	MemoryBlock* pNewBlock = createNewBlock(finalAddress, size);
+	size_t allocCount = 0;
+	while (allocCount < count)
+	{
+		// One free block large enough for every chunk still missing, otherwise any block that holds at least one
+		const size_t wantedCount = count - allocCount < maxChunkCount ? count - allocCount : maxChunkCount;
+		MemoryBlock* pBlock = wantedCount > 0 ? findSuitableBlock(wantedCount * chunkStride - m_blockOverhead, 1) : nullptr;
+		if (!pBlock)
+		{
+			pBlock = findSuitableBlock(size, 1);
+			if (!pBlock)
+			{
+				break;
+			}
+		}
 
-	pNewBlock->AlignmentAdjustment = adjustment;
-	
-	// track allocation
-	pNewBlock->pNextBlock = m_pOutstandingAllocationList;
-	m_pOutstandingAllocationList = pNewBlock;
+		removeFreeBlock(pBlock);
+		allocCount += carveChunks(pBlock, size, count - allocCount, o_ptrs + allocCount);
+	}
 
-	return pNewBlock->pBaseAddress;
+	return allocCount;
 }
 
 bool HeapManager::Free(const void* ptr)
 {
-		assert(ptr);
+	assert(ptr);
 
-		// Find the block in the outstanding allocation list
-		MemoryBlock* pCurrentBlock = m_pOutstandingAllocationList;
-		MemoryBlock* pPreviousBlock = nullptr;
+	// The MemoryBlock sits right in front of the pointer, no list search needed
+	MemoryBlock* pCurrentBlock = findAllocatedBlock(ptr);
+	if (!pCurrentBlock)
+	{
+		// Not an outstanding allocation of this heap (or already freed)
+		return false;
+	}
 
-		while (pCurrentBlock)
-		{
-			if (pCurrentBlock->pBaseAddress == ptr)
-			{
-				// Found the block to free
+#ifdef HEAP_MANAGER_TRACK_ALLOCATIONS
+	// Remove the block from the outstanding allocation list
+	MemoryBlock** ppLink = &m_pOutstandingAllocationList;
+	while (*ppLink != pCurrentBlock)
+	{
+		assert(*ppLink && "Outstanding allocation missing from the tracking list");
+		ppLink = &(*ppLink)->pNextAllocation;
+	}
+	*ppLink = pCurrentBlock->pNextAllocation;
+#endif
 
-				// Remove the block from the outstanding allocation list
-				if (pPreviousBlock)
-				{
-					pPreviousBlock->pNextBlock = pCurrentBlock->pNextBlock;
-				}
-				else
-				{
-					m_pOutstandingAllocationList = pCurrentBlock->pNextBlock;
-				}
+	m_outstandingBlockSize -= pCurrentBlock->GetBlockSize() + m_blockOverhead;
 
-				// Insert the block back to the free memory block list in the correct position
-				MemoryBlock* pFreeMemoryBlock = m_pFreeMemoryBlockList;
-				MemoryBlock* pPrevMemoryBlock = nullptr;
-				while (pFreeMemoryBlock && reinterpret_cast<uintptr_t>(pFreeMemoryBlock) < reinterpret_cast<uintptr_t>(pCurrentBlock))
-				{
-					pPrevMemoryBlock = pFreeMemoryBlock;
-					pFreeMemoryBlock = pFreeMemoryBlock->pNextBlock;
-				}
+	// A second Free of the same pointer fails the check above
+	if (m_pDescriptorPool)
+	{
+		unregisterDescriptor(pCurrentBlock);
+	}
+	pCurrentBlock->SetAllocated(false);
 
-				if (pPrevMemoryBlock)
-				{
-					pPrevMemoryBlock->pNextBlock = pCurrentBlock;
-				}
-				else
-				{
-					m_pFreeMemoryBlockList = pCurrentBlock;
-				}
-				pCurrentBlock->pNextBlock = pFreeMemoryBlock;
+	// Merge with the block physically after this one if it is free
+	MemoryBlock* pNextPhysicalBlock = getNextPhysicalBlock(pCurrentBlock);
+	if (pNextPhysicalBlock && !pNextPhysicalBlock->IsAllocated())
+	{
+		removeFreeBlock(pNextPhysicalBlock);
+		mergeNextPhysicalBlock(pCurrentBlock, pNextPhysicalBlock);
+	}
 
-				return true;
-			}
+	// Merge into the block physically in front of this one if it is free
+	MemoryBlock* pPrevPhysicalBlock = getPrevPhysicalBlock(pCurrentBlock);
+	if (pPrevPhysicalBlock && !pPrevPhysicalBlock->IsAllocated())
+	{
+		removeFreeBlock(pPrevPhysicalBlock);
+		mergeNextPhysicalBlock(pPrevPhysicalBlock, pCurrentBlock);
+		pCurrentBlock = pPrevPhysicalBlock;
+	}
 
-			pPreviousBlock = pCurrentBlock;
-			pCurrentBlock = pCurrentBlock->pNextBlock;
-		}
+	linkNextPhysicalBlock(pCurrentBlock);
+	insertFreeBlock(pCurrentBlock);
 
-		// Block not found in the outstanding allocation list
-		return false;
+	return true;
 }
 
-void HeapManager::Collect() const
+void* HeapManager::Realloc(const void* ptr, size_t size)
 {
-	bool bShouldMerge;
+	assert(ptr);
+	assert(size > 0);
 
-	do
+	MemoryBlock* pBlock = findAllocatedBlock(ptr);
+	if (!pBlock)
 	{
-		bShouldMerge = false;
-		MemoryBlock* pCurrentBlock = m_pFreeMemoryBlockList;
+		// Not an outstanding allocation of this heap
+		return nullptr;
+	}
 
-		while (pCurrentBlock && pCurrentBlock->pNextBlock)
+	const size_t oldBlockSize = pBlock->GetBlockSize();
+	const size_t newSize = alignSizeUp(size, HEAP_BLOCK_GRANULARITY);
+
+	// Growing takes the free block physically after this one if together they are large enough. Shrinking takes it
+	// as well, so the tail split off below merges with it instead of ending up next to a free block
+	MemoryBlock* pNextPhysicalBlock = getNextPhysicalBlock(pBlock);
+	const bool bNextIsFree = pNextPhysicalBlock && !pNextPhysicalBlock->IsAllocated();
+	if (newSize <= oldBlockSize || (bNextIsFree && oldBlockSize + m_blockOverhead + pNextPhysicalBlock->GetBlockSize() >= newSize))
+	{
+		if (bNextIsFree)
 		{
-			const uintptr_t currentBlockEnd = reinterpret_cast<uintptr_t>(pCurrentBlock->pBaseAddress) + pCurrentBlock->BlockSize - pCurrentBlock->AlignmentAdjustment;
+			removeFreeBlock(pNextPhysicalBlock);
+			mergeNextPhysicalBlock(pBlock, pNextPhysicalBlock);
+			linkNextPhysicalBlock(pBlock);
+		}
+
+		shrinkBlock(pBlock, newSize);
+		m_outstandingBlockSize += pBlock->GetBlockSize();
+		m_outstandingBlockSize -= oldBlockSize;
+		return getBlockData(pBlock);
+	}
+
+	// Last resort: move, at the default alignment
+	void* pNewPtr = Alloc(newSize, HEAP_BLOCK_GRANULARITY);
+	if (!pNewPtr)
+	{
+		return nullptr;
+	}
+
+	memcpy(pNewPtr, ptr, oldBlockSize);
+	Free(ptr);
+	return pNewPtr;
+}
+
+void HeapManager::Collect()
+{
+	// Restart the walk, so it covers the whole heap in one go
+	m_pCollectCursor = nullptr;
 
-			MemoryBlock* pNextBlock = pCurrentBlock->pNextBlock;
-			const uintptr_t nextBlockStart = reinterpret_cast<uintptr_t>(pNextBlock) - pNextBlock->AlignmentAdjustment;
+	size_t blocksVisited;
+	const bool bDone = Collect(SIZE_MAX, blocksVisited);
+	assert(bDone);
+	(void)bDone;
+}
+
+bool HeapManager::Collect(size_t i_maxBlocks, size_t& o_blocksVisited)
+{
+	o_blocksVisited = 0;
+
+#ifdef _DEBUG
+	// Walk the heap in address order, every boundary tag has to point at the block in front of it, every block's data
+	// has to follow the one in front of it, and Free must have left no two free blocks next to each other
+	MemoryBlock* pCurrentBlock = m_pCollectCursor ? m_pCollectCursor : getFirstBlock();
+	for (; pCurrentBlock && o_blocksVisited < i_maxBlocks; pCurrentBlock = getNextPhysicalBlock(pCurrentBlock))
+	{
+		const MemoryBlock* pPrevBlock = getPrevPhysicalBlock(pCurrentBlock);
+		assert(pPrevBlock ? getNextPhysicalBlock(pPrevBlock) == pCurrentBlock : pCurrentBlock == getFirstBlock());
+		assert(!pPrevBlock || getBlockData(pCurrentBlock) == PointerAdd(getBlockData(pPrevBlock), pPrevBlock->GetBlockSize() + m_blockOverhead));
+		assert(!(pPrevBlock && !pPrevBlock->IsAllocated() && !pCurrentBlock->IsAllocated()));
+		o_blocksVisited++;
+	}
+
+	m_pCollectCursor = pCurrentBlock;
+	if (pCurrentBlock)
+	{
+		return false;
+	}
 
-			// Check if the current block and the next block are adjacent
-			if (currentBlockEnd == nextBlockStart)
+	// A whole pass is done, the running total of free bytes has to match the bins
+	size_t freeBlockSize = 0;
+	for (unsigned int fl = 0; fl < HEAP_FL_INDEX_COUNT; fl++)
+	{
+		for (unsigned int sl = 0; sl < HEAP_SL_INDEX_COUNT; sl++)
+		{
+			for (const MemoryBlock* pBlock = m_pFreeBlockLists[fl][sl]; pBlock; pBlock = getFreeLinks(pBlock)->pNextBlock)
 			{
-				// Merge the blocks
-				pCurrentBlock->BlockSize += pCurrentBlock->pNextBlock->BlockSize + MEMORY_BLOCK_OVERHEAD + pCurrentBlock->pNextBlock->AlignmentAdjustment;
-
-				// Remove next block from the free block list
-				pCurrentBlock->pNextBlock = pNextBlock->pNextBlock;
-				pNextBlock = nullptr;
-				
-				// merging two blocks might create a new opportunity for further merging
-				bShouldMerge = true;
+				freeBlockSize += pBlock->GetBlockSize() + m_blockOverhead;
 			}
-			else
+		}
+	}
+	assert(freeBlockSize == m_freeBlockSize);
+#else
+	(void)i_maxBlocks;
+#endif
+
+	return true;
+}
+
+size_t HeapManager::DecayFreePages()
+{
+	m_emptyDecayCount = m_outstandingBlockSize == 0 ? m_emptyDecayCount + 1 : 0;
+
+	const size_t pageSize = GetVirtualMemoryPageSize();
+	size_t discardedSize = 0;
+	for (unsigned int fl = 0; fl < HEAP_FL_INDEX_COUNT; fl++)
+	{
+		for (unsigned int sl = 0; sl < HEAP_SL_INDEX_COUNT; sl++)
+		{
+			for (MemoryBlock* pBlock = m_pFreeBlockLists[fl][sl]; pBlock; pBlock = getFreeLinks(pBlock)->pNextBlock)
 			{
-				pCurrentBlock = pCurrentBlock->pNextBlock;
+				if (!(pBlock->SizeAndFlags & MEMORY_BLOCK_AGED))
+				{
+					pBlock->SizeAndFlags |= MEMORY_BLOCK_AGED;
+					continue;
+				}
+				if (pBlock->SizeAndFlags & MEMORY_BLOCK_DISCARDED)
+				{
+					continue;
+				}
+
+				// Only pages the block covers entirely, and never the one holding its free list links
+				const uintptr_t dataStart = reinterpret_cast<uintptr_t>(getBlockData(pBlock)) + (m_pDescriptorPool ? 0 : sizeof(FreeBlockLinks));
+				const uintptr_t dataEnd = reinterpret_cast<uintptr_t>(getBlockData(pBlock)) + pBlock->GetBlockSize();
+				const uintptr_t discardStart = (dataStart + pageSize - 1) & ~static_cast<uintptr_t>(pageSize - 1);
+				const uintptr_t discardEnd = dataEnd & ~static_cast<uintptr_t>(pageSize - 1);
+				if (discardStart < discardEnd)
+				{
+					DiscardPages(reinterpret_cast<void*>(discardStart), discardEnd - discardStart);
+					discardedSize += discardEnd - discardStart;
+				}
+				pBlock->SizeAndFlags |= MEMORY_BLOCK_DISCARDED;
 			}
 		}
-	} while (bShouldMerge);
+	}
+
+	return discardedSize;
 }
 
 void HeapManager::Destroy() const
 {
-	// Free all outstanding allocations
-	const MemoryBlock* pCurrentBlock = m_pOutstandingAllocationList;
-	while (pCurrentBlock)
-	{
-		const MemoryBlock* nextBlock = pCurrentBlock->pNextBlock;
-		delete pCurrentBlock;
-		pCurrentBlock = nextBlock;
-	}
+	// All MemoryBlocks live inside the heap memory, there is nothing to release on our side
 
-	// Free all free memory blocks
-	pCurrentBlock = m_pFreeMemoryBlockList;
-	while (pCurrentBlock)
+#ifdef HEAP_MANAGER_TRACK_ALLOCATIONS
+	// Anything still outstanding at this point was leaked
+	if (m_pOutstandingAllocationList)
 	{
-		const MemoryBlock* nextBlock = pCurrentBlock->pNextBlock;
-		pCurrentBlock = nullptr;
-		pCurrentBlock = nextBlock;
+		ShowOutstandingAllocations();
 	}
+#endif
 }
 
 void HeapManager::ShowFreeBlocks() const
 {
 	printf("Free Blocks:\n");
-	MemoryBlock* pCurrentBlock = m_pFreeMemoryBlockList;
-	while (pCurrentBlock)
+	for (unsigned int fl = 0; fl < HEAP_FL_INDEX_COUNT; fl++)
 	{
-		printf("Free block Address: %p, Free block base Address: %p, Size: %zu bytes\n", 
-			   static_cast<void*>(pCurrentBlock), 
-			   pCurrentBlock->pBaseAddress, 
-			   pCurrentBlock->BlockSize);
-		pCurrentBlock = pCurrentBlock->pNextBlock;
+		for (unsigned int sl = 0; sl < HEAP_SL_INDEX_COUNT; sl++)
+		{
+			const MemoryBlock* pCurrentBlock = m_pFreeBlockLists[fl][sl];
+			while (pCurrentBlock)
+			{
+				printf("Free block Address: %p, Free block base Address: %p, Size: %zu bytes, Bin: [%u][%u]\n",
+					   static_cast<const void*>(pCurrentBlock),
+					   getBlockData(pCurrentBlock),
+					   pCurrentBlock->GetBlockSize(),
+					   fl, sl);
+				pCurrentBlock = getFreeLinks(pCurrentBlock)->pNextBlock;
+			}
+		}
 	}
 }
 
@@ -222,51 +415,50 @@ void HeapManager::ShowFreeBlocks() const
 void HeapManager::ShowOutstandingAllocations() const
 {
 	printf("Outstanding Allocations:\n");
+#ifdef HEAP_MANAGER_TRACK_ALLOCATIONS
 	MemoryBlock* pCurrentBlock = m_pOutstandingAllocationList;
 	while (pCurrentBlock)
 	{
-		printf("Outstanding block Address: %p, Outstanding block base Address: %p, Size: %zu bytes\n", static_cast<void*>(pCurrentBlock), pCurrentBlock->pBaseAddress, pCurrentBlock->BlockSize);
-		pCurrentBlock = pCurrentBlock->pNextBlock;
+		printf("Outstanding block Address: %p, Outstanding block base Address: %p, Size: %zu bytes\n", static_cast<void*>(pCurrentBlock), getBlockData(pCurrentBlock), pCurrentBlock->GetBlockSize());
+		pCurrentBlock = pCurrentBlock->pNextAllocation;
 	}
+#else
+	printf("Not tracked, define HEAP_MANAGER_TRACK_ALLOCATIONS to list them. Total size: %zu bytes\n", m_outstandingBlockSize);
+#endif
 }
 
 size_t HeapManager::GetLargestFreeBlockSize() const
 {
+	if (m_firstLevelBitmap == 0)
+	{
+		return 0;
+	}
+
+	// The largest block is in the highest non-empty bin
+	const unsigned int fl = FindHighestSetBit(static_cast<size_t>(m_firstLevelBitmap));
+	const unsigned int sl = FindHighestSetBit(static_cast<size_t>(m_secondLevelBitmap[fl]));
+
 	size_t largestSize = 0;
-	const MemoryBlock* pCurrentBlock = m_pFreeMemoryBlockList;
+	const MemoryBlock* pCurrentBlock = m_pFreeBlockLists[fl][sl];
 	while (pCurrentBlock)
 	{
-		if (pCurrentBlock->BlockSize > largestSize)
+		if (pCurrentBlock->GetBlockSize() > largestSize)
 		{
-			largestSize = pCurrentBlock->BlockSize;
+			largestSize = pCurrentBlock->GetBlockSize();
 		}
-		pCurrentBlock = pCurrentBlock->pNextBlock;
+		pCurrentBlock = getFreeLinks(pCurrentBlock)->pNextBlock;
 	}
 	return largestSize;
 }
 
 size_t HeapManager::GetAllOutstandingBlockSize() const
 {
-	size_t totalSize = 0;
-	const MemoryBlock* pCurrentBlock = m_pOutstandingAllocationList;
-	while (pCurrentBlock)
-	{
-		totalSize += pCurrentBlock->BlockSize + MEMORY_BLOCK_OVERHEAD;
-		pCurrentBlock = pCurrentBlock->pNextBlock;
-	}
-	return totalSize;
+	return m_outstandingBlockSize;
 }
 
 size_t HeapManager::GetAllFreeBlockSize() const
 {
-	size_t totalSize = 0;
-	const MemoryBlock* pCurrentBlock = m_pFreeMemoryBlockList;
-	while (pCurrentBlock)
-	{
-		totalSize += pCurrentBlock->BlockSize + MEMORY_BLOCK_OVERHEAD;
-		pCurrentBlock = pCurrentBlock->pNextBlock;
-	}
-	return totalSize;
+	return m_freeBlockSize;
 }
 
 bool HeapManager::Contains(void* ptr) const
@@ -279,103 +471,497 @@ bool HeapManager::Contains(void* ptr) const
 
 bool HeapManager::IsAllocated(const void* ptr) const
 {
-	const MemoryBlock* pCurrentBlock = m_pOutstandingAllocationList;
-	while (pCurrentBlock)
+	return findAllocatedBlock(ptr) != nullptr;
+}
+
+size_t HeapManager::GetUsableSize(const void* ptr) const
+{
+	assert(ptr);
+
+	const MemoryBlock* pBlock = findAllocatedBlock(ptr);
+	assert(pBlock);
+
+	return pBlock->GetBlockSize();
+}
+
+size_t HeapManager::GetBlockOverhead() const
+{
+	return m_blockOverhead;
+}
+
+MemoryBlock* HeapManager::findSuitableBlock(const size_t size, const size_t alignment) const
+{
+	// Blocks are HEAP_BLOCK_GRANULARITY aligned already, stricter alignments may need a gap in front of the data
+	// that is large enough to be a free block of its own
+	const size_t maxAdjustment = alignment > HEAP_BLOCK_GRANULARITY ? m_blockOverhead + HEAP_MIN_BLOCK_SIZE + alignment - HEAP_BLOCK_GRANULARITY : 0;
+	const size_t searchSize = size + maxAdjustment;
+
+	// Good fit: the first non-empty bin whose blocks are all large enough
+	unsigned int fl, sl;
+	if (mappingSearch(searchSize, fl, sl))
 	{
-		if (pCurrentBlock->pBaseAddress == ptr)
+		uint32_t secondLevelMap = m_secondLevelBitmap[fl] & (~0u << sl);
+		if (secondLevelMap == 0)
 		{
-			return true;
+			// Nothing left in this first level, go to the next non-empty one
+			const uint32_t firstLevelMap = (fl + 1 < HEAP_FL_INDEX_COUNT) ? m_firstLevelBitmap & (~0u << (fl + 1)) : 0;
+			if (firstLevelMap != 0)
+			{
+				fl = FindLowestSetBit(firstLevelMap);
+				secondLevelMap = m_secondLevelBitmap[fl];
+			}
+		}
+
+		if (secondLevelMap != 0)
+		{
+			return m_pFreeBlockLists[fl][FindLowestSetBit(secondLevelMap)];
 		}
-		pCurrentBlock = pCurrentBlock->pNextBlock;
 	}
-	return false;
+
+	// The bin the request itself falls into can still hold a block that is large enough
+	if (mappingInsert(searchSize, fl, sl))
+	{
+		MemoryBlock* pCurrentBlock = m_pFreeBlockLists[fl][sl];
+		while (pCurrentBlock)
+		{
+			const size_t adjustment = getAlignmentAdjustment(reinterpret_cast<uintptr_t>(getBlockData(pCurrentBlock)), alignment);
+			if (pCurrentBlock->GetBlockSize() >= size + adjustment)
+			{
+				return pCurrentBlock;
+			}
+			pCurrentBlock = getFreeLinks(pCurrentBlock)->pNextBlock;
+		}
+	}
+
+	return nullptr;
 }
 
-std::pair<MemoryBlock*, MemoryBlock*> HeapManager::findSuitableBlock(const size_t size, const size_t alignment) const
+size_t HeapManager::getAlignmentAdjustment(uintptr_t rawAddress, size_t alignment) const
 {
-	MemoryBlock* pCurrentBlock = m_pFreeMemoryBlockList;
-	MemoryBlock* pPreviousBlock = nullptr;
+	const uintptr_t alignmentMask = static_cast<uintptr_t>(alignment) - 1;
+	uintptr_t alignedAddress = (rawAddress + alignmentMask) & ~alignmentMask;
 
-	while (pCurrentBlock)
+	// A gap too small to be a free block would be lost, skip ahead to the next aligned address that leaves a usable one.
+	// Blocks described by a descriptor pool carry no MemoryBlock in front of them, so their gaps need none either
+	const size_t minGap = m_blockOverhead + HEAP_MIN_BLOCK_SIZE;
+	if (alignedAddress != rawAddress && alignedAddress - rawAddress < minGap)
 	{
-		// New block will potentially use memory space in alignment gap, use the raw base address to calculate the alignment adjustment
-		const uintptr_t rawAddress = reinterpret_cast<uintptr_t>(pCurrentBlock->pBaseAddress) - pCurrentBlock->AlignmentAdjustment;
-		const size_t adjustment = (alignment - (rawAddress & (alignment - 1))) % alignment;
+		alignedAddress = (rawAddress + minGap + alignmentMask) & ~alignmentMask;
+	}
 
-		// Check if the block is large enough to fit the size with alignment
-		// Take the size of the block and the alignment gap into account
-		const size_t totalSize = size + adjustment;
-		if (pCurrentBlock->BlockSize + pCurrentBlock->AlignmentAdjustment + MEMORY_BLOCK_OVERHEAD >= totalSize)
-			{
-			// Check if the aligned address is still within the block
-			const uintptr_t alignedAddress = rawAddress + adjustment;
-			if (alignedAddress + size <= rawAddress + pCurrentBlock->BlockSize + pCurrentBlock->AlignmentAdjustment)
+	return alignedAddress - rawAddress;
+}
+
+bool HeapManager::mappingInsert(size_t size, unsigned int& o_firstLevel, unsigned int& o_secondLevel)
+{
+	if (size < HEAP_SMALL_BLOCK_SIZE)
+	{
+		// Small blocks are spread linearly over the bins of first level 0
+		o_firstLevel = 0;
+		o_secondLevel = static_cast<unsigned int>(size / (HEAP_SMALL_BLOCK_SIZE / HEAP_SL_INDEX_COUNT));
+		return true;
+	}
+
+	// The highest bit picks the first level, the HEAP_SL_INDEX_COUNT_LOG2 bits below it the second level
+	const unsigned int highestBit = FindHighestSetBit(size);
+	o_firstLevel = highestBit - (HEAP_FL_INDEX_SHIFT - 1);
+	o_secondLevel = static_cast<unsigned int>(size >> (highestBit - HEAP_SL_INDEX_COUNT_LOG2)) ^ HEAP_SL_INDEX_COUNT;
+	return o_firstLevel < HEAP_FL_INDEX_COUNT;
+}
+
+bool HeapManager::mappingSearch(size_t size, unsigned int& o_firstLevel, unsigned int& o_secondLevel)
+{
+	// Round up to the start of the next bin, every block from there on is large enough
+	if (size >= HEAP_SMALL_BLOCK_SIZE)
+	{
+		size += (static_cast<size_t>(1) << (FindHighestSetBit(size) - HEAP_SL_INDEX_COUNT_LOG2)) - 1;
+	}
+	else
+	{
+		size = alignSizeUp(size, HEAP_SMALL_BLOCK_SIZE / HEAP_SL_INDEX_COUNT);
+	}
+
+	return mappingInsert(size, o_firstLevel, o_secondLevel);
+}
+
+void HeapManager::insertFreeBlock(MemoryBlock* pBlock)
+{
+	unsigned int fl, sl;
+	const bool bMapped = mappingInsert(pBlock->GetBlockSize(), fl, sl);
+	assert(bMapped);
+	(void)bMapped;
+
+	FreeBlockLinks* pLinks = getFreeLinks(pBlock);
+	pLinks->pPrevBlock = nullptr;
+	pLinks->pNextBlock = m_pFreeBlockLists[fl][sl];
+	if (pLinks->pNextBlock)
+	{
+		getFreeLinks(pLinks->pNextBlock)->pPrevBlock = pBlock;
+	}
+	m_pFreeBlockLists[fl][sl] = pBlock;
+
+	m_firstLevelBitmap |= 1u << fl;
+	m_secondLevelBitmap[fl] |= 1u << sl;
+	m_freeBlockSize += pBlock->GetBlockSize() + m_blockOverhead;
+}
+
+void HeapManager::removeFreeBlock(MemoryBlock* pBlock)
+{
+	unsigned int fl, sl;
+	mappingInsert(pBlock->GetBlockSize(), fl, sl);
+
+	const FreeBlockLinks* pLinks = getFreeLinks(pBlock);
+	if (pLinks->pPrevBlock)
+	{
+		getFreeLinks(pLinks->pPrevBlock)->pNextBlock = pLinks->pNextBlock;
+	}
+	else
+	{
+		m_pFreeBlockLists[fl][sl] = pLinks->pNextBlock;
+	}
+
+	if (pLinks->pNextBlock)
+	{
+		getFreeLinks(pLinks->pNextBlock)->pPrevBlock = pLinks->pPrevBlock;
+	}
+
+	m_freeBlockSize -= pBlock->GetBlockSize() + m_blockOverhead;
+
+	// Clear the bitmap bits of bins that just became empty
+	if (!m_pFreeBlockLists[fl][sl])
+	{
+		m_secondLevelBitmap[fl] &= ~(1u << sl);
+		if (!m_secondLevelBitmap[fl])
+		{
+			m_firstLevelBitmap &= ~(1u << fl);
+		}
+	}
+}
+
+MemoryBlock* HeapManager::findAllocatedBlock(const void* ptr) const
+{
+	if (m_pDescriptorPool)
+	{
+		if (!Contains(const_cast<void*>(ptr)))
+		{
+			return nullptr;
+		}
+
+		// The table only holds outstanding allocations, an empty slot ends the probe
+		for (size_t slot = getDescriptorSlot(ptr); m_pDescriptorTable[slot]; slot = (slot + 1) & m_descriptorTableMask)
+		{
+			if (getBlockData(m_pDescriptorTable[slot]) == ptr)
 			{
-				return {pCurrentBlock, pPreviousBlock};
+				return m_pDescriptorTable[slot];
 			}
 		}
+		return nullptr;
+	}
+
+	// Reject pointers whose MemoryBlock would lie outside the heap's blocks before touching it
+	const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+	const uintptr_t firstBlockAddress = reinterpret_cast<uintptr_t>(m_pFirstBlock);
+	if ((address & (HEAP_BLOCK_GRANULARITY - 1)) != 0 || address < firstBlockAddress + MEMORY_BLOCK_OVERHEAD || !Contains(const_cast<void*>(ptr)))
+	{
+		return nullptr;
+	}
+
+	MemoryBlock* pBlock = static_cast<MemoryBlock*>(const_cast<void*>(PointerSub(ptr, MEMORY_BLOCK_OVERHEAD)));
+	if (!pBlock->IsAllocated())
+	{
+		return nullptr;
+	}
 
-		pPreviousBlock = pCurrentBlock;
-		pCurrentBlock = pCurrentBlock->pNextBlock;
+	// The block has to end inside the heap, and both neighbours have to agree on where it starts and ends
+	const uintptr_t heapEnd = reinterpret_cast<uintptr_t>(m_pHeapBaseAddress) + m_heapSize;
+	const size_t blockSize = pBlock->GetBlockSize();
+	if (blockSize > heapEnd - address)
+	{
+		return nullptr;
+	}
+
+	const MemoryBlock* pNextPhysicalBlock = getNextPhysicalBlock(pBlock);
+	if (pNextPhysicalBlock && pNextPhysicalBlock->PrevPhysicalSize != blockSize + MEMORY_BLOCK_OVERHEAD)
+	{
+		return nullptr;
+	}
+
+	if (pBlock->PrevPhysicalSize == 0)
+	{
+		return pBlock == m_pFirstBlock ? pBlock : nullptr;
+	}
+	if (pBlock->PrevPhysicalSize > reinterpret_cast<uintptr_t>(pBlock) - firstBlockAddress)
+	{
+		return nullptr;
 	}
+	const MemoryBlock* pPrevPhysicalBlock = getPrevPhysicalBlock(pBlock);
+	return pPrevPhysicalBlock->GetBlockSize() + MEMORY_BLOCK_OVERHEAD == pBlock->PrevPhysicalSize ? pBlock : nullptr;
+}
 
-	return {nullptr, nullptr};
+MemoryBlock* HeapManager::getFirstBlock() const
+{
+	return m_pFirstBlock;
 }
 
-MemoryBlock* HeapManager::createNewBlock(void* pBlockAddress, size_t size)
+void* HeapManager::getBlockData(const MemoryBlock* pBlock) const
 {
-	MemoryBlock* newBlock = static_cast<MemoryBlock*>(pBlockAddress);
-	newBlock->pBaseAddress = PointerAdd(pBlockAddress, MEMORY_BLOCK_OVERHEAD);
-	newBlock->BlockSize = size;
-	newBlock->AlignmentAdjustment = 0;
-	return newBlock;
+	if (m_pDescriptorPool)
+	{
+		return static_cast<const BlockDescriptor*>(pBlock)->pData;
+	}
+	return PointerAdd(pBlock, MEMORY_BLOCK_OVERHEAD);
 }
 
-void HeapManager::shrinkBlock(MemoryBlock* pCurBlock, MemoryBlock* pPrevBlock, size_t size)
+MemoryBlock* HeapManager::getNextPhysicalBlock(const MemoryBlock* pBlock) const
 {
-	assert(pCurBlock != nullptr);
-	assert(size > 0);
-	assert(pCurBlock->BlockSize + pCurBlock->AlignmentAdjustment >= size);
+	if (m_pDescriptorPool)
+	{
+		return static_cast<const BlockDescriptor*>(pBlock)->pNextPhysicalBlock;
+	}
 
-	// The alignment gap will suffice the allocation, so we don't need to shrink the block, just shrink the alignment gap
-	if (pCurBlock->AlignmentAdjustment >= size)
+	// The next block starts right after this one's data, unless this is the last block that fits the heap
+	void* pNextBlockAddress = PointerAdd(getBlockData(pBlock), pBlock->GetBlockSize());
+	const uintptr_t heapEnd = reinterpret_cast<uintptr_t>(m_pHeapBaseAddress) + m_heapSize;
+	if (reinterpret_cast<uintptr_t>(pNextBlockAddress) + MEMORY_BLOCK_OVERHEAD > heapEnd)
 	{
-		pCurBlock->AlignmentAdjustment -= size + MEMORY_BLOCK_OVERHEAD;
-		return;
+		return nullptr;
+	}
+	return static_cast<MemoryBlock*>(pNextBlockAddress);
+}
+
+MemoryBlock* HeapManager::getPrevPhysicalBlock(const MemoryBlock* pBlock) const
+{
+	if (m_pDescriptorPool)
+	{
+		return static_cast<const BlockDescriptor*>(pBlock)->pPrevPhysicalBlock;
+	}
+
+	if (pBlock->PrevPhysicalSize == 0)
+	{
+		return nullptr;
 	}
+	return static_cast<MemoryBlock*>(const_cast<void*>(PointerSub(pBlock, pBlock->PrevPhysicalSize)));
+}
 
-	// The alignment gap is used up, so we need to shrink the block
-	if (pCurBlock->BlockSize + pCurBlock->AlignmentAdjustment > size)
+FreeBlockLinks* HeapManager::getFreeLinks(const MemoryBlock* pBlock) const
+{
+	if (m_pDescriptorPool)
 	{
-		MemoryBlock* pShrunkBlock = createNewBlock(
-			PointerAdd(pCurBlock->pBaseAddress, (size - pCurBlock->AlignmentAdjustment)),
-			pCurBlock->BlockSize - (size + MEMORY_BLOCK_OVERHEAD - pCurBlock->AlignmentAdjustment));
+		return &const_cast<BlockDescriptor*>(static_cast<const BlockDescriptor*>(pBlock))->Links;
+	}
+	return static_cast<FreeBlockLinks*>(getBlockData(pBlock));
+}
 
-		// Since the alignment gap is used up, set the alignment adjustment to zero
-		pShrunkBlock->AlignmentAdjustment = 0;
+void HeapManager::linkNextPhysicalBlock(MemoryBlock* pBlock) const
+{
+	MemoryBlock* pNextPhysicalBlock = getNextPhysicalBlock(pBlock);
+	if (!pNextPhysicalBlock)
+	{
+		return;
+	}
+
+	if (m_pDescriptorPool)
+	{
+		static_cast<BlockDescriptor*>(pNextPhysicalBlock)->pPrevPhysicalBlock = pBlock;
+	}
+	else
+	{
+		pNextPhysicalBlock->PrevPhysicalSize = reinterpret_cast<uintptr_t>(pNextPhysicalBlock) - reinterpret_cast<uintptr_t>(pBlock);
+	}
+}
 
-		if (pPrevBlock)
+MemoryBlock* HeapManager::createNewBlock(void* pBlockAddress, size_t size, MemoryBlock* pPrevPhysicalBlock)
+{
+	MemoryBlock* newBlock;
+	if (m_pDescriptorPool)
+	{
+		if (!m_pFreeDescriptors)
 		{
-			pPrevBlock->pNextBlock = pShrunkBlock;
-			pShrunkBlock->pNextBlock = pCurBlock->pNextBlock;
+			return nullptr;
 		}
-		else
+		newBlock = m_pFreeDescriptors;
+		m_pFreeDescriptors = static_cast<BlockDescriptor*>(newBlock)->Links.pNextBlock;
+
+		// The new block takes the place of the one in front of it in the chain of physical neighbours
+		BlockDescriptor* pDescriptor = static_cast<BlockDescriptor*>(newBlock);
+		pDescriptor->pData = pBlockAddress;
+		pDescriptor->pPrevPhysicalBlock = pPrevPhysicalBlock;
+		pDescriptor->pNextPhysicalBlock = pPrevPhysicalBlock ? static_cast<BlockDescriptor*>(pPrevPhysicalBlock)->pNextPhysicalBlock : nullptr;
+		if (pPrevPhysicalBlock)
 		{
-			pShrunkBlock->pNextBlock = pCurBlock->pNextBlock;
-			m_pFreeMemoryBlockList = pShrunkBlock;
+			static_cast<BlockDescriptor*>(pPrevPhysicalBlock)->pNextPhysicalBlock = newBlock;
 		}
 	}
-
-	// The block is used up, so we need to remove it from the free memory block list
 	else
 	{
-		if (pPrevBlock)
+		newBlock = static_cast<MemoryBlock*>(pBlockAddress);
+		newBlock->PrevPhysicalSize = pPrevPhysicalBlock ? reinterpret_cast<uintptr_t>(newBlock) - reinterpret_cast<uintptr_t>(pPrevPhysicalBlock) : 0;
+	}
+
+	// Starts out free, with no links until it is inserted into a bin
+	newBlock->SizeAndFlags = 0;
+	newBlock->SetBlockSize(size);
+	return newBlock;
+}
+
+void HeapManager::mergeNextPhysicalBlock(MemoryBlock* pBlock, MemoryBlock* pNextPhysicalBlock)
+{
+	pBlock->SetBlockSize(pBlock->GetBlockSize() + m_blockOverhead + pNextPhysicalBlock->GetBlockSize());
+
+	// Part of the merged block was in use until now, its decay starts over
+	pBlock->SizeAndFlags &= ~(MEMORY_BLOCK_AGED | MEMORY_BLOCK_DISCARDED);
+
+	// The merged block no longer exists, a bounded Collect that was about to look at it looks at the merged one instead
+	if (pNextPhysicalBlock == m_pCollectCursor)
+	{
+		m_pCollectCursor = pBlock;
+	}
+
+	if (m_pDescriptorPool)
+	{
+		// The merged block's descriptor goes back to the pool
+		static_cast<BlockDescriptor*>(pBlock)->pNextPhysicalBlock = static_cast<BlockDescriptor*>(pNextPhysicalBlock)->pNextPhysicalBlock;
+		static_cast<BlockDescriptor*>(pNextPhysicalBlock)->Links.pNextBlock = m_pFreeDescriptors;
+		m_pFreeDescriptors = pNextPhysicalBlock;
+	}
+}
+
+void* HeapManager::initDescriptorPool(void* pAddress, unsigned int numDescriptors)
+{
+	m_pDescriptorPool = static_cast<BlockDescriptor*>(PointerAlignUp(pAddress, alignof(BlockDescriptor)));
+
+	// Every descriptor starts out unused
+	m_pFreeDescriptors = nullptr;
+	for (unsigned int i = numDescriptors; i > 0; i--)
+	{
+		m_pDescriptorPool[i - 1].Links.pNextBlock = m_pFreeDescriptors;
+		m_pFreeDescriptors = &m_pDescriptorPool[i - 1];
+	}
+
+	const size_t tableSize = getDescriptorTableSize(numDescriptors);
+	m_pDescriptorTable = static_cast<MemoryBlock**>(static_cast<void*>(m_pDescriptorPool + numDescriptors));
+	m_descriptorTableMask = tableSize - 1;
+	memset(m_pDescriptorTable, 0, tableSize * sizeof(MemoryBlock*));
+
+	return m_pDescriptorTable + tableSize;
+}
+
+size_t HeapManager::getDescriptorSlot(const void* pData) const
+{
+	// Data addresses are multiples of the granularity, mix the bits above it so neighbouring blocks spread out
+	size_t hash = static_cast<size_t>(reinterpret_cast<uintptr_t>(pData) / HEAP_BLOCK_GRANULARITY);
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6Du;
+	hash ^= hash >> 12;
+	return hash & m_descriptorTableMask;
+}
+
+void HeapManager::registerDescriptor(MemoryBlock* pBlock)
+{
+	size_t slot = getDescriptorSlot(getBlockData(pBlock));
+	while (m_pDescriptorTable[slot])
+	{
+		slot = (slot + 1) & m_descriptorTableMask;
+	}
+	m_pDescriptorTable[slot] = pBlock;
+}
+
+void HeapManager::unregisterDescriptor(MemoryBlock* pBlock)
+{
+	size_t slot = getDescriptorSlot(getBlockData(pBlock));
+	while (m_pDescriptorTable[slot] != pBlock)
+	{
+		assert(m_pDescriptorTable[slot] && "Allocated descriptor missing from the table");
+		slot = (slot + 1) & m_descriptorTableMask;
+	}
+
+	// Move later entries of the same probe chain back into the hole, so lookups never stop at it too early
+	size_t holeSlot = slot;
+	for (size_t nextSlot = (slot + 1) & m_descriptorTableMask; m_pDescriptorTable[nextSlot]; nextSlot = (nextSlot + 1) & m_descriptorTableMask)
+	{
+		const size_t homeSlot = getDescriptorSlot(getBlockData(m_pDescriptorTable[nextSlot]));
+		const size_t distanceToHole = (holeSlot - homeSlot) & m_descriptorTableMask;
+		const size_t distanceToEntry = (nextSlot - homeSlot) & m_descriptorTableMask;
+		if (distanceToHole < distanceToEntry)
 		{
-			pPrevBlock->pNextBlock = pCurBlock->pNextBlock;
+			m_pDescriptorTable[holeSlot] = m_pDescriptorTable[nextSlot];
+			holeSlot = nextSlot;
 		}
-		else
+	}
+	m_pDescriptorTable[holeSlot] = nullptr;
+}
+
+void* HeapManager::markAllocated(MemoryBlock* pBlock)
+{
+	// Only outstanding allocations are flagged allocated, this is what Free validates pointers with
+	pBlock->SetAllocated(true);
+	pBlock->SizeAndFlags &= ~(MEMORY_BLOCK_AGED | MEMORY_BLOCK_DISCARDED);
+	m_outstandingBlockSize += pBlock->GetBlockSize() + m_blockOverhead;
+	if (m_pDescriptorPool)
+	{
+		registerDescriptor(pBlock);
+	}
+
+#ifdef HEAP_MANAGER_TRACK_ALLOCATIONS
+	// track allocation
+	pBlock->pNextAllocation = m_pOutstandingAllocationList;
+	m_pOutstandingAllocationList = pBlock;
+#endif
+
+	return getBlockData(pBlock);
+}
+
+size_t HeapManager::carveChunks(MemoryBlock* pBlock, size_t size, size_t maxCount, void** o_ptrs)
+{
+	const size_t chunkStride = size + m_blockOverhead;
+	const size_t fitCount = (pBlock->GetBlockSize() + m_blockOverhead) / chunkStride;
+	size_t chunkCount = fitCount < maxCount ? fitCount : maxCount;
+	assert(chunkCount > 0);
+
+	MemoryBlock* pChunk = pBlock;
+	for (size_t i = 0; i + 1 < chunkCount; i++)
+	{
+		// The rest of the block becomes the next chunk, it is still large enough for all the chunks after this one
+		MemoryBlock* pNextChunk = createNewBlock(PointerAdd(getBlockData(pChunk), size), pChunk->GetBlockSize() - chunkStride, pChunk);
+		if (!pNextChunk)
 		{
-			m_pFreeMemoryBlockList = pCurBlock->pNextBlock;
+			// Out of descriptors, this chunk is the last one
+			chunkCount = i + 1;
+			break;
 		}
+		pChunk->SetBlockSize(size);
+		o_ptrs[i] = markAllocated(pChunk);
+		pChunk = pNextChunk;
 	}
-}
\ No newline at end of file
+
+	// The last chunk hands whatever is left over back to the bins, like Alloc does
+	linkNextPhysicalBlock(pChunk);
+	shrinkBlock(pChunk, size);
+	o_ptrs[chunkCount - 1] = markAllocated(pChunk);
+
+	return chunkCount;
+}
+
+void HeapManager::shrinkBlock(MemoryBlock* pCurBlock, size_t size)
+{
+	assert(pCurBlock != nullptr);
+	assert(pCurBlock->GetBlockSize() >= size);
+
+	// The leftover is too small for a block of its own, it stays with the current block
+	if (pCurBlock->GetBlockSize() < size + m_blockOverhead + HEAP_MIN_BLOCK_SIZE)
+	{
+		return;
+	}
+
+	MemoryBlock* pShrunkBlock = createNewBlock(PointerAdd(getBlockData(pCurBlock), size), pCurBlock->GetBlockSize() - size - m_blockOverhead, pCurBlock);
+	if (!pShrunkBlock)
+	{
+		return;
+	}
+	pCurBlock->SetBlockSize(size);
+
+	// The tail is the new physical neighbour of the block after it. That block is allocated (free neighbours are always
+	// merged), so the tail needs no merging
+	linkNextPhysicalBlock(pShrunkBlock);
+	insertFreeBlock(pShrunkBlock);
+}
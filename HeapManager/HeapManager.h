@@ -2,50 +2,119 @@
 #define HEAP_ALLOCATOR_H
 
 #include <cstddef>
-#include <utility>
+#include <cstdint>
 #include <cassert>
 
+// Keep every outstanding allocation on m_pOutstandingAllocationList so leaks can be listed.
+// Free doesn't need the list, it is a debugging aid only and costs a pointer in every MemoryBlock and an O(n) unlink per Free.
+#ifdef _DEBUG
+#define HEAP_MANAGER_TRACK_ALLOCATIONS
+#endif
+
+// Block sizes are rounded up to this, so every MemoryBlock and every block's data is at least this aligned:
+// enough for any fundamental type and for 16 byte SIMD loads without asking for an alignment
+const size_t HEAP_BLOCK_GRANULARITY = alignof(std::max_align_t) > 16 ? alignof(std::max_align_t) : 16;
+
+// Smallest block worth splitting off on its own; smaller tails stay with the allocation, smaller alignment gaps are avoided
+const size_t HEAP_MIN_BLOCK_SIZE = 2 * HEAP_BLOCK_GRANULARITY;
+
+// Segregated free lists (TLSF style): each power of two size range (first level) is split into
+// HEAP_SL_INDEX_COUNT linear bins (second level). Blocks below HEAP_SMALL_BLOCK_SIZE share first level 0.
+const unsigned int HEAP_SL_INDEX_COUNT_LOG2 = 4;
+const unsigned int HEAP_SL_INDEX_COUNT = 1 << HEAP_SL_INDEX_COUNT_LOG2;
+const unsigned int HEAP_FL_INDEX_SHIFT = HEAP_SL_INDEX_COUNT_LOG2 + (sizeof(void*) == 8 ? 3 : 2);
+const size_t HEAP_SMALL_BLOCK_SIZE = static_cast<size_t>(1) << HEAP_FL_INDEX_SHIFT;
+const unsigned int HEAP_FL_INDEX_COUNT = 32;    // One bit per first level in a uint32_t, blocks up to 2^(HEAP_FL_INDEX_SHIFT + 31) bytes
+
+// Flags in the low bits of MemoryBlock::SizeAndFlags, free since block sizes are multiples of HEAP_BLOCK_GRANULARITY
+const size_t MEMORY_BLOCK_ALLOCATED = 1;
+const size_t MEMORY_BLOCK_AGED = 2;         // Free block seen by a DecayFreePages call, still free at the next one gets its pages discarded
+const size_t MEMORY_BLOCK_DISCARDED = 4;    // Free block whose whole pages have been handed back to the OS
+const size_t MEMORY_BLOCK_FLAGS_MASK = HEAP_BLOCK_GRANULARITY - 1;
+
 /**
  * @struct MemoryBlock
- * @brief Represents a block of memory.
+ * @brief The header in front of every block of the heap.
  *
- * The MemoryBlock struct provides information about a block of memory,
- * including its base address, size, alignment adjustment, and a pointer to the next block.
+ * Only what every block needs is kept in the header: its size and allocated flag packed into one word, and the distance
+ * back to the block physically in front of it. The free list links of a free block live in the first bytes of its
+ * (unused) data instead, see FreeBlockLinks, so an outstanding allocation costs 16 bytes of header on 64 bit.
  */
-struct MemoryBlock
+struct alignas(HEAP_BLOCK_GRANULARITY) MemoryBlock     // Padded to the granularity, so the data after it stays aligned
 {
+#ifdef HEAP_MANAGER_TRACK_ALLOCATIONS
     /**
-     * @brief Actual address of the memory that this block manages.
-     *
-     * @note pBaseAddress always equals the address of the MemoryBlock itself plus the size of the MemoryBlock struct(defined as MEMORY_BLOCK_OVERHEAD).
+     * @brief Next block of the outstanding allocation list, only while the block is allocated.
      */
-    void* pBaseAddress;
+    MemoryBlock* pNextAllocation;
+#endif
 
     /**
-     * @brief The size of the block.
+     * @brief Bytes from the block physically in front of this one to this one, 0 for the first block of the heap.
      *
-     * This variable represents the size of the block. It is of type size_t, which is an unsigned integral type.
-     * The value of BlockSize determines the size of memory that this block manages.
+     * The block physically after this one starts right after this one's data, so together with this boundary tag
+     * Free finds both neighbours in O(1) and merges with the free ones immediately.
      */
-    size_t BlockSize;
-
+    size_t PrevPhysicalSize;
 
     /**
-     * @brief The AlignmentAdjustment variable is of type size_t and stores the adjustment needed to align memory addresses.
-     *
-     * The AlignmentAdjustment value represents the number of bytes that should be added to the address to align it correctly.
-     *
-     * @note This variable represents the size of alignment gap before the memory block.
+     * @brief The size of the memory this block manages, or'ed with the MEMORY_BLOCK_* flags.
      */
-    size_t AlignmentAdjustment;
-    
+    size_t SizeAndFlags;
+
+    size_t GetBlockSize() const
+    {
+        return SizeAndFlags & ~MEMORY_BLOCK_FLAGS_MASK;
+    }
+
+    void SetBlockSize(size_t size)
+    {
+        assert((size & MEMORY_BLOCK_FLAGS_MASK) == 0);
+        SizeAndFlags = size | (SizeAndFlags & MEMORY_BLOCK_FLAGS_MASK);
+    }
+
     /**
-     * @brief Pointer to the next memory block.
-     *
-     * This variable is used to store a pointer to the next memory block in a linked list structure.
-     * Used in both the free memory block list and the outstanding allocation list.
+     * @brief Whether the block is an outstanding allocation. Free blocks are linked into the bin of their size.
      */
+    bool IsAllocated() const
+    {
+        return (SizeAndFlags & MEMORY_BLOCK_ALLOCATED) != 0;
+    }
+
+    void SetAllocated(bool bAllocated)
+    {
+        SizeAndFlags = bAllocated ? SizeAndFlags | MEMORY_BLOCK_ALLOCATED : SizeAndFlags & ~MEMORY_BLOCK_ALLOCATED;
+    }
+};
+
+/**
+ * @struct FreeBlockLinks
+ * @brief The links of a free block in the doubly linked free list of its size bin.
+ *
+ * Kept at the start of the free block's data, which nobody uses while the block is free, or in its BlockDescriptor.
+ * Lets a free block be unlinked from its bin in O(1).
+ */
+struct FreeBlockLinks
+{
     MemoryBlock* pNextBlock;
+    MemoryBlock* pPrevBlock;
+};
+
+static_assert(sizeof(FreeBlockLinks) <= HEAP_BLOCK_GRANULARITY, "Every block's data must be able to hold its free list links");
+
+/**
+ * @struct BlockDescriptor
+ * @brief A MemoryBlock kept in the HeapManager's descriptor pool instead of in front of the memory it manages.
+ *
+ * With the data no longer right after its MemoryBlock, the descriptor records where the data is and which blocks
+ * surround it physically, and keeps the free list links out of the data as well.
+ */
+struct BlockDescriptor : MemoryBlock
+{
+    void* pData;                        // Address of the memory this block manages, whether it is allocated or free
+    MemoryBlock* pNextPhysicalBlock;    // nullptr for the last block of the heap
+    MemoryBlock* pPrevPhysicalBlock;    // nullptr for the first block of the heap, PrevPhysicalSize is unused
+    FreeBlockLinks Links;               // Links in the free list of its bin while free, in the unused descriptors while unused
 };
 
 class HeapManager
@@ -56,8 +125,24 @@ public:
 
     size_t m_heapSize;
     void* m_pHeapBaseAddress;
-    MemoryBlock* m_pFreeMemoryBlockList;        // Linked list of free blocks
-    MemoryBlock* m_pOutstandingAllocationList;  // Linked list of allocated blocks
+    MemoryBlock* m_pOutstandingAllocationList;  // Linked list of allocated blocks, only kept with HEAP_MANAGER_TRACK_ALLOCATIONS
+    size_t m_outstandingBlockSize;              // Sum of block size + m_blockOverhead over all allocated blocks
+    size_t m_freeBlockSize;                     // Sum of block size + m_blockOverhead over all free blocks
+    MemoryBlock* m_pCollectCursor;              // Block the next bounded Collect starts at, nullptr for the first block
+    HeapManager* m_pNextArena;                  // Next heap in the owner's chain of arenas, nullptr if there is none
+    unsigned int m_emptyDecayCount;             // DecayFreePages calls in a row that found no outstanding allocation
+
+    MemoryBlock* m_pFirstBlock;                 // Lowest block in the heap, it never merges into another one
+    size_t m_blockOverhead;                     // Bytes in front of every block's data: MEMORY_BLOCK_OVERHEAD, or 0 with a descriptor pool
+
+    BlockDescriptor* m_pDescriptorPool;         // numDescriptors descriptors, nullptr if MemoryBlocks are placed in front of their data
+    MemoryBlock* m_pFreeDescriptors;            // Unused descriptors, linked through Links.pNextBlock
+    MemoryBlock** m_pDescriptorTable;           // Open addressing table of the allocated descriptors, keyed by pData
+    size_t m_descriptorTableMask;               // Table size - 1, the table is a power of 2 at least twice numDescriptors
+
+    uint32_t m_firstLevelBitmap;                                            // Bit fl set if any bin of first level fl is non-empty
+    uint32_t m_secondLevelBitmap[HEAP_FL_INDEX_COUNT];                      // Bit sl set if bin [fl][sl] is non-empty
+    MemoryBlock* m_pFreeBlockLists[HEAP_FL_INDEX_COUNT][HEAP_SL_INDEX_COUNT];   // Doubly linked free lists, one per size bin
     
     /**
     * Allocates a block of memory with the specified size and alignment.
@@ -74,16 +159,15 @@ public:
     * @warning The caller is responsible for freeing the allocated memory block using the appropriate method.
     *
     * @see HeapManager::Free
-    * @see HeapManager::Collect
     */
     void* Alloc(size_t size, size_t alignment);
     
     /**
     * @brief Frees the memory pointed to by the given pointer.
     *
-    * This method searches for the memory block associated with the given pointer in the outstanding allocation list.
-    * If found, the block is removed from the outstanding allocation list and inserted back into the free memory block list
-    * in the correct position.
+    * The memory block associated with the given pointer is the MemoryBlock right in front of it. If that block is an
+    * outstanding allocation it is merged with its physical neighbours that are free and the result is pushed onto the
+    * free list of its size bin, all in O(1).
     *
     * @param ptr A pointer to the memory block to be freed.
     * @return true if the memory block was successfully freed, false otherwise.
@@ -91,19 +175,92 @@ public:
     bool Free(const void* ptr);
 
     /**
-     * @brief Collects and merges adjacent free memory blocks in the heap.
+     * @brief Resizes an outstanding allocation, in place whenever possible.
+     *
+     * Shrinking splits the tail off as a free block (merged with the free block after it, if any). Growing takes the
+     * free block physically after this one if the two together are large enough. Only if neither works is a new block
+     * allocated, the data copied over and the old block freed; the new block is only HEAP_BLOCK_GRANULARITY aligned.
+     *
+     * @param ptr A pointer returned by Alloc that has not been freed yet.
+     * @param size The new size (in bytes), not zero.
+     * @return The resized allocation, or nullptr if ptr is not an outstanding allocation of this heap or there was no
+     *         room to move it. The old allocation is left untouched in that case.
+     */
+    void* Realloc(const void* ptr, size_t size);
+
+    /**
+     * @brief Allocates count chunks of the same size in one go, carving as many of them as possible out of one free block.
      *
-     * This method iterates through the list of free memory blocks and checks if any adjacent blocks can be merged.
-     * If an adjacent block is found, the blocks are merged and the next block is removed from the free block list.
-     * This process continues until no more merges can be performed.
+     * The first free block that holds every chunk is split into consecutive chunks, each with a MemoryBlock of its own
+     * so Free takes them back one by one like any other allocation. If no single block is large enough the chunks are
+     * carved out of several blocks. Chunks are HEAP_BLOCK_GRANULARITY aligned.
+     *
+     * @param size The size of every chunk (in bytes).
+     * @param count The number of chunks to allocate.
+     * @param o_ptrs Receives the pointers to the chunks, in address order within every block they were carved from.
+     * @return The number of chunks allocated, fewer than count only if the heap ran out of memory.
+     */
+    size_t AllocBatch(size_t size, size_t count, void** o_ptrs);
+
+    /**
+     * @brief Verifies that no two adjacent memory blocks in the heap are both free.
+     *
+     * Free merges blocks with their free neighbours right away, so there is nothing left to merge here.
+     * Debug builds walk the heap once and assert the boundary tags are consistent; release builds do nothing.
+     */
+    void Collect();
+
+    /**
+     * @brief Like Collect, but walks no more than i_maxBlocks blocks, continuing where the last call stopped.
+     *
+     * A block the walk stopped at that gets merged into the one in front of it hands the walk over to that block, so the
+     * walk always resumes at a live block.
+     *
+     * @param o_blocksVisited Receives the number of blocks walked, always 0 in release builds.
+     * @return true if the walk reached the end of the heap, the next call starts over at the first block.
      */
-    void Collect() const;
+    bool Collect(size_t i_maxBlocks, size_t& o_blocksVisited);
+
+    /**
+     * @brief Hands the whole pages of long free blocks back to the OS, for heaps placed in memory from MapPages.
+     *
+     * Decays in two steps, so memory freed and reused in quick succession is never discarded: a call flags every free
+     * block, and a block still free at the next call gets the pages it covers entirely discarded (see DiscardPages). The
+     * pages stay mapped and are simply refilled on the next touch. Allocating or merging a block clears its flags.
+     *
+     * @return The number of bytes discarded by this call.
+     */
+    size_t DecayFreePages();
     
-    void Init(void* pHeapBaseAddress, size_t heapSize, unsigned int numDescriptors);
+    /**
+     * @brief Sets up the heap, with every block's MemoryBlock in front of its data or, if numDescriptors is not zero,
+     *        with a pool of that many BlockDescriptors placed right after the HeapManager.
+     *
+     * Out of band descriptors keep all block metadata dense and leave user blocks without a header, so small
+     * allocations pack tightly and free list walks touch only the pool. Every block, free or allocated, takes one
+     * descriptor; once the pool is used up allocations that need another block fail, and tails too small to get one
+     * stay with their allocation.
+     *
+     * @return False if the heap is too small for the descriptor pool and at least one block.
+     */
+    bool Init(void* pHeapBaseAddress, size_t heapSize, unsigned int numDescriptors);
     void ShowFreeBlocks() const;
     void ShowOutstandingAllocations() const;
     bool Contains(void* ptr) const;
     bool IsAllocated(const void* ptr) const;
+
+    /**
+     * @brief Returns the usable size of an outstanding allocation, read straight from its MemoryBlock.
+     *
+     * @param ptr A pointer returned by Alloc that has not been freed yet.
+     */
+    size_t GetUsableSize(const void* ptr) const;
+
+    /**
+     * @brief Returns the number of bytes every block takes in front of its data, 0 with a descriptor pool.
+     */
+    size_t GetBlockOverhead() const;
+
     size_t GetLargestFreeBlockSize() const;
     size_t GetAllOutstandingBlockSize() const;
     size_t GetAllFreeBlockSize() const;
@@ -112,46 +269,163 @@ public:
     
 private:
     /**
-    * @brief Finds a memory block that is suitable for the given size and alignment.
+    * @brief Finds a free memory block that is suitable for the given size and alignment.
     *
-    * @param size The size of the memory block to find.
+    * Looks up the first non-empty size bin whose blocks are all large enough, using the bin bitmaps, so the search is O(1).
+    * The size is padded with the largest alignment gap the block could need (see getAlignmentAdjustment). If no such bin
+    * exists, the bin the request itself maps to is searched for a block that happens to be large enough.
+    *
+    * @param size The size of the memory block to find, a multiple of HEAP_BLOCK_GRANULARITY.
     * @param alignment The alignment requirement of the memory block to find.
-    * @return A pair of MemoryBlock pointers. The first pointer points to the suitable block, and the second pointer points to the previous block.
-    *         If a suitable block is not found, both pointers will be nullptr.
+    * @return The suitable block, still linked into its bin, or nullptr if there is none.
     */
-    std::pair<MemoryBlock*, MemoryBlock*> findSuitableBlock(size_t size, size_t alignment) const;
+    MemoryBlock* findSuitableBlock(size_t size, size_t alignment) const;
+
+    /**
+     * @brief Returns the gap to leave in front of data at rawAddress so it ends up aligned.
+     *
+     * A non-zero gap is always large enough to be split off as a free block of its own (m_blockOverhead plus
+     * HEAP_MIN_BLOCK_SIZE), so no block ever carries an unusable gap in front of its MemoryBlock.
+     */
+    size_t getAlignmentAdjustment(uintptr_t rawAddress, size_t alignment) const;
+
+    /**
+     * @brief Computes the bin a free block of the given size belongs to.
+     *
+     * @return False if the size is beyond the largest first level.
+     */
+    static bool mappingInsert(size_t size, unsigned int& o_firstLevel, unsigned int& o_secondLevel);
+
+    /**
+     * @brief Computes the first bin whose blocks are all at least the given size.
+     *
+     * @return False if the size is beyond the largest first level.
+     */
+    static bool mappingSearch(size_t size, unsigned int& o_firstLevel, unsigned int& o_secondLevel);
+
+    /**
+     * @brief Links a free block into the bin of its size and updates the bin bitmaps.
+     */
+    void insertFreeBlock(MemoryBlock* pBlock);
+
+    /**
+     * @brief Unlinks a free block from the bin of its size and updates the bin bitmaps.
+     */
+    void removeFreeBlock(MemoryBlock* pBlock);
+
+    /**
+     * @brief Returns the MemoryBlock of an outstanding allocation, or nullptr if ptr isn't one.
+     *
+     * The MemoryBlock is right in front of ptr. It has to be flagged allocated and agree with the boundary tags of both
+     * its physical neighbours, which the data of a stale or foreign pointer practically never does. With a descriptor
+     * pool the block is found through the descriptor table instead.
+     *
+     * @param ptr A pointer that may have been returned by Alloc.
+     */
+    MemoryBlock* findAllocatedBlock(const void* ptr) const;
+
+    /**
+     * @brief Returns the first memory block of the heap, the one whose data starts right after the HeapManager
+     *        (and its descriptor pool, if it has one).
+     */
+    MemoryBlock* getFirstBlock() const;
+
+    /**
+     * @brief Returns the address of the memory a block manages: right after its MemoryBlock, or wherever its
+     *        BlockDescriptor says.
+     */
+    void* getBlockData(const MemoryBlock* pBlock) const;
+
+    /**
+     * @brief Returns the memory block physically after the given one, or nullptr if it is the last one of the heap.
+     */
+    MemoryBlock* getNextPhysicalBlock(const MemoryBlock* pBlock) const;
+
+    /**
+     * @brief Returns the memory block physically in front of the given one, or nullptr if it is the first one of the heap.
+     */
+    MemoryBlock* getPrevPhysicalBlock(const MemoryBlock* pBlock) const;
+
+    /**
+     * @brief Returns the free list links of a block: at the start of its data, or in its BlockDescriptor.
+     */
+    FreeBlockLinks* getFreeLinks(const MemoryBlock* pBlock) const;
+
+    /**
+     * @brief Points the boundary tag of the block physically after the given one back at it.
+     */
+    void linkNextPhysicalBlock(MemoryBlock* pBlock) const;
 
 
     /**
      * Creates a new memory block.
      *
-     * @param pBlockAddress The address of the block.
+     * @param pBlockAddress The address of the block: where its MemoryBlock goes, or its data with a descriptor pool.
      * @param size The size of the block, excluding MemoryBlock overhead.
-     * @return A pointer to the created MemoryBlock.
+     * @param pPrevPhysicalBlock The block physically in front of the new one, nullptr if it is the first of the heap.
+     *                           The new block is split off the end of it.
+     * @return A pointer to the created MemoryBlock, nullptr if the descriptor pool is used up.
      */
-    static MemoryBlock* createNewBlock(void* pBlockAddress, size_t size);
+    MemoryBlock* createNewBlock(void* pBlockAddress, size_t size, MemoryBlock* pPrevPhysicalBlock);
+
+    /**
+     * @brief Merges the block physically after pBlock, already unlinked from its bin, into pBlock.
+     *
+     * The caller links the block after the merged one back to pBlock with linkNextPhysicalBlock.
+     */
+    void mergeNextPhysicalBlock(MemoryBlock* pBlock, MemoryBlock* pNextPhysicalBlock);
+
+    /**
+     * @brief Carves the descriptor pool and its table out of the memory at pAddress.
+     *
+     * @return The address right after them.
+     */
+    void* initDescriptorPool(void* pAddress, unsigned int numDescriptors);
+
+    /**
+     * @brief Returns the table slot a data address hashes to.
+     */
+    size_t getDescriptorSlot(const void* pData) const;
+
+    /**
+     * @brief Adds an allocated block to the descriptor table, so findAllocatedBlock finds it by its data address.
+     */
+    void registerDescriptor(MemoryBlock* pBlock);
+
+    /**
+     * @brief Removes an allocated block from the descriptor table.
+     */
+    void unregisterDescriptor(MemoryBlock* pBlock);
 
 
     /**
      * \brief Shrinks a memory block to a specified size.
      *
-     * \param pCurBlock Pointer to the current memory block.
-     * \param pPrevBlock Pointer to the previous memory block.
+     * \param pCurBlock Pointer to the memory block, not linked into any bin.
      * \param size The desired size for the memory block.
      *
-     * This method is used to shrink a memory block to a specified size. It first checks if the alignment gap is sufficient
-     * to satisfy the requested size. If so, it adjusts the alignment gap accordingly. If not, it shrinks the block by creating
-     * a new block with the desired size and updating the relevant pointers. If the block becomes empty after shrinking, it is
-     * removed from the free memory block list.
+     * If the space beyond the desired size can hold a block of its own (MemoryBlock plus HEAP_MIN_BLOCK_SIZE), it is split off
+     * as a new free block and inserted into its bin. Otherwise, or if the descriptor pool is used up, the block keeps its size
+     * and the caller gets the extra.
      *
      * \pre pCurBlock must not be nullptr.
-     * \pre size must be greater than 0.
-     * \pre The sum of pCurBlock's block size and alignment adjustment must be greater than or equal to size.
-     * \post If the alignment gap is used up, pCurBlock's alignment adjustment is set to 0.
-     * \post If a new block is created, it is linked to pPrevBlock and pCurBlock's next block.
-     * \post If the block becomes empty, it is removed from the free memory block list.
+     * \pre pCurBlock's block size must be greater than or equal to size.
      */
-    void shrinkBlock(MemoryBlock* pCurBlock, MemoryBlock* pPrevBlock, size_t size);
+    void shrinkBlock(MemoryBlock* pCurBlock, size_t size);
+
+    /**
+     * @brief Makes a block that is not in any bin an outstanding allocation and returns the pointer handed out for it.
+     */
+    void* markAllocated(MemoryBlock* pBlock);
+
+    /**
+     * @brief Splits a block that is not in any bin into up to maxCount allocated chunks of size bytes, see AllocBatch.
+     *
+     * The last chunk gives the rest of the block back to the bins like shrinkBlock does.
+     *
+     * @return The number of chunks carved, at least one.
+     */
+    size_t carveChunks(MemoryBlock* pBlock, size_t size, size_t maxCount, void** o_ptrs);
 };
 
 HeapManager* CreateHeapManager(void* pHeapBaseAddress, size_t heapSize, unsigned int numDescriptors);
@@ -177,16 +451,35 @@ inline void* Alloc(HeapManager* pHeapManager, size_t size, size_t alignment)
     return pHeapManager->Alloc(size, alignment);
 }
 
+inline size_t AllocBatch(HeapManager* pHeapManager, size_t size, size_t count, void** o_ptrs)
+{
+    assert(pHeapManager != nullptr);
+
+    return pHeapManager->AllocBatch(size, count, o_ptrs);
+}
+
+inline void* Realloc(HeapManager* pHeapManager, const void* ptr, size_t size)
+{
+    assert(pHeapManager != nullptr);
+
+    return pHeapManager->Realloc(ptr, size);
+}
+
 inline bool Free(HeapManager* pHeapManager, const void* ptr)
 {
     return pHeapManager->Free(ptr);
 }
 
-inline void Collect(const HeapManager* pHeapManager)
+inline void Collect(HeapManager* pHeapManager)
 {
     pHeapManager->Collect();
 }
 
+inline bool Collect(HeapManager* pHeapManager, size_t maxBlocks, size_t& o_blocksVisited)
+{
+    return pHeapManager->Collect(maxBlocks, o_blocksVisited);
+}
+
 inline void ShowFreeBlocks(const HeapManager* pHeapManager)
 {
     pHeapManager->ShowFreeBlocks();
@@ -0,0 +1,181 @@
+#include "LargeAllocator.h"
+#include "../MemorySystem.h"
+#include "../Utilities/VirtualMemory.h"
+
+#include <cassert>
+#include <cstdint>
+
+struct LargeAllocation
+{
+	void* m_pAddress;
+	size_t m_size;		// Of the whole mapping
+};
+
+// Twice as many slots as outstanding allocations, so the table stays at most half full and probes stay short
+const size_t LARGE_ALLOCATION_TABLE_SIZE = 2 * static_cast<size_t>(LARGE_ALLOCATION_MAX_COUNT);
+static_assert((LARGE_ALLOCATION_TABLE_SIZE & (LARGE_ALLOCATION_TABLE_SIZE - 1)) == 0, "The table size must be a power of 2");
+
+size_t g_LargeAllocationThreshold = LARGE_ALLOCATION_DEFAULT_THRESHOLD;
+
+// Plain data, usable before static constructors run. Everything below is guarded by s_LargeAllocationLock
+static SpinLock s_LargeAllocationLock;
+static LargeAllocation s_LargeAllocations[LARGE_ALLOCATION_TABLE_SIZE];	// Open addressing, m_pAddress nullptr for an empty slot
+static unsigned int s_largeAllocationCount = 0;							// Outstanding, or about to be mapped
+static LargeAllocation s_CachedMappings[LARGE_ALLOCATION_CACHE_COUNT];
+static unsigned int s_cachedMappingCount = 0;
+
+// Slot a mapping's address hashes to. Mappings start on pages, mix the bits above the page offset
+static size_t getSlot(const void* i_pAddress)
+{
+	size_t hash = static_cast<size_t>(reinterpret_cast<uintptr_t>(i_pAddress) / GetVirtualMemoryPageSize());
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6Du;
+	hash ^= hash >> 12;
+	return hash & (LARGE_ALLOCATION_TABLE_SIZE - 1);
+}
+
+// Slot of the large allocation at i_pAddress, LARGE_ALLOCATION_TABLE_SIZE if there is none
+static size_t findSlot(const void* i_pAddress)
+{
+	for (size_t slot = getSlot(i_pAddress); s_LargeAllocations[slot].m_pAddress; slot = (slot + 1) & (LARGE_ALLOCATION_TABLE_SIZE - 1))
+	{
+		if (s_LargeAllocations[slot].m_pAddress == i_pAddress)
+			return slot;
+	}
+	return LARGE_ALLOCATION_TABLE_SIZE;
+}
+
+static void insertAllocation(void* i_pAddress, size_t i_size)
+{
+	size_t slot = getSlot(i_pAddress);
+	while (s_LargeAllocations[slot].m_pAddress)
+		slot = (slot + 1) & (LARGE_ALLOCATION_TABLE_SIZE - 1);
+
+	s_LargeAllocations[slot].m_pAddress = i_pAddress;
+	s_LargeAllocations[slot].m_size = i_size;
+}
+
+static void removeAllocation(size_t i_slot)
+{
+	// Move later entries of the same probe chain back into the hole, so lookups never stop at it too early
+	size_t holeSlot = i_slot;
+	for (size_t nextSlot = (i_slot + 1) & (LARGE_ALLOCATION_TABLE_SIZE - 1); s_LargeAllocations[nextSlot].m_pAddress; nextSlot = (nextSlot + 1) & (LARGE_ALLOCATION_TABLE_SIZE - 1))
+	{
+		const size_t homeSlot = getSlot(s_LargeAllocations[nextSlot].m_pAddress);
+		if (((holeSlot - homeSlot) & (LARGE_ALLOCATION_TABLE_SIZE - 1)) < ((nextSlot - homeSlot) & (LARGE_ALLOCATION_TABLE_SIZE - 1)))
+		{
+			s_LargeAllocations[holeSlot] = s_LargeAllocations[nextSlot];
+			holeSlot = nextSlot;
+		}
+	}
+	s_LargeAllocations[holeSlot].m_pAddress = nullptr;
+}
+
+void SetLargeAllocationThreshold(size_t i_threshold)
+{
+	assert(i_threshold >= SIZE_CLASS_MAX_SIZE);
+
+	g_LargeAllocationThreshold = i_threshold;
+}
+
+void* LargeAlloc(size_t i_size, bool* o_pbZeroed)
+{
+	const size_t pageSize = GetVirtualMemoryPageSize();
+	if (i_size == 0 || i_size > SIZE_MAX - pageSize)
+		return nullptr;
+
+	size_t mappingSize = (i_size + pageSize - 1) & ~(pageSize - 1);
+	void* ptr = nullptr;
+	{
+		ScopedSpinLock lock(s_LargeAllocationLock);
+		if (s_largeAllocationCount >= LARGE_ALLOCATION_MAX_COUNT)
+			return nullptr;
+
+		// The smallest cached mapping at least as large, but not wastefully larger, serves the request without a system call
+		unsigned int bestFit = s_cachedMappingCount;
+		for (unsigned int i = 0; i < s_cachedMappingCount; i++)
+		{
+			const size_t cachedSize = s_CachedMappings[i].m_size;
+			if (cachedSize >= mappingSize && cachedSize / 2 <= mappingSize &&
+				(bestFit == s_cachedMappingCount || cachedSize < s_CachedMappings[bestFit].m_size))
+				bestFit = i;
+		}
+
+		if (bestFit < s_cachedMappingCount)
+		{
+			ptr = s_CachedMappings[bestFit].m_pAddress;
+			mappingSize = s_CachedMappings[bestFit].m_size;
+			s_CachedMappings[bestFit] = s_CachedMappings[--s_cachedMappingCount];
+			insertAllocation(ptr, mappingSize);
+		}
+
+		// Keep the slot while mapping outside the lock
+		s_largeAllocationCount++;
+	}
+
+	if (o_pbZeroed)
+		*o_pbZeroed = ptr == nullptr;
+
+	if (ptr != nullptr)
+		return ptr;
+
+	ptr = MapPages(mappingSize);
+
+	ScopedSpinLock lock(s_LargeAllocationLock);
+	if (ptr == nullptr)
+	{
+		s_largeAllocationCount--;
+		return nullptr;
+	}
+
+	insertAllocation(ptr, mappingSize);
+	return ptr;
+}
+
+bool LargeFree(void* i_ptr)
+{
+	LargeAllocation allocation;
+	{
+		ScopedSpinLock lock(s_LargeAllocationLock);
+		const size_t slot = findSlot(i_ptr);
+		if (slot == LARGE_ALLOCATION_TABLE_SIZE)
+			return false;
+
+		allocation = s_LargeAllocations[slot];
+		removeAllocation(slot);
+		s_largeAllocationCount--;
+
+		if (s_cachedMappingCount < LARGE_ALLOCATION_CACHE_COUNT)
+		{
+			s_CachedMappings[s_cachedMappingCount++] = allocation;
+			return true;
+		}
+	}
+
+	UnmapPages(allocation.m_pAddress, allocation.m_size);
+	return true;
+}
+
+size_t GetLargeAllocationSize(const void* i_ptr)
+{
+	ScopedSpinLock lock(s_LargeAllocationLock);
+	const size_t slot = findSlot(i_ptr);
+	return slot < LARGE_ALLOCATION_TABLE_SIZE ? s_LargeAllocations[slot].m_size : 0;
+}
+
+void ReleaseLargeAllocationCache()
+{
+	LargeAllocation cachedMappings[LARGE_ALLOCATION_CACHE_COUNT];
+	unsigned int cachedMappingCount;
+	{
+		ScopedSpinLock lock(s_LargeAllocationLock);
+		cachedMappingCount = s_cachedMappingCount;
+		for (unsigned int i = 0; i < cachedMappingCount; i++)
+			cachedMappings[i] = s_CachedMappings[i];
+		s_cachedMappingCount = 0;
+	}
+
+	// Unmap outside the lock, other threads keep allocating meanwhile
+	for (unsigned int i = 0; i < cachedMappingCount; i++)
+		UnmapPages(cachedMappings[i].m_pAddress, cachedMappings[i].m_size);
+}
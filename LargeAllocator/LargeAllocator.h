@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+// Requests above this get page mappings of their own unless SetLargeAllocationThreshold says otherwise
+const size_t LARGE_ALLOCATION_DEFAULT_THRESHOLD = 256 * 1024;
+
+// Most large allocations that can be outstanding at once, further ones fall back to the HeapManager
+const unsigned int LARGE_ALLOCATION_MAX_COUNT = 1024;
+
+// Freed mappings kept for reuse instead of being unmapped right away
+const unsigned int LARGE_ALLOCATION_CACHE_COUNT = 4;
+
+/**
+ * Large allocations, served by page mappings of their own instead of the HeapManager.
+ *
+ * Multi-megabyte buffers would fragment the fixed heap region and could outgrow it, so every request above the
+ * threshold is mapped straight from the OS (see Utilities/VirtualMemory.h). The mappings are kept in a small open
+ * addressing table keyed by their address, which is how free tells them apart from foreign pointers the page map
+ * doesn't know either. Freed mappings are cached for reuse by a request of about the same size, the others go back to
+ * the OS right away. All calls are thread-safe.
+ */
+
+extern size_t g_LargeAllocationThreshold;
+
+// SetLargeAllocationThreshold - requests above i_threshold (at least SIZE_CLASS_MAX_SIZE) become large allocations, set before other threads allocate
+void SetLargeAllocationThreshold(size_t i_threshold);
+
+// IsLargeAllocationSize - whether a request of i_size bytes is served by LargeAlloc
+inline bool IsLargeAllocationSize(size_t i_size)
+{
+	return i_size > g_LargeAllocationThreshold;
+}
+
+// LargeAlloc - map i_size bytes aligned to the page size. o_pbZeroed (optional) tells whether the memory is fresh from the OS and so zeroed.
+//              nullptr if the OS is out of memory or the table is full
+void* LargeAlloc(size_t i_size, bool* o_pbZeroed = nullptr);
+
+// LargeFree - unmap or cache a large allocation, false if i_ptr isn't one
+bool LargeFree(void* i_ptr);
+
+// GetLargeAllocationSize - usable size of a large allocation (its whole mapping), 0 if i_ptr isn't one
+size_t GetLargeAllocationSize(const void* i_ptr);
+
+// ReleaseLargeAllocationCache - unmap every cached mapping, called by Collect and DestroyMemorySystem
+void ReleaseLargeAllocationCache();
@@ -0,0 +1,116 @@
+#include "LinearAllocator.h"
+#include "../Utilities/PointerMath.h"
+
+#include <cassert>
+#include <cstring>
+
+LinearAllocator* CreateLinearAllocator(HeapManager* pHeapManager, size_t size)
+{
+    assert(pHeapManager != nullptr);
+
+    const size_t headerSize = (sizeof(LinearAllocator) + LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT - 1) & ~(LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT - 1);
+    if (size > SIZE_MAX - headerSize)
+    {
+        return nullptr;
+    }
+
+    void* pChunk = pHeapManager->Alloc(headerSize + size, LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT);
+    if (pChunk == nullptr)
+    {
+        return nullptr;
+    }
+
+    LinearAllocator* pAllocator = static_cast<LinearAllocator*>(pChunk);
+    pAllocator->m_pHeapManager = pHeapManager;
+    pAllocator->m_pBase = PointerAdd(pChunk, headerSize);
+    pAllocator->m_size = size;
+    pAllocator->m_bottom = 0;
+    pAllocator->m_top = size;
+    return pAllocator;
+}
+
+void* LinearAllocator::Alloc(size_t size, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    const uintptr_t base = reinterpret_cast<uintptr_t>(m_pBase);
+    const uintptr_t start = (base + m_bottom + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    const size_t offset = start - base;
+    if (offset > m_top || size > m_top - offset)
+    {
+        return nullptr;
+    }
+
+    m_bottom = offset + size;
+    return reinterpret_cast<void*>(start);
+}
+
+void* LinearAllocator::AllocTop(size_t size, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    if (size > m_top)
+    {
+        return nullptr;
+    }
+
+    // Aligning down may step below the bottom end (or below the chunk), which the bottom end check catches as well
+    const uintptr_t base = reinterpret_cast<uintptr_t>(m_pBase);
+    const uintptr_t start = (base + m_top - size) & ~(static_cast<uintptr_t>(alignment) - 1);
+    if (start < base + m_bottom)
+    {
+        return nullptr;
+    }
+
+    m_top = start - base;
+    return reinterpret_cast<void*>(start);
+}
+
+void LinearAllocator::FreeToMarker(Marker marker)
+{
+    assert(marker <= m_bottom && "Marker from a later point, or from the top end");
+
+#ifdef _DEBUG
+    memset(PointerAdd(m_pBase, marker), LINEAR_ALLOCATOR_FREE_PATTERN, m_bottom - marker);
+#endif
+
+    m_bottom = marker;
+}
+
+void LinearAllocator::FreeToTopMarker(Marker marker)
+{
+    assert(marker >= m_top && marker <= m_size && "Marker from a later point, or from the bottom end");
+
+#ifdef _DEBUG
+    memset(PointerAdd(m_pBase, m_top), LINEAR_ALLOCATOR_FREE_PATTERN, marker - m_top);
+#endif
+
+    m_top = marker;
+}
+
+void LinearAllocator::Clear()
+{
+    FreeToMarker(0);
+    FreeToTopMarker(m_size);
+}
+
+bool LinearAllocator::Contains(const void* ptr) const
+{
+    const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(m_pBase);
+    return address >= base && address < base + m_size;
+}
+
+size_t LinearAllocator::GetFreeSize() const
+{
+    return m_top - m_bottom;
+}
+
+void LinearAllocator::Destroy()
+{
+    // Everything, the allocator included, lives in the one chunk
+    HeapManager* pHeapManager = m_pHeapManager;
+    const bool bFreed = pHeapManager->Free(this);
+    assert(bFreed);
+    (void)bFreed;
+}
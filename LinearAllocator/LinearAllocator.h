@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../HeapManager/HeapManager.h"
+
+// Alignment of an allocation that doesn't ask for one, the same as every heap block's
+const size_t LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT = HEAP_BLOCK_GRANULARITY;
+
+// Debug builds fill rewound memory with this, so use after a rewind shows up like use after free does in the CRT's debug heap
+const unsigned char LINEAR_ALLOCATOR_FREE_PATTERN = 0xDD;
+
+/**
+ * @class LinearAllocator
+ *
+ * @brief Hands out scratch memory from one chunk by bumping a pointer, for memory that dies all at once.
+ *
+ * An allocation costs an align and an add and carries no header, and nothing is freed on its own. GetMarker remembers how
+ * far the allocator got, FreeToMarker rewinds to that point and so frees everything allocated since in O(1), and Clear
+ * rewinds to the start. The chunk is double-ended: AllocTop grows a second stack down from the end of the chunk with
+ * markers of its own, so e.g. a request's results and its temporaries share one chunk without fragmenting it.
+ *
+ * The allocator sits at the start of a chunk taken from a HeapManager, and Destroy gives the chunk back in one Free.
+ * Not thread-safe, and Create and Destroy call into the HeapManager, so lock it as usual.
+ */
+class LinearAllocator
+{
+public:
+    // Bytes used from the start of the chunk (GetMarker) or offset of the lowest byte used from the end (GetTopMarker)
+    typedef size_t Marker;
+
+    HeapManager* m_pHeapManager;    // Owns the chunk
+    void* m_pBase;                  // First byte of the chunk after the allocator
+    size_t m_size;                  // Bytes from m_pBase to the end of the chunk
+    size_t m_bottom;                // Bytes used from m_pBase up
+    size_t m_top;                   // Offset from m_pBase of the lowest byte the top end uses, m_size while it is empty
+
+    /**
+     * @brief Allocates from the bottom end of the chunk.
+     *
+     * @param alignment A power of 2.
+     * @return nullptr if the two ends would overlap.
+     */
+    void* Alloc(size_t size, size_t alignment = LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT);
+
+    /**
+     * @brief Allocates from the top end of the chunk, growing down towards the bottom end.
+     *
+     * @param alignment A power of 2.
+     * @return nullptr if the two ends would overlap.
+     */
+    void* AllocTop(size_t size, size_t alignment = LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT);
+
+    Marker GetMarker() const
+    {
+        return m_bottom;
+    }
+
+    /**
+     * @brief Frees everything allocated from the bottom end since GetMarker returned marker.
+     */
+    void FreeToMarker(Marker marker);
+
+    Marker GetTopMarker() const
+    {
+        return m_top;
+    }
+
+    /**
+     * @brief Frees everything allocated from the top end since GetTopMarker returned marker.
+     */
+    void FreeToTopMarker(Marker marker);
+
+    /**
+     * @brief Frees everything allocated from either end.
+     */
+    void Clear();
+
+    bool Contains(const void* ptr) const;
+
+    // Bytes left between the two ends, before any alignment padding
+    size_t GetFreeSize() const;
+
+    /**
+     * @brief Gives the whole chunk back to its HeapManager, allocations still in use or not.
+     */
+    void Destroy();
+};
+
+/**
+ * @brief Creates a LinearAllocator with size bytes of scratch memory in a chunk allocated from pHeapManager.
+ *
+ * @return nullptr if the HeapManager has no room for the chunk.
+ */
+LinearAllocator* CreateLinearAllocator(HeapManager* pHeapManager, size_t size);
@@ -0,0 +1,172 @@
+#include "MemoryResource.h"
+
+#include <cassert>
+
+void* MemorySystemAllocate(size_t i_size, size_t i_alignment)
+{
+    // Size class blocks of a cache line or more are cache line aligned, so they serve any alignment up to that
+    if (i_alignment <= FSA_CACHE_LINE_SIZE)
+    {
+        const size_t classSize = i_alignment > MALLOC_MIN_ALIGNMENT && i_size < FSA_CACHE_LINE_SIZE ? FSA_CACHE_LINE_SIZE : i_size;
+        const unsigned int sizeClass = GetSizeClassIndex(classSize);
+        for (unsigned int i = sizeClass; i < g_FixedSizeAllocatorsCount && i <= sizeClass + FSA_OVERFLOW_SPILL_CLASSES; i++)
+        {
+            void* ptr = ThreadCacheAlloc(i);
+            if (ptr != nullptr)
+            {
+                return ptr;
+            }
+        }
+    }
+
+    return AllocFromHeap(i_size, i_alignment > MALLOC_MIN_ALIGNMENT ? i_alignment : MALLOC_MIN_ALIGNMENT);
+}
+
+void MemorySystemDeallocate(void* i_ptr)
+{
+    const unsigned char owner = GetPageOwner(i_ptr);
+    if (owner < g_FixedSizeAllocatorsCount)
+    {
+        ThreadCacheFree(owner, i_ptr);
+    }
+    else if (owner == PAGE_OWNER_HEAP_MANAGER)
+    {
+        ScopedSpinLock lock(g_HeapManagerLock);
+        g_pHeapManager->Free(i_ptr);
+    }
+    else if (i_ptr != nullptr)
+    {
+        FreeToHeapArena(i_ptr);
+    }
+}
+
+FixedSizeMemoryResource::FixedSizeMemoryResource(FixedSizeAllocator* i_pAllocator, SpinLock* i_pLock, std::pmr::memory_resource* i_pUpstream)
+    : m_pAllocator(i_pAllocator)
+    , m_pLock(i_pLock)
+    , m_pUpstream(i_pUpstream)
+{
+    assert(i_pAllocator != nullptr && i_pUpstream != nullptr);
+}
+
+void* FixedSizeMemoryResource::do_allocate(size_t i_bytes, size_t i_alignment)
+{
+    if (i_bytes <= m_pAllocator->m_blockSize && i_alignment <= FixedSizeAllocator::GetBlockAlignment(m_pAllocator->m_blockSize))
+    {
+        void* ptr;
+        if (m_pLock)
+        {
+            ScopedSpinLock lock(*m_pLock);
+            ptr = m_pAllocator->Alloc();
+        }
+        else
+        {
+            ptr = m_pAllocator->Alloc();
+        }
+
+        if (ptr != nullptr)
+        {
+            return ptr;
+        }
+    }
+
+    return m_pUpstream->allocate(i_bytes, i_alignment);
+}
+
+void FixedSizeMemoryResource::do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment)
+{
+    if (!m_pAllocator->Contains(i_ptr))
+    {
+        m_pUpstream->deallocate(i_ptr, i_bytes, i_alignment);
+        return;
+    }
+
+    if (m_pLock)
+    {
+        ScopedSpinLock lock(*m_pLock);
+        m_pAllocator->Free(i_ptr);
+    }
+    else
+    {
+        m_pAllocator->Free(i_ptr);
+    }
+}
+
+bool FixedSizeMemoryResource::do_is_equal(const std::pmr::memory_resource& i_other) const noexcept
+{
+    return this == &i_other;
+}
+
+HeapMemoryResource::HeapMemoryResource(HeapManager* i_pHeapManager, SpinLock* i_pLock)
+    : m_pHeapManager(i_pHeapManager)
+    , m_pLock(i_pLock)
+{
+    assert(i_pHeapManager != nullptr);
+}
+
+void* HeapMemoryResource::do_allocate(size_t i_bytes, size_t i_alignment)
+{
+    // Even an empty request gets a distinct block
+    const size_t size = i_bytes > 0 ? i_bytes : 1;
+
+    void* ptr;
+    if (m_pLock)
+    {
+        ScopedSpinLock lock(*m_pLock);
+        ptr = m_pHeapManager->Alloc(size, i_alignment);
+    }
+    else
+    {
+        ptr = m_pHeapManager->Alloc(size, i_alignment);
+    }
+
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void HeapMemoryResource::do_deallocate(void* i_ptr, size_t, size_t)
+{
+    if (m_pLock)
+    {
+        ScopedSpinLock lock(*m_pLock);
+        m_pHeapManager->Free(i_ptr);
+    }
+    else
+    {
+        m_pHeapManager->Free(i_ptr);
+    }
+}
+
+bool HeapMemoryResource::do_is_equal(const std::pmr::memory_resource& i_other) const noexcept
+{
+    return this == &i_other;
+}
+
+void* SizeClassMemoryResource::do_allocate(size_t i_bytes, size_t i_alignment)
+{
+    void* ptr = MemorySystemAllocate(i_bytes, i_alignment);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void SizeClassMemoryResource::do_deallocate(void* i_ptr, size_t, size_t)
+{
+    MemorySystemDeallocate(i_ptr);
+}
+
+bool SizeClassMemoryResource::do_is_equal(const std::pmr::memory_resource& i_other) const noexcept
+{
+    // Every instance hands out from and takes back to the same memory system
+    return dynamic_cast<const SizeClassMemoryResource*>(&i_other) != nullptr;
+}
+
+SizeClassMemoryResource* GetSizeClassMemoryResource()
+{
+    static SizeClassMemoryResource s_resource;
+    return &s_resource;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "../MemorySystem.h"
+#include "../FixedSizeAllocator/FixedSizeAllocator.h"
+#include "../ThreadCache/ThreadCache.h"
+
+#include <memory_resource>
+#include <new>
+
+/**
+ * Adapters that point single containers at a chosen allocator without replacing the global malloc.
+ *
+ * The std::pmr::memory_resource implementations wrap one FixedSizeAllocator, one HeapManager, or the memory system's
+ * size classes (a pool of pools), for use with std::pmr::polymorphic_allocator and the std::pmr containers. Allocator<T>
+ * is a plain standard allocator over the size classes, for containers whose allocator is part of their type.
+ */
+
+// MemorySystemAllocate - i_size bytes aligned to i_alignment (a power of 2) from the size class that fits them, or the heap and its arenas.
+//                        nullptr if there is no memory left
+void* MemorySystemAllocate(size_t i_size, size_t i_alignment);
+
+// MemorySystemDeallocate - give back a block MemorySystemAllocate returned
+void MemorySystemDeallocate(void* i_ptr);
+
+/**
+ * @class FixedSizeMemoryResource
+ * @brief Serves every request that fits one block of a FixedSizeAllocator from it, and anything else (or anything once it
+ *        is full) from an upstream resource.
+ *
+ * Made for the nodes of one list, set or map. Locks the allocator with the given SpinLock if there is one, a concurrent
+ * FixedSizeAllocator needs none.
+ */
+class FixedSizeMemoryResource : public std::pmr::memory_resource
+{
+public:
+    explicit FixedSizeMemoryResource(FixedSizeAllocator* i_pAllocator, SpinLock* i_pLock = nullptr,
+                                     std::pmr::memory_resource* i_pUpstream = std::pmr::get_default_resource());
+
+private:
+    void* do_allocate(size_t i_bytes, size_t i_alignment) override;
+    void do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& i_other) const noexcept override;
+
+    FixedSizeAllocator* m_pAllocator;
+    SpinLock* m_pLock;
+    std::pmr::memory_resource* m_pUpstream;
+};
+
+/**
+ * @class HeapMemoryResource
+ * @brief Serves every request from one HeapManager, locked with the given SpinLock if there is one.
+ */
+class HeapMemoryResource : public std::pmr::memory_resource
+{
+public:
+    explicit HeapMemoryResource(HeapManager* i_pHeapManager, SpinLock* i_pLock = nullptr);
+
+private:
+    void* do_allocate(size_t i_bytes, size_t i_alignment) override;
+    void do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& i_other) const noexcept override;
+
+    HeapManager* m_pHeapManager;
+    SpinLock* m_pLock;
+};
+
+/**
+ * @class SizeClassMemoryResource
+ * @brief The memory system's pool of pools: every request goes to the size class that fits it through this thread's
+ *        cache, or to the heap and its arenas, see MemorySystemAllocate. Thread-safe, every instance is equal.
+ */
+class SizeClassMemoryResource : public std::pmr::memory_resource
+{
+private:
+    void* do_allocate(size_t i_bytes, size_t i_alignment) override;
+    void do_deallocate(void* i_ptr, size_t i_bytes, size_t i_alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& i_other) const noexcept override;
+};
+
+// GetSizeClassMemoryResource - the one SizeClassMemoryResource, e.g. as the upstream of a FixedSizeMemoryResource
+SizeClassMemoryResource* GetSizeClassMemoryResource();
+
+/**
+ * @class Allocator
+ * @brief A standard allocator over the memory system's size classes and heap, stateless like std::allocator.
+ *
+ * Single objects (the nodes of lists, sets and maps) go straight to the thread cache of the size class for sizeof(T):
+ * the lookup table entry is a constant of the type, so routing costs one load. Arrays, over-aligned types and types
+ * without a class of their own go through MemorySystemAllocate.
+ */
+template <class T>
+class Allocator
+{
+public:
+    typedef T value_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef Allocator<U> other;
+    };
+
+    Allocator() noexcept = default;
+
+    template <class U>
+    Allocator(const Allocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(size_t i_count)
+    {
+        void* ptr = nullptr;
+        if (i_count == 1)
+        {
+            ptr = allocateNode();
+        }
+        else if (i_count <= SIZE_MAX / sizeof(T))
+        {
+            ptr = MemorySystemAllocate(i_count * sizeof(T), alignof(T));
+        }
+
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* i_ptr, size_t)
+    {
+        MemorySystemDeallocate(i_ptr);
+    }
+
+private:
+    static void* allocateNode()
+    {
+        if constexpr (sizeof(T) <= SIZE_CLASS_MAX_SIZE && alignof(T) <= MALLOC_MIN_ALIGNMENT)
+        {
+            const size_t lookupEntry = (sizeof(T) + SIZE_CLASS_GRANULARITY - 1) >> SIZE_CLASS_GRANULARITY_SHIFT;
+            const unsigned int sizeClass = g_SizeClassLookupTable.m_classIndex[lookupEntry];
+            if (sizeClass < g_FixedSizeAllocatorsCount)
+            {
+                void* ptr = ThreadCacheAlloc(sizeClass);
+                if (ptr != nullptr)
+                {
+                    return ptr;
+                }
+            }
+        }
+
+        return MemorySystemAllocate(sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const Allocator<T>&, const Allocator<U>&) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const Allocator<T>&, const Allocator<U>&) noexcept
+{
+    return false;
+}
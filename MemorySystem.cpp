@@ -1,55 +1,530 @@
 #include "MemorySystem.h"
+#include "LargeAllocator/LargeAllocator.h"
+#include "ThreadCache/ThreadCache.h"
+#include "Utilities/VirtualMemory.h"
 
-FSAInitData g_FixedSizeAllocatorsInitData[] = {
-	{ 16, 100 },
-	{ 32, 200 },
-	{ 96, 400 },
-	{ 256, 100 },
-	{ 1024, 100 },
+#include <chrono>
+#include <cstring>
+
+const FSAInitData g_DefaultSizeClasses[] = {
+	{ 16, 100, 32 },
+	{ 32, 200, 32 },
+	{ 96, 400, 32 },
+	{ 256, 100, 16 },
+	{ 1024, 100, 8 },
  };
 
-const unsigned int g_FixedSizeAllocatorsCount = 5;
+const unsigned int g_DefaultSizeClassCount = sizeof(g_DefaultSizeClasses) / sizeof(FSAInitData);
+
+unsigned int g_FixedSizeAllocatorsCount = 0;
+SizeClassLookupTable g_SizeClassLookupTable = {};
+PageMap g_PageMap = {0, 0, nullptr};
 HeapManager* g_pHeapManager = nullptr;
-FixedSizeAllocator* g_pFixedSizeAllocators[5] = {nullptr};
+ThreadArena g_ThreadArenas[THREAD_ARENA_COUNT];
+GrowableFixedSizeAllocator* g_pFixedSizeAllocators[FSA_MAX_SIZE_CLASSES] = {nullptr};
+SpinLock g_FixedSizeAllocatorLocks[FSA_MAX_SIZE_CLASSES];
+SpinLock g_HeapManagerLock;
+
+// Nodes a bounded Collect handles under one lock before it checks its budget again
+static const size_t COLLECT_STEP_NODES = 16;
 
-bool InitializeMemorySystem(void * i_pHeapMemory, size_t i_sizeHeapMemory, unsigned int i_OptionalNumDescriptors)
+// Where a bounded Collect stopped: the size class it is at, g_FixedSizeAllocatorsCount once it is at the heap
+static SpinLock s_CollectLock;
+static unsigned int s_collectSizeClass = 0;
+static bool s_bCollectPassStarted = false;
+
+// Address range of a mapped arena and the thread arena it belongs to, m_begin 0 for an unused slot. Written under
+// s_ArenaRangeLock, end and owner before begin, so FindHeapArena can read them without a lock
+struct ArenaRange
 {
-	// Create FixedSizeAllocators
-	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+	std::atomic<uintptr_t> m_begin;
+	std::atomic<uintptr_t> m_end;
+	std::atomic<unsigned int> m_threadArena;
+};
+
+static SpinLock s_ArenaRangeLock;
+static ArenaRange s_ArenaRanges[HEAP_ARENA_MAX_COUNT];
+static std::atomic<unsigned int> s_arenaRangeCount{0};	// Slots ever used, FindHeapArena looks at no others
+
+static std::atomic<unsigned int> s_nextThreadArena{0};
+static thread_local unsigned int t_threadArenaIndex = THREAD_ARENA_COUNT;
+
+// Marks every page touched by [i_pStart, i_pStart + i_size) as owned by i_owner
+static void setPageOwner(const void* i_pStart, size_t i_size, unsigned char i_owner)
+{
+	const uintptr_t firstPage = (reinterpret_cast<uintptr_t>(i_pStart) >> PAGE_MAP_SHIFT) - g_PageMap.m_firstPage;
+	const uintptr_t lastPage = ((reinterpret_cast<uintptr_t>(i_pStart) + i_size - 1) >> PAGE_MAP_SHIFT) - g_PageMap.m_firstPage;
+
+	memset(g_PageMap.m_pOwners + firstPage, i_owner, lastPage - firstPage + 1);
+}
+
+static_assert((FSA_SLAB_SIZE & (FSA_SLAB_SIZE - 1)) == 0 && FSA_SLAB_SIZE % PAGE_MAP_PAGE_SIZE == 0, "Slabs must cover whole pages");
+
+// Carves a slab for size class i_owner out of the HeapManager. Slabs are aligned to their size and their pages belong
+// to the size class. The MemoryBlock of the next heap block (if blocks have one) fits in the slab's last bytes, so slabs
+// pack back to back
+static void* allocSlab(size_t i_slabSize, unsigned int i_owner)
+{
+	void* pSlab;
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pSlab = g_pHeapManager->Alloc(i_slabSize - g_pHeapManager->GetBlockOverhead(), i_slabSize);
+	}
+
+	if (pSlab != nullptr)
+		setPageOwner(pSlab, i_slabSize - g_pHeapManager->GetBlockOverhead(), static_cast<unsigned char>(i_owner));
+
+	return pSlab;
+}
+
+// Checks the size class table InitializeMemorySystem was given
+static bool validateSizeClasses(const FSAInitData* i_pSizeClasses, unsigned int i_classCount)
+{
+	if (i_classCount > FSA_MAX_SIZE_CLASSES)
+		return false;
+
+	for (unsigned int i = 0; i < i_classCount; i++)
 	{
-		const size_t fixedSizeAllocatorSize = g_FixedSizeAllocatorsInitData[i].blockSize * g_FixedSizeAllocatorsInitData[i].blockNum;
-		
-		// Check if there is enough heap memory to create a FixedSizeAllocator
-		if (i_sizeHeapMemory < fixedSizeAllocatorSize)
+		const FSAInitData& sizeClass = i_pSizeClasses[i];
+		if (sizeClass.blockSize == 0 || sizeClass.blockSize > SIZE_CLASS_MAX_SIZE || sizeClass.blockSize % SIZE_CLASS_GRANULARITY != 0)
+			return false;
+
+		if (i > 0 && sizeClass.blockSize <= i_pSizeClasses[i - 1].blockSize)
 			return false;
-		
-		g_pFixedSizeAllocators[i] = CreateFixedSizeAllocator(g_FixedSizeAllocatorsInitData[i].blockSize, g_FixedSizeAllocatorsInitData[i].blockNum, i_pHeapMemory);
-		if (g_pFixedSizeAllocators[i] == nullptr)
+
+		if (sizeClass.threadCacheDepth > THREAD_CACHE_MAX_DEPTH)
 			return false;
-		
-		// Update heap memory pointer and keep track of remaining heap memory size
-		i_pHeapMemory = static_cast<char*>(i_pHeapMemory) + fixedSizeAllocatorSize;
-		i_sizeHeapMemory -= fixedSizeAllocatorSize;
 	}
 
-	// Create HeapManager
+	return true;
+}
+
+static void freeSlab(void* i_pSlab, size_t i_slabSize)
+{
+	setPageOwner(i_pSlab, i_slabSize - g_pHeapManager->GetBlockOverhead(), PAGE_OWNER_HEAP_MANAGER);
+
+	ScopedSpinLock lock(g_HeapManagerLock);
+	g_pHeapManager->Free(i_pSlab);
+}
+
+// Records the range of a new arena, false if HEAP_ARENA_MAX_COUNT arenas are mapped already
+static bool registerArena(const HeapManager* i_pArena, unsigned int i_threadArena)
+{
+	ScopedSpinLock lock(s_ArenaRangeLock);
+	unsigned int slot = 0;
+	while (slot < HEAP_ARENA_MAX_COUNT && s_ArenaRanges[slot].m_begin.load(std::memory_order_relaxed) != 0)
+		slot++;
+	if (slot == HEAP_ARENA_MAX_COUNT)
+		return false;
+
+	const uintptr_t begin = reinterpret_cast<uintptr_t>(i_pArena->m_pHeapBaseAddress);
+	s_ArenaRanges[slot].m_end.store(begin + i_pArena->m_heapSize, std::memory_order_relaxed);
+	s_ArenaRanges[slot].m_threadArena.store(i_threadArena, std::memory_order_relaxed);
+	s_ArenaRanges[slot].m_begin.store(begin, std::memory_order_release);
+	if (slot >= s_arenaRangeCount.load(std::memory_order_relaxed))
+		s_arenaRangeCount.store(slot + 1, std::memory_order_release);
+	return true;
+}
+
+static void unregisterArena(const HeapManager* i_pArena)
+{
+	ScopedSpinLock lock(s_ArenaRangeLock);
+	for (unsigned int slot = 0; slot < HEAP_ARENA_MAX_COUNT; slot++)
+	{
+		if (s_ArenaRanges[slot].m_begin.load(std::memory_order_relaxed) == reinterpret_cast<uintptr_t>(i_pArena->m_pHeapBaseAddress))
+		{
+			s_ArenaRanges[slot].m_begin.store(0, std::memory_order_relaxed);
+			return;
+		}
+	}
+	assert(false && "Arena missing from the ranges");
+}
+
+// Frees the blocks other threads queued on a thread arena. The caller holds its lock
+static void drainRemoteFrees(ThreadArena& io_threadArena)
+{
+	void* pBlock = io_threadArena.m_pRemoteFrees.exchange(nullptr, std::memory_order_acquire);
+	while (pBlock != nullptr)
+	{
+		void* pNextBlock = *static_cast<void**>(pBlock);
+		HeapManager* pArena = FindHeapArena(pBlock);
+		assert(pArena != nullptr);
+		pArena->Free(pBlock);
+		pBlock = pNextBlock;
+	}
+}
+
+// Discards the long free pages of every arena and unmaps the arenas that stayed empty long enough
+static void decayHeapArenas()
+{
+	for (ThreadArena& threadArena : g_ThreadArenas)
+	{
+		HeapManager* pEmptyArenas = nullptr;
+		{
+			ScopedSpinLock lock(threadArena.m_lock);
+			drainRemoteFrees(threadArena);
+
+			HeapManager** ppArena = &threadArena.m_pArenas;
+			while (*ppArena != nullptr)
+			{
+				HeapManager* pArena = *ppArena;
+				pArena->DecayFreePages();
+				if (pArena->m_emptyDecayCount >= HEAP_ARENA_DECAY_PASSES)
+				{
+					*ppArena = pArena->m_pNextArena;
+					pArena->m_pNextArena = pEmptyArenas;
+					pEmptyArenas = pArena;
+				}
+				else
+				{
+					ppArena = &pArena->m_pNextArena;
+				}
+			}
+		}
+
+		// Unmap outside the lock, other threads keep allocating meanwhile
+		while (pEmptyArenas != nullptr)
+		{
+			HeapManager* pArena = pEmptyArenas;
+			pEmptyArenas = pArena->m_pNextArena;
+			unregisterArena(pArena);
+			UnmapPages(pArena->m_pHeapBaseAddress, pArena->m_heapSize);
+		}
+	}
+}
+
+unsigned int GetThreadArenaIndex()
+{
+	if (t_threadArenaIndex == THREAD_ARENA_COUNT)
+		t_threadArenaIndex = s_nextThreadArena.fetch_add(1, std::memory_order_relaxed) % THREAD_ARENA_COUNT;
+
+	return t_threadArenaIndex;
+}
+
+void* AllocFromHeap(size_t i_size, size_t i_alignment)
+{
+	// The shared heap is only worth waiting for when this thread's arenas are full too
+	void* ptr = nullptr;
+	const bool bHeapLocked = g_HeapManagerLock.TryLock();
+	if (bHeapLocked)
+	{
+		ptr = g_pHeapManager->Alloc(i_size, i_alignment);
+		g_HeapManagerLock.Unlock();
+		if (ptr != nullptr)
+			return ptr;
+	}
+
+	const unsigned int threadArenaIndex = GetThreadArenaIndex();
+	ThreadArena& threadArena = g_ThreadArenas[threadArenaIndex];
+	{
+		ScopedSpinLock lock(threadArena.m_lock);
+		drainRemoteFrees(threadArena);
+		for (HeapManager* pArena = threadArena.m_pArenas; ptr == nullptr && pArena != nullptr; pArena = pArena->m_pNextArena)
+			ptr = pArena->Alloc(i_size, i_alignment);
+
+		if (ptr != nullptr)
+			return ptr;
+	}
+
+	if (!bHeapLocked)
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		ptr = g_pHeapManager->Alloc(i_size, i_alignment);
+		if (ptr != nullptr)
+			return ptr;
+	}
+
+	// Every heap is full. The new arena holds the HeapManager, the block with its worst alignment gap and a free tail
+	if (i_size >= SIZE_MAX / 4 || i_alignment >= SIZE_MAX / 4)
+		return nullptr;
+
+	const size_t pageSize = GetVirtualMemoryPageSize();
+	const size_t arenaOverhead = sizeof(HeapManager) + 2 * (sizeof(MemoryBlock) + HEAP_MIN_BLOCK_SIZE) + HEAP_BLOCK_GRANULARITY;
+	size_t arenaSize = (i_size + i_alignment + arenaOverhead + pageSize - 1) & ~(pageSize - 1);
+	if (arenaSize < HEAP_ARENA_SIZE)
+		arenaSize = HEAP_ARENA_SIZE;
+
+	// Map outside the lock
+	void* pArenaMemory = MapPages(arenaSize);
+	if (pArenaMemory == nullptr)
+		return nullptr;
+
+	HeapManager* pNewArena = CreateHeapManager(pArenaMemory, arenaSize, 0);
+	assert(pNewArena != nullptr);
+	if (!registerArena(pNewArena, threadArenaIndex))
+	{
+		UnmapPages(pArenaMemory, arenaSize);
+		return nullptr;
+	}
+
+	// Older arenas are tried first, so the newer ones are the first to drain and decay
+	ScopedSpinLock lock(threadArena.m_lock);
+	ptr = pNewArena->Alloc(i_size, i_alignment);
+	HeapManager** ppArena = &threadArena.m_pArenas;
+	while (*ppArena != nullptr)
+		ppArena = &(*ppArena)->m_pNextArena;
+	*ppArena = pNewArena;
+
+	return ptr;
+}
+
+HeapManager* FindHeapArena(const void* i_ptr, unsigned int* o_pThreadArena)
+{
+	const uintptr_t address = reinterpret_cast<uintptr_t>(i_ptr);
+	const unsigned int rangeCount = s_arenaRangeCount.load(std::memory_order_acquire);
+	for (unsigned int slot = 0; slot < rangeCount; slot++)
+	{
+		const uintptr_t begin = s_ArenaRanges[slot].m_begin.load(std::memory_order_acquire);
+		if (begin != 0 && address >= begin && address < s_ArenaRanges[slot].m_end.load(std::memory_order_relaxed))
+		{
+			if (o_pThreadArena)
+				*o_pThreadArena = s_ArenaRanges[slot].m_threadArena.load(std::memory_order_relaxed);
+
+			// Every arena starts with its HeapManager
+			return reinterpret_cast<HeapManager*>(begin);
+		}
+	}
+	return nullptr;
+}
+
+bool FreeToHeapArena(const void* i_ptr)
+{
+	unsigned int threadArenaIndex;
+	HeapManager* pArena = FindHeapArena(i_ptr, &threadArenaIndex);
+	if (pArena == nullptr)
+		return false;
+
+	ThreadArena& threadArena = g_ThreadArenas[threadArenaIndex];
+	if (threadArenaIndex == GetThreadArenaIndex())
+	{
+		ScopedSpinLock lock(threadArena.m_lock);
+		pArena->Free(i_ptr);
+		return true;
+	}
+
+	// Another thread arena's block, queue it without taking that arena's lock. The block's data holds the link
+	void* pHead = threadArena.m_pRemoteFrees.load(std::memory_order_relaxed);
+	do
+	{
+		*static_cast<void**>(const_cast<void*>(i_ptr)) = pHead;
+	} while (!threadArena.m_pRemoteFrees.compare_exchange_weak(pHead, const_cast<void*>(i_ptr), std::memory_order_release, std::memory_order_relaxed));
+	return true;
+}
+
+bool InitializeMemorySystem(void * i_pHeapMemory, size_t i_sizeHeapMemory, unsigned int i_OptionalNumDescriptors,
+                            const FSAInitData * i_pSizeClasses, unsigned int i_sizeClassCount)
+{
+	if (i_pSizeClasses == nullptr)
+	{
+		i_pSizeClasses = g_DefaultSizeClasses;
+		i_sizeClassCount = g_DefaultSizeClassCount;
+	}
+
+	if (!validateSizeClasses(i_pSizeClasses, i_sizeClassCount))
+		return false;
+
+	g_FixedSizeAllocatorsCount = i_sizeClassCount;
+	g_SizeClassLookupTable.Build(i_pSizeClasses, i_sizeClassCount);
+
+	const uintptr_t heapEnd = reinterpret_cast<uintptr_t>(i_pHeapMemory) + i_sizeHeapMemory;
+
+	// The page map comes first and covers the whole heap memory
+	g_PageMap.m_firstPage = reinterpret_cast<uintptr_t>(i_pHeapMemory) >> PAGE_MAP_SHIFT;
+	g_PageMap.m_pageCount = ((heapEnd - 1) >> PAGE_MAP_SHIFT) - g_PageMap.m_firstPage + 1;
+	g_PageMap.m_pOwners = static_cast<unsigned char*>(i_pHeapMemory);
+
+	if (i_sizeHeapMemory < g_PageMap.m_pageCount)
+		return false;
+
+	memset(g_PageMap.m_pOwners, PAGE_OWNER_NONE, g_PageMap.m_pageCount);
+	i_pHeapMemory = PointerAdd(i_pHeapMemory, g_PageMap.m_pageCount);
+
+	// The FixedSizeAllocators themselves come next, their slabs come out of the HeapManager
+	GrowableFixedSizeAllocator* pFixedSizeAllocatorMemory = static_cast<GrowableFixedSizeAllocator*>(PointerAlignUp(i_pHeapMemory, alignof(GrowableFixedSizeAllocator)));
+	i_pHeapMemory = pFixedSizeAllocatorMemory + g_FixedSizeAllocatorsCount;
+
+	// Create HeapManager on the remaining pages
+	i_pHeapMemory = PointerAlignUp(i_pHeapMemory, PAGE_MAP_PAGE_SIZE);
+	if (reinterpret_cast<uintptr_t>(i_pHeapMemory) >= heapEnd)
+		return false;
+
+	i_sizeHeapMemory = heapEnd - reinterpret_cast<uintptr_t>(i_pHeapMemory);
 	g_pHeapManager = CreateHeapManager(i_pHeapMemory, i_sizeHeapMemory, i_OptionalNumDescriptors);
+	if (g_pHeapManager == nullptr)
+		return false;
+
+	setPageOwner(i_pHeapMemory, i_sizeHeapMemory, PAGE_OWNER_HEAP_MANAGER);
+
+	// Create FixedSizeAllocators, reserving their initial blocks before anything else can fragment the heap
+	const SlabSource slabSource = { allocSlab, freeSlab, g_pHeapManager->GetBlockOverhead() };
+	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+	{
+		g_pFixedSizeAllocators[i] = CreateGrowableFixedSizeAllocator(pFixedSizeAllocatorMemory + i, i_pSizeClasses[i].blockSize, FSA_SLAB_SIZE, i, slabSource);
+		if (!g_pFixedSizeAllocators[i]->Reserve(i_pSizeClasses[i].blockNum))
+			return false;
+
+		SetThreadCacheDepth(i, i_pSizeClasses[i].threadCacheDepth);
+	}
+
+	return InitializeThreadCaches();
+}
+
+size_t GetUsableSize(const void * i_ptr)
+{
+	const unsigned char owner = GetPageOwner(i_ptr);
+
+	if (owner < g_FixedSizeAllocatorsCount)
+		return g_pFixedSizeAllocators[owner]->m_blockSize;
+
+	if (owner == PAGE_OWNER_HEAP_MANAGER)
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		return g_pHeapManager->GetUsableSize(i_ptr);
+	}
 
-	return g_pHeapManager != nullptr;
+	unsigned int threadArena;
+	const HeapManager* pArena = FindHeapArena(i_ptr, &threadArena);
+	if (pArena != nullptr)
+	{
+		ScopedSpinLock lock(g_ThreadArenas[threadArena].m_lock);
+		return pArena->GetUsableSize(i_ptr);
+	}
+
+	return GetLargeAllocationSize(i_ptr);
 }
 
 void Collect()
 {
-	g_pHeapManager->Collect();
+	// Blocks sitting in this thread's cache keep their slabs from being empty
+	FlushThreadCache();
+	ReleaseLargeAllocationCache();
+
+	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+	{
+		ScopedSpinLock lock(g_FixedSizeAllocatorLocks[i]);
+		g_pFixedSizeAllocators[i]->ReleaseEmptySlabs();
+	}
+
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		g_pHeapManager->Collect();
+	}
+	for (ThreadArena& threadArena : g_ThreadArenas)
+	{
+		ScopedSpinLock lock(threadArena.m_lock);
+		for (HeapManager* pArena = threadArena.m_pArenas; pArena != nullptr; pArena = pArena->m_pNextArena)
+			pArena->Collect();
+	}
+
+	decayHeapArenas();
+}
+
+bool Collect(const CollectBudget& i_budget, CollectProgress* o_pProgress)
+{
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	ScopedSpinLock collectLock(s_CollectLock);
+
+	// A pass starts with the blocks sitting in this thread's cache, they keep their slabs from being empty
+	if (!s_bCollectPassStarted)
+	{
+		FlushThreadCache();
+		ReleaseLargeAllocationCache();
+		s_bCollectPassStarted = true;
+	}
+
+	size_t nodesVisited = 0;
+	size_t slabsReleased = 0;
+	bool bPassComplete = false;
+	while (!bPassComplete)
+	{
+		size_t maxNodes = COLLECT_STEP_NODES;
+		if (i_budget.maxNodes != 0)
+		{
+			if (nodesVisited >= i_budget.maxNodes)
+				break;
+			if (i_budget.maxNodes - nodesVisited < maxNodes)
+				maxNodes = i_budget.maxNodes - nodesVisited;
+		}
+		if (i_budget.maxNanoseconds != 0 &&
+			static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count()) >= i_budget.maxNanoseconds)
+			break;
+
+		size_t visited;
+		bool bDone;
+		if (s_collectSizeClass < g_FixedSizeAllocatorsCount)
+		{
+			GrowableFixedSizeAllocator* pAllocator = g_pFixedSizeAllocators[s_collectSizeClass];
+			ScopedSpinLock lock(g_FixedSizeAllocatorLocks[s_collectSizeClass]);
+			const size_t slabCount = pAllocator->m_slabCount;
+			bDone = pAllocator->ReleaseEmptySlabs(maxNodes, visited);
+			slabsReleased += slabCount - pAllocator->m_slabCount;
+		}
+		else
+		{
+			ScopedSpinLock lock(g_HeapManagerLock);
+			bDone = g_pHeapManager->Collect(maxNodes, visited);
+		}
+		nodesVisited += visited;
+
+		if (bDone)
+		{
+			if (s_collectSizeClass < g_FixedSizeAllocatorsCount)
+			{
+				s_collectSizeClass++;
+			}
+			else
+			{
+				s_collectSizeClass = 0;
+				s_bCollectPassStarted = false;
+				bPassComplete = true;
+				decayHeapArenas();
+			}
+		}
+	}
+
+	if (o_pProgress)
+	{
+		o_pProgress->bPassComplete = bPassComplete;
+		o_pProgress->nodesVisited = nodesVisited;
+		o_pProgress->slabsReleased = slabsReleased;
+		{
+			ScopedSpinLock lock(g_HeapManagerLock);
+			o_pProgress->freeHeapBytes = g_pHeapManager->GetAllFreeBlockSize();
+			o_pProgress->largestFreeHeapBlock = g_pHeapManager->GetLargestFreeBlockSize();
+		}
+		const size_t largestFreeBytes = o_pProgress->largestFreeHeapBlock + (o_pProgress->largestFreeHeapBlock ? g_pHeapManager->GetBlockOverhead() : 0);
+		o_pProgress->fragmentation = o_pProgress->freeHeapBytes ? 1.0f - static_cast<float>(largestFreeBytes) / static_cast<float>(o_pProgress->freeHeapBytes) : 0.0f;
+	}
+
+	return bPassComplete;
 }
 
 void DestroyMemorySystem()
 {
-	// Destroy your HeapManager and FixedSizeAllocators
+	// Every other thread has exited and flushed its cache by now, give back the blocks this one still caches
+	DestroyThreadCaches();
+
+	// Destroy your HeapManager and FixedSizeAllocators, the slabs go back to the HeapManager first
 	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
 	{
 		g_pFixedSizeAllocators[i]->Destroy();
 	}
 	Destroy(g_pHeapManager);
+	for (ThreadArena& threadArena : g_ThreadArenas)
+	{
+		drainRemoteFrees(threadArena);
+		while (threadArena.m_pArenas != nullptr)
+		{
+			HeapManager* pArena = threadArena.m_pArenas;
+			threadArena.m_pArenas = pArena->m_pNextArena;
+			Destroy(pArena);
+			unregisterArena(pArena);
+			UnmapPages(pArena->m_pHeapBaseAddress, pArena->m_heapSize);
+		}
+	}
+	ReleaseLargeAllocationCache();
+
+	// Nothing is owned anymore, late frees of stale pointers become no-ops
+	g_PageMap.m_pageCount = 0;
 }
 
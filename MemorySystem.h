@@ -1,23 +1,204 @@
 #pragma once
 
 #include "HeapManager/HeapManager.h"
-#include "FixedSizeAllocator/FixedSizeAllocator.h"
+#include "FixedSizeAllocator/GrowableFixedSizeAllocator.h"
+#include "Utilities/SpinLock.h"
+
+#include <atomic>
 
 struct FSAInitData
 {
    size_t blockSize;
-   size_t blockNum;
+   size_t blockNum;                // Blocks reserved up front, the allocator grows past them on demand
+   unsigned int threadCacheDepth;  // Blocks each thread keeps cached for this class, 0 sends every malloc/free to the allocator
+};
+
+// Most FixedSizeAllocators (size classes) the memory system can be built with
+const unsigned int FSA_MAX_SIZE_CLASSES = 32;
+
+// Size classes grow by slabs of this size carved from the HeapManager, each aligned to its size
+const size_t FSA_SLAB_SIZE = 16 * 1024;
+
+// Every block malloc returns is aligned to at least this. Size classes are multiples of it, so their blocks are
+// FSA_MIN_BLOCK_ALIGNMENT aligned (a cache line from 64 bytes up), and the HeapManager aligns every block to its granularity
+const size_t MALLOC_MIN_ALIGNMENT = HEAP_BLOCK_GRANULARITY;
+
+static_assert(FSA_MIN_BLOCK_ALIGNMENT >= MALLOC_MIN_ALIGNMENT, "Size class blocks must be aligned like heap blocks");
+
+// Once g_pHeapManager is full the heap grows by arenas of at least this size mapped from the OS, see AllocFromHeap
+const size_t HEAP_ARENA_SIZE = 4 * 1024 * 1024;
+
+// Collect passes an arena has to stay without outstanding allocations through before it is unmapped
+const unsigned int HEAP_ARENA_DECAY_PASSES = 2;
+
+// Most arenas mapped at once, over all thread arenas
+const unsigned int HEAP_ARENA_MAX_COUNT = 256;
+
+// Threads are assigned round robin to this many thread arenas, each growing its own arenas under its own lock
+const unsigned int THREAD_ARENA_COUNT = 4;
+
+/**
+ * @brief The arenas one share of the threads allocates from once g_pHeapManager is full or busy, see AllocFromHeap.
+ *
+ * The arenas are only touched under m_lock, taken by the threads assigned to the thread arena. A thread freeing one of
+ * its blocks without being assigned to it doesn't take the lock but pushes the block onto m_pRemoteFrees, which the next
+ * AllocFromHeap of the thread arena drains. Producer and consumer threads so don't contend on one heap.
+ */
+struct ThreadArena
+{
+   SpinLock m_lock;
+   HeapManager* m_pArenas;                 // Arenas in the order they were mapped, linked through m_pNextArena
+   std::atomic<void*> m_pRemoteFrees;      // Blocks other threads freed, each linked to the next through its first bytes
+};
+
+// Requests up to this size are routed to a FixedSizeAllocator through g_SizeClassLookupTable
+const size_t SIZE_CLASS_MAX_SIZE = 1024;
+
+// The lookup table has one entry per 16 bytes of request size, so block sizes are multiples of 16
+const size_t SIZE_CLASS_GRANULARITY_SHIFT = 4;
+const size_t SIZE_CLASS_GRANULARITY = static_cast<size_t>(1) << SIZE_CLASS_GRANULARITY_SHIFT;
+
+static_assert(SIZE_CLASS_GRANULARITY % MALLOC_MIN_ALIGNMENT == 0, "Size classes must keep their blocks aligned");
+const size_t SIZE_CLASS_LOOKUP_ENTRIES = (SIZE_CLASS_MAX_SIZE >> SIZE_CLASS_GRANULARITY_SHIFT) + 1;
+
+// Overflow policy: when the size class of a request is exhausted malloc tries at most this many larger classes
+// before it falls back to the HeapManager, so a full 16 byte class never ends up eating 1024 byte blocks
+const unsigned int FSA_OVERFLOW_SPILL_CLASSES = 1;
+
+/**
+ * @brief Maps a request size to the smallest FixedSizeAllocator whose blocks fit it, with a single load.
+ *
+ * Entry i covers request sizes ((i - 1) * 16, i * 16]. Built by InitializeMemorySystem from the size classes, which
+ * must be sorted by block size. Entries no class can serve hold the class count.
+ */
+struct SizeClassLookupTable
+{
+   unsigned char m_classIndex[SIZE_CLASS_LOOKUP_ENTRIES];
+
+   void Build(const FSAInitData* i_pSizeClasses, unsigned int i_classCount)
+   {
+      unsigned int classIndex = 0;
+      for (size_t entry = 0; entry < SIZE_CLASS_LOOKUP_ENTRIES; entry++)
+      {
+         const size_t largestSize = entry << SIZE_CLASS_GRANULARITY_SHIFT;
+         while (classIndex < i_classCount && i_pSizeClasses[classIndex].blockSize < largestSize)
+            classIndex++;
+
+         m_classIndex[entry] = static_cast<unsigned char>(classIndex);
+      }
+   }
+};
+
+// Granularity of the page map. Every slab covers whole pages, so no page has two owners
+const size_t PAGE_MAP_SHIFT = 12;
+const size_t PAGE_MAP_PAGE_SIZE = static_cast<size_t>(1) << PAGE_MAP_SHIFT;
+
+// Page owners other than a size class index
+const unsigned char PAGE_OWNER_NONE = 0xFF;
+const unsigned char PAGE_OWNER_HEAP_MANAGER = 0xFE;
+
+static_assert(FSA_MAX_SIZE_CLASSES <= PAGE_OWNER_HEAP_MANAGER, "Size class indices must fit a page owner byte");
+
+/**
+ * @brief One owner byte per page of the memory handed to InitializeMemorySystem.
+ *
+ * The owner is either the index of the FixedSizeAllocator the page belongs to, PAGE_OWNER_HEAP_MANAGER or
+ * PAGE_OWNER_NONE, so free() finds the allocator of any pointer without asking every allocator whether it contains it.
+ */
+struct PageMap
+{
+   uintptr_t m_firstPage;       // Address of the first page >> PAGE_MAP_SHIFT
+   size_t m_pageCount;
+   unsigned char* m_pOwners;
 };
 
-extern const unsigned int g_FixedSizeAllocatorsCount;
+// The default size classes, used when InitializeMemorySystem is not given any
+extern const FSAInitData g_DefaultSizeClasses[];
+extern const unsigned int g_DefaultSizeClassCount;
+
+// The size classes the memory system was initialized with
+extern unsigned int g_FixedSizeAllocatorsCount;
+extern SizeClassLookupTable g_SizeClassLookupTable;
+extern PageMap g_PageMap;
 extern HeapManager* g_pHeapManager;
-extern FixedSizeAllocator* g_pFixedSizeAllocators[5];
+extern ThreadArena g_ThreadArenas[THREAD_ARENA_COUNT];
+extern GrowableFixedSizeAllocator* g_pFixedSizeAllocators[FSA_MAX_SIZE_CLASSES];
+
+// The allocators themselves are not thread-safe, every call into one has to hold its lock
+extern SpinLock g_FixedSizeAllocatorLocks[FSA_MAX_SIZE_CLASSES];
+extern SpinLock g_HeapManagerLock;
+
+// GetSizeClassIndex - index of the FixedSizeAllocator serving i_size, g_FixedSizeAllocatorsCount if there is none
+inline unsigned int GetSizeClassIndex(size_t i_size)
+{
+   if (i_size > SIZE_CLASS_MAX_SIZE)
+      return g_FixedSizeAllocatorsCount;
+
+   return g_SizeClassLookupTable.m_classIndex[(i_size + (1 << SIZE_CLASS_GRANULARITY_SHIFT) - 1) >> SIZE_CLASS_GRANULARITY_SHIFT];
+}
+
+// GetPageOwner - size class index of the FixedSizeAllocator owning i_ptr, PAGE_OWNER_HEAP_MANAGER or PAGE_OWNER_NONE
+inline unsigned char GetPageOwner(const void* i_ptr)
+{
+   // Pointers below the first page wrap around and fail the range check as well
+   const uintptr_t page = (reinterpret_cast<uintptr_t>(i_ptr) >> PAGE_MAP_SHIFT) - g_PageMap.m_firstPage;
+   return page < g_PageMap.m_pageCount ? g_PageMap.m_pOwners[page] : PAGE_OWNER_NONE;
+}
+
+// GetThreadArenaIndex - the thread arena this thread allocates from, assigned round robin on its first call
+unsigned int GetThreadArenaIndex();
 
-// InitializeMemorySystem - initialize your memory system including your HeapManager and some FixedSizeAllocators
-bool InitializeMemorySystem(void * i_pHeapMemory, size_t i_sizeHeapMemory, unsigned int i_OptionalNumDescriptors);
+// AllocFromHeap - allocate i_size bytes aligned to i_alignment from g_pHeapManager if its lock is free, else from the first arena of this
+//                 thread's thread arena with room, else from g_pHeapManager after all, mapping a new arena if none has room.
+//                 nullptr only if the OS is out of memory or HEAP_ARENA_MAX_COUNT arenas are mapped
+void* AllocFromHeap(size_t i_size, size_t i_alignment);
 
-// Collect - coalesce free blocks in attempt to create larger blocks
+// FindHeapArena - the arena whose memory holds i_ptr, nullptr if none does. Takes no lock, o_pThreadArena (optional) receives the index
+//                 of its thread arena, whose lock guards it. An arena stays mapped as long as it has outstanding allocations
+HeapManager* FindHeapArena(const void* i_ptr, unsigned int* o_pThreadArena = nullptr);
+
+// FreeToHeapArena - free i_ptr if an arena holds it, queueing it on its thread arena if this thread isn't assigned to that one. False if
+//                   no arena holds it
+bool FreeToHeapArena(const void* i_ptr);
+
+// InitializeMemorySystem - initialize your memory system including your HeapManager and one FixedSizeAllocator per size class.
+//                          i_pSizeClasses (g_DefaultSizeClasses if nullptr) must be sorted by block size, block sizes must be
+//                          multiples of SIZE_CLASS_GRANULARITY up to SIZE_CLASS_MAX_SIZE, and there can be up to FSA_MAX_SIZE_CLASSES
+bool InitializeMemorySystem(void * i_pHeapMemory, size_t i_sizeHeapMemory, unsigned int i_OptionalNumDescriptors,
+                            const FSAInitData * i_pSizeClasses = nullptr, unsigned int i_sizeClassCount = 0);
+
+// GetUsableSize - number of bytes usable at i_ptr, which must be a live allocation of the memory system (0 if it isn't ours)
+size_t GetUsableSize(const void * i_ptr);
+
+// Collect - return this thread's cached blocks, every empty slab above the reserved ones and the cached large allocation
+//           mappings, then verify the heap in debug builds (free blocks are coalesced as soon as they are freed). Decays the
+//           arenas: pages of free blocks that stayed free since the last pass are discarded, and arenas that stayed empty for
+//           HEAP_ARENA_DECAY_PASSES passes are unmapped
 void Collect();
 
+// Limits of a bounded Collect, 0 means no limit
+struct CollectBudget
+{
+   size_t maxNodes;           // Slabs and heap blocks to look at
+   uint64_t maxNanoseconds;
+};
+
+// What a bounded Collect did and how fragmented the heap is afterwards
+struct CollectProgress
+{
+   bool bPassComplete;        // The pass is done, the next Collect starts a new one
+   size_t nodesVisited;       // Slabs and heap blocks looked at by this call
+   size_t slabsReleased;      // Empty slabs given back to the heap by this call
+   size_t freeHeapBytes;      // Bytes in free heap blocks, headers included
+   size_t largestFreeHeapBlock;
+   float fragmentation;       // Share of the free heap bytes outside the largest free block, 0 if there is a single one
+};
+
+// Collect - do the work of Collect() a few slabs and heap blocks at a time within i_budget, continuing where the last call stopped,
+//           so idle time in a frame can be spent on it instead of a stall later. The arenas decay once at the end of every pass
+//           (not counted against the budget). Returns true once a whole pass is done,
+//           o_pProgress (optional) receives what this call did
+bool Collect(const CollectBudget& i_budget, CollectProgress* o_pProgress = nullptr);
+
 // DestroyMemorySystem - destroy your memory systems
 void DestroyMemorySystem();
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "../FixedSizeAllocator/FixedSizeAllocator.h"
+#include "../HeapManager/HeapManager.h"
+#include "../Utilities/PointerMath.h"
+
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// True if T has a Reset() member, which a keep-constructed ObjectPool calls instead of the destructor
+template <class T, class = void>
+struct HasReset : std::false_type
+{
+};
+
+template <class T>
+struct HasReset<T, std::void_t<decltype(std::declval<T&>().Reset())>> : std::true_type
+{
+};
+
+/**
+ * @class ObjectPool
+ *
+ * @brief Creates and destroys objects of one type in blocks of a FixedSizeAllocator of their own, instead of going
+ *        through new/delete and the size class dispatch for each of them.
+ *
+ * The block size is fixed at compile time from sizeof(T) and alignof(T), so finding a block's index takes no load of
+ * the allocator's block size. CreateBatch and DestroyBatch claim and release up to a BitArray element of blocks per bit
+ * operation. ForEachLive walks the live objects in address order straight from the BitArray, a word of it at a time.
+ *
+ * With KeepConstructed, Destroy leaves the object constructed and only calls its Reset() if it has one, and Create hands
+ * it out again as it is. Every block is default constructed the first time it is handed out and destructed by
+ * DestroyObjectPool, so a recycled object keeps the buffers it already acquired. The blocks are never filled with a
+ * debug pattern in this mode, which would overwrite the objects kept in them.
+ *
+ * The pool sits at the start of a chunk taken from a HeapManager, with its allocator right behind it. Not thread-safe,
+ * and CreateObjectPool and DestroyObjectPool call into the HeapManager, so lock it as usual.
+ */
+template <class T, bool KeepConstructed = false, class Policy = DefaultFixedSizeAllocatorPolicy>
+class ObjectPool
+{
+    static_assert(alignof(T) <= FSA_CACHE_LINE_SIZE, "Blocks are aligned to a cache line at most");
+
+public:
+    // Blocks below a cache line are aligned to less than their size rounds up to, so over-aligned types get a whole one
+    static const size_t BlockSize = alignof(T) > FSA_MIN_BLOCK_ALIGNMENT && sizeof(T) < FSA_CACHE_LINE_SIZE ? FSA_CACHE_LINE_SIZE : sizeof(T);
+
+    typedef FixedSizeAllocatorPolicy<typename Policy::Guardband, typename std::conditional<KeepConstructed, NoFill, typename Policy::Fill>::type,
+                                     typename Policy::Stats> AllocatorPolicy;
+    typedef BasicFixedSizeAllocator<BlockSize, AllocatorPolicy> Allocator;
+
+    HeapManager* m_pHeapManager;    // Owns the chunk
+    Allocator* m_pAllocator;
+    size_t m_constructedCount;      // KeepConstructed: every block below this index holds a constructed object
+
+    // Bytes CreateObjectPool takes from its HeapManager for a pool of i_capacity objects
+    static size_t GetSize(size_t i_capacity)
+    {
+        return getHeaderSize() + Allocator::GetSize(BlockSize, i_capacity);
+    }
+
+    /**
+     * @brief Creates an object from the arguments, or hands out a recycled one with KeepConstructed (which takes none).
+     *
+     * @return nullptr if the pool is full.
+     */
+    template <class... Args>
+    T* Create(Args&&... i_args)
+    {
+        void* ptr = m_pAllocator->Alloc();
+        if (ptr == nullptr)
+        {
+            return nullptr;
+        }
+
+        if constexpr (KeepConstructed)
+        {
+            static_assert(sizeof...(Args) == 0, "A keep-constructed pool hands out objects that already exist");
+            return constructOnFirstUse(ptr);
+        }
+        else
+        {
+            return construct(ptr, std::forward<Args>(i_args)...);
+        }
+    }
+
+    /**
+     * @brief Destroys an object Create or CreateBatch returned, or just resets it with KeepConstructed.
+     */
+    void Destroy(T* i_pObject)
+    {
+        assert(m_pAllocator->IsAllocated(i_pObject) && "Not a live object of this pool");
+
+        release(i_pObject);
+        const bool bFreed = m_pAllocator->Free(i_pObject);
+        assert(bFreed);
+        (void)bFreed;
+    }
+
+    /**
+     * @brief Creates up to i_count objects into o_objects, each one copy constructed from the arguments (or recycled with
+     *        KeepConstructed), and returns how many it created, fewer only if the pool ran out.
+     */
+    template <class... Args>
+    size_t CreateBatch(T** o_objects, size_t i_count, const Args&... i_args)
+    {
+        void** ptrs = reinterpret_cast<void**>(o_objects);
+        const size_t allocCount = m_pAllocator->AllocBatch(ptrs, i_count);
+
+        for (size_t i = 0; i < allocCount; i++)
+        {
+            if constexpr (KeepConstructed)
+            {
+                static_assert(sizeof...(Args) == 0, "A keep-constructed pool hands out objects that already exist");
+                o_objects[i] = constructOnFirstUse(ptrs[i]);
+            }
+            else
+            {
+                o_objects[i] = construct(ptrs[i], i_args...);
+            }
+        }
+        return allocCount;
+    }
+
+    /**
+     * @brief Destroys the i_count objects in i_objects like Destroy does. Objects in the order CreateBatch returned them
+     *        (or sorted by address) are released a BitArray element at a time.
+     */
+    void DestroyBatch(T* const* i_objects, size_t i_count)
+    {
+        for (size_t i = 0; i < i_count; i++)
+        {
+            assert(m_pAllocator->IsAllocated(i_objects[i]) && "Not a live object of this pool");
+            release(i_objects[i]);
+        }
+
+        const size_t freeCount = m_pAllocator->FreeBatch(reinterpret_cast<void* const*>(i_objects), i_count);
+        assert(freeCount == i_count);
+        (void)freeCount;
+    }
+
+    /**
+     * @brief Calls i_function with every live object, in address order.
+     *
+     * Each word of the BitArray is read once and its set bits are walked from a copy, so i_function may Destroy the
+     * object it was called with (but no other, and it must not Create any).
+     */
+    template <class Function>
+    void ForEachLive(Function i_function)
+    {
+        const BitArray& bitArray = m_pAllocator->m_BitArray;
+        for (size_t elementIndex = 0; elementIndex < bitArray.m_elementCount; elementIndex++)
+        {
+            for (t_BitData bits = bitArray.m_pBits[elementIndex]; bits != 0; bits &= bits - 1)
+            {
+                i_function(*getObject(elementIndex * bitArray.bitsPerElement + FindLowestSetBit(bits)));
+            }
+        }
+    }
+
+    bool Contains(const void* i_ptr) const
+    {
+        return m_pAllocator->Contains(i_ptr);
+    }
+
+    size_t GetLiveCount() const
+    {
+        return m_pAllocator->m_blockNum - m_pAllocator->m_freeBlockNum;
+    }
+
+    size_t GetCapacity() const
+    {
+        return m_pAllocator->m_blockNum;
+    }
+
+private:
+    static size_t getHeaderSize()
+    {
+        return (sizeof(ObjectPool) + HEAP_BLOCK_GRANULARITY - 1) & ~(HEAP_BLOCK_GRANULARITY - 1);
+    }
+
+    T* getObject(size_t i_blockIndex) const
+    {
+        char* pBlock = static_cast<char*>(m_pAllocator->m_blockBaseAddr) + i_blockIndex * Allocator::GetBlockStride(BlockSize);
+        return std::launder(reinterpret_cast<T*>(pBlock + Allocator::GetBlockOffset(BlockSize)));
+    }
+
+    template <class... Args>
+    T* construct(void* i_ptr, Args&&... i_args)
+    {
+        try
+        {
+            return new (i_ptr) T(std::forward<Args>(i_args)...);
+        }
+        catch (...)
+        {
+            m_pAllocator->Free(i_ptr);
+            throw;
+        }
+    }
+
+    // The allocator always hands out the lowest free block, so the blocks that were ever handed out are the ones below
+    // the highest of them, and a block at m_constructedCount is the first one handed out for the first time
+    T* constructOnFirstUse(void* i_ptr)
+    {
+        const size_t blockIndex = (static_cast<char*>(i_ptr) - static_cast<char*>(m_pAllocator->m_blockBaseAddr)) / Allocator::GetBlockStride(BlockSize);
+        assert(blockIndex <= m_constructedCount);
+
+        if (blockIndex < m_constructedCount)
+        {
+            return std::launder(static_cast<T*>(i_ptr));
+        }
+
+        T* pObject = construct(i_ptr);
+        m_constructedCount++;
+        return pObject;
+    }
+
+    void release(T* i_pObject)
+    {
+        if constexpr (!KeepConstructed)
+        {
+            i_pObject->~T();
+        }
+        else if constexpr (HasReset<T>::value)
+        {
+            i_pObject->Reset();
+        }
+    }
+
+    template <class U, bool K, class P>
+    friend ObjectPool<U, K, P>* CreateObjectPool(HeapManager* i_pHeapManager, size_t i_capacity);
+
+    template <class U, bool K, class P>
+    friend void DestroyObjectPool(ObjectPool<U, K, P>* i_pPool);
+};
+
+/**
+ * @brief Creates an ObjectPool for up to i_capacity objects in one chunk allocated from i_pHeapManager.
+ *
+ * @return nullptr if the HeapManager has no room for the chunk.
+ */
+template <class T, bool KeepConstructed = false, class Policy = DefaultFixedSizeAllocatorPolicy>
+ObjectPool<T, KeepConstructed, Policy>* CreateObjectPool(HeapManager* i_pHeapManager, size_t i_capacity)
+{
+    typedef ObjectPool<T, KeepConstructed, Policy> Pool;
+
+    assert(i_pHeapManager != nullptr && i_capacity > 0);
+
+    void* pChunk = i_pHeapManager->Alloc(Pool::GetSize(i_capacity), HEAP_BLOCK_GRANULARITY);
+    if (pChunk == nullptr)
+    {
+        return nullptr;
+    }
+
+    Pool* pPool = static_cast<Pool*>(pChunk);
+    pPool->m_pHeapManager = i_pHeapManager;
+    pPool->m_pAllocator = Pool::Allocator::Create(Pool::BlockSize, i_capacity, PointerAdd(pChunk, Pool::getHeaderSize()), false);
+    pPool->m_constructedCount = 0;
+    return pPool;
+}
+
+/**
+ * @brief Destroys every object still alive in i_pPool (every one it ever constructed with KeepConstructed) and gives
+ *        its chunk back to its HeapManager.
+ */
+template <class T, bool KeepConstructed, class Policy>
+void DestroyObjectPool(ObjectPool<T, KeepConstructed, Policy>* i_pPool)
+{
+    if constexpr (KeepConstructed)
+    {
+        for (size_t blockIndex = 0; blockIndex < i_pPool->m_constructedCount; blockIndex++)
+        {
+            i_pPool->getObject(blockIndex)->~T();
+        }
+    }
+    else
+    {
+        i_pPool->ForEachLive([](T& i_object) { i_object.~T(); });
+    }
+
+    i_pPool->m_pAllocator->Destroy();
+
+    HeapManager* pHeapManager = i_pPool->m_pHeapManager;
+    const bool bFreed = pHeapManager->Free(i_pPool);
+    assert(bFreed);
+    (void)bFreed;
+}
@@ -0,0 +1,197 @@
+#include "SizeClassProfiler.h"
+#include "../ThreadCache/ThreadCache.h"
+#include "../Utilities/Atomics.h"
+
+#include <cstdio>
+
+std::atomic<bool> g_bRecordSizeHistogram(false);
+
+static SizeHistogram s_SizeHistogram = {};
+
+void StartSizeHistogram()
+{
+	for (uint64_t& count : s_SizeHistogram.m_requestCount)
+	{
+		AsAtomic(count).store(0, std::memory_order_relaxed);
+	}
+	AsAtomic(s_SizeHistogram.m_largeRequestCount).store(0, std::memory_order_relaxed);
+
+	g_bRecordSizeHistogram.store(true, std::memory_order_relaxed);
+}
+
+void StopSizeHistogram()
+{
+	g_bRecordSizeHistogram.store(false, std::memory_order_relaxed);
+}
+
+void RecordRequestSize(size_t i_size)
+{
+	uint64_t& count = i_size > SIZE_CLASS_MAX_SIZE
+		? s_SizeHistogram.m_largeRequestCount
+		: s_SizeHistogram.m_requestCount[(i_size + SIZE_CLASS_GRANULARITY - 1) >> SIZE_CLASS_GRANULARITY_SHIFT];
+
+	AsAtomic(count).fetch_add(1, std::memory_order_relaxed);
+}
+
+void GetSizeHistogram(SizeHistogram& o_histogram)
+{
+	for (size_t entry = 0; entry < SIZE_CLASS_LOOKUP_ENTRIES; entry++)
+	{
+		o_histogram.m_requestCount[entry] = AsAtomic(s_SizeHistogram.m_requestCount[entry]).load(std::memory_order_relaxed);
+	}
+	o_histogram.m_largeRequestCount = AsAtomic(s_SizeHistogram.m_largeRequestCount).load(std::memory_order_relaxed);
+}
+
+uint64_t GetInternalFragmentation(const SizeHistogram& i_histogram, const FSAInitData* i_pSizeClasses, unsigned int i_classCount)
+{
+	uint64_t fragmentation = 0;
+	unsigned int classIndex = 0;
+	for (size_t entry = 0; entry < SIZE_CLASS_LOOKUP_ENTRIES; entry++)
+	{
+		const size_t largestSize = entry << SIZE_CLASS_GRANULARITY_SHIFT;
+		while (classIndex < i_classCount && i_pSizeClasses[classIndex].blockSize < largestSize)
+			classIndex++;
+
+		if (classIndex == i_classCount)
+			break;
+
+		fragmentation += i_histogram.m_requestCount[entry] * (i_pSizeClasses[classIndex].blockSize - largestSize);
+	}
+
+	return fragmentation;
+}
+
+// Same split as the default size classes: small blocks are requested most often and cost the least to cache
+static unsigned int getThreadCacheDepth(size_t i_blockSize)
+{
+	if (i_blockSize <= 128)
+		return 32;
+
+	return i_blockSize <= 256 ? 16 : 8;
+}
+
+unsigned int ComputeSizeClasses(const SizeHistogram& i_histogram, size_t i_memoryBudget, unsigned int i_maxClassCount, FSAInitData* o_pSizeClasses)
+{
+	const size_t entryCount = SIZE_CLASS_LOOKUP_ENTRIES;
+
+	// Prefix sums of the requests and of their bucket indices, the fragmentation of a class over any range of buckets
+	// is then two subtractions
+	uint64_t requestCount[entryCount];
+	uint64_t requestIndexSum[entryCount];
+	unsigned int usedEntryCount = 0;
+	size_t lastEntry = 0;
+	for (size_t entry = 0; entry < entryCount; entry++)
+	{
+		const uint64_t count = i_histogram.m_requestCount[entry];
+		requestCount[entry] = count + (entry > 0 ? requestCount[entry - 1] : 0);
+		requestIndexSum[entry] = count * entry + (entry > 0 ? requestIndexSum[entry - 1] : 0);
+
+		// 0 byte requests are served by the smallest class like 16 byte ones
+		if (count > 0)
+		{
+			lastEntry = entry;
+			if (entry > 0 || i_histogram.m_requestCount[1] == 0)
+				usedEntryCount++;
+		}
+	}
+
+	if (requestCount[entryCount - 1] == 0)
+		return 0;
+
+	if (lastEntry == 0)
+		lastEntry = 1;
+
+	// Every class reserves at least one slab, more classes than used buckets can't lower the fragmentation
+	size_t maxClassCount = i_memoryBudget / FSA_SLAB_SIZE;
+	if (maxClassCount > i_maxClassCount)
+		maxClassCount = i_maxClassCount;
+	if (maxClassCount > FSA_MAX_SIZE_CLASSES)
+		maxClassCount = FSA_MAX_SIZE_CLASSES;
+	if (maxClassCount > usedEntryCount)
+		maxClassCount = usedEntryCount;
+
+	if (maxClassCount == 0)
+		return 0;
+
+	// Fragmentation, in buckets, of a class serving every bucket in [i_firstEntry, i_lastEntry]
+	auto fragmentation = [&](size_t i_firstEntry, size_t i_lastEntry)
+	{
+		const uint64_t count = requestCount[i_lastEntry] - (i_firstEntry > 0 ? requestCount[i_firstEntry - 1] : 0);
+		const uint64_t indexSum = requestIndexSum[i_lastEntry] - (i_firstEntry > 0 ? requestIndexSum[i_firstEntry - 1] : 0);
+		return count * i_lastEntry - indexSum;
+	};
+
+	// minFragmentation[k][entry]: least fragmentation serving buckets [0, entry] with k + 1 classes, the largest one
+	// ending at entry. Classes end at bucket 1 at the earliest, blocks are never 0 bytes
+	uint64_t minFragmentation[FSA_MAX_SIZE_CLASSES][entryCount];
+	unsigned char previousEntry[FSA_MAX_SIZE_CLASSES][entryCount];
+	for (size_t entry = 1; entry <= lastEntry; entry++)
+	{
+		minFragmentation[0][entry] = fragmentation(0, entry);
+	}
+
+	size_t bestClassCount = 1;
+	for (size_t k = 1; k < maxClassCount; k++)
+	{
+		for (size_t entry = k + 1; entry <= lastEntry; entry++)
+		{
+			minFragmentation[k][entry] = UINT64_MAX;
+			for (size_t previous = k; previous < entry; previous++)
+			{
+				const uint64_t candidate = minFragmentation[k - 1][previous] + fragmentation(previous + 1, entry);
+				if (candidate < minFragmentation[k][entry])
+				{
+					minFragmentation[k][entry] = candidate;
+					previousEntry[k][entry] = static_cast<unsigned char>(previous);
+				}
+			}
+		}
+
+		// Fewer classes win ties, every class costs a slab
+		if (lastEntry >= k + 1 && minFragmentation[k][lastEntry] < minFragmentation[bestClassCount - 1][lastEntry])
+			bestClassCount = k + 1;
+	}
+
+	// Walk the class boundaries back from the largest class
+	size_t entry = lastEntry;
+	for (size_t k = bestClassCount; k-- > 0;)
+	{
+		o_pSizeClasses[k].blockSize = entry << SIZE_CLASS_GRANULARITY_SHIFT;
+		if (k > 0)
+			entry = previousEntry[k][entry];
+	}
+
+	// Split the budget by the bytes each class hands out
+	uint64_t classBytes[FSA_MAX_SIZE_CLASSES];
+	uint64_t totalBytes = 0;
+	size_t firstEntry = 0;
+	for (size_t k = 0; k < bestClassCount; k++)
+	{
+		const size_t lastClassEntry = o_pSizeClasses[k].blockSize >> SIZE_CLASS_GRANULARITY_SHIFT;
+		const uint64_t count = requestCount[lastClassEntry] - (firstEntry > 0 ? requestCount[firstEntry - 1] : 0);
+		classBytes[k] = count * o_pSizeClasses[k].blockSize;
+		totalBytes += classBytes[k];
+		firstEntry = lastClassEntry + 1;
+	}
+
+	for (size_t k = 0; k < bestClassCount; k++)
+	{
+		const double share = static_cast<double>(classBytes[k]) / static_cast<double>(totalBytes);
+		const size_t blockNum = static_cast<size_t>(share * i_memoryBudget / o_pSizeClasses[k].blockSize);
+
+		o_pSizeClasses[k].blockNum = blockNum > 0 ? blockNum : 1;
+		o_pSizeClasses[k].threadCacheDepth = getThreadCacheDepth(o_pSizeClasses[k].blockSize);
+	}
+
+	return static_cast<unsigned int>(bestClassCount);
+}
+
+void PrintSizeClasses(const FSAInitData* i_pSizeClasses, unsigned int i_classCount)
+{
+	printf("const FSAInitData g_DefaultSizeClasses[] = {\n");
+	for (unsigned int i = 0; i < i_classCount; i++)
+	{
+		printf("\t{ %zu, %zu, %u },\n", i_pSizeClasses[i].blockSize, i_pSizeClasses[i].blockNum, i_pSizeClasses[i].threadCacheDepth);
+	}
+	printf(" };\n");
+}
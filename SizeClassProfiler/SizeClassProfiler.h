@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../MemorySystem.h"
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Size class profiling.
+ *
+ * While recording, malloc counts every request in a histogram with the same 16 byte buckets as the size class lookup
+ * table. ComputeSizeClasses then fits a size class table to the histogram, which can be passed to InitializeMemorySystem
+ * or printed as source with PrintSizeClasses.
+ */
+
+struct SizeHistogram
+{
+	uint64_t m_requestCount[SIZE_CLASS_LOOKUP_ENTRIES];	// Requests per lookup table entry, entry i counts sizes ((i - 1) * 16, i * 16]
+	uint64_t m_largeRequestCount;						// Requests above SIZE_CLASS_MAX_SIZE
+};
+
+// Checked by malloc before it records a request, off unless StartSizeHistogram was called
+extern std::atomic<bool> g_bRecordSizeHistogram;
+
+// StartSizeHistogram - clear the histogram and count the size of every malloc from now on
+void StartSizeHistogram();
+
+// StopSizeHistogram - stop counting, the histogram is kept
+void StopSizeHistogram();
+
+// RecordRequestSize - count one request of i_size, called by malloc while recording
+void RecordRequestSize(size_t i_size);
+
+// GetSizeHistogram - the requests counted so far
+void GetSizeHistogram(SizeHistogram& o_histogram);
+
+// GetInternalFragmentation - bytes lost to rounding every request of i_histogram up to its size class. Approximate, requests
+//                            are taken to be the largest size of their bucket. Requests no class serves are not counted
+uint64_t GetInternalFragmentation(const SizeHistogram& i_histogram, const FSAInitData* i_pSizeClasses, unsigned int i_classCount);
+
+// ComputeSizeClasses - the size classes with the least internal fragmentation for i_histogram, written to o_pSizeClasses.
+//                      Every class reserves at least one slab, so i_memoryBudget (bytes reserved over all classes) limits the
+//                      number of classes as well as i_maxClassCount. The budget is split by each class's share of the requested
+//                      bytes. Returns the number of classes, 0 if no request fits a size class
+unsigned int ComputeSizeClasses(const SizeHistogram& i_histogram, size_t i_memoryBudget, unsigned int i_maxClassCount, FSAInitData* o_pSizeClasses);
+
+// PrintSizeClasses - print a size class table as C++ source, in the format of g_DefaultSizeClasses
+void PrintSizeClasses(const FSAInitData* i_pSizeClasses, unsigned int i_classCount);
@@ -0,0 +1,212 @@
+#include "ThreadCache.h"
+#include "../MemorySystem.h"
+
+#include <cassert>
+#include <cstring>
+
+#if _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+struct ThreadCache
+{
+	void* m_pBlocks[FSA_MAX_SIZE_CLASSES][THREAD_CACHE_MAX_DEPTH];	// Per class stack, the most recently freed block on top
+	unsigned int m_blockCount[FSA_MAX_SIZE_CLASSES];
+	bool m_bExitHookSet;
+};
+
+// Plain data, so every thread starts with an empty cache without a TLS constructor or destructor running inside malloc
+static thread_local ThreadCache t_ThreadCache;
+
+static unsigned int s_threadCacheDepth[FSA_MAX_SIZE_CLASSES] = {0};
+
+// The thread exit hook: the key's destructor flushes the cache stored in it
+#if _WIN32
+static DWORD s_threadExitKey = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t s_threadExitKey;
+static bool s_bThreadExitKeyCreated = false;
+#endif
+
+// Returns the i_count oldest blocks of a class to its allocator in a single critical section
+static void flushBlocks(ThreadCache& io_cache, unsigned int i_sizeClass, unsigned int i_count)
+{
+	void** pBlocks = io_cache.m_pBlocks[i_sizeClass];
+	{
+		ScopedSpinLock lock(g_FixedSizeAllocatorLocks[i_sizeClass]);
+		g_pFixedSizeAllocators[i_sizeClass]->FreeBatch(pBlocks, i_count);
+	}
+
+	io_cache.m_blockCount[i_sizeClass] -= i_count;
+	memmove(pBlocks, pBlocks + i_count, io_cache.m_blockCount[i_sizeClass] * sizeof(void*));
+}
+
+static void flushCache(ThreadCache& io_cache)
+{
+	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+	{
+		if (io_cache.m_blockCount[i] > 0)
+		{
+			flushBlocks(io_cache, i, io_cache.m_blockCount[i]);
+		}
+	}
+}
+
+#if _WIN32
+static void WINAPI onThreadExit(void* i_pCache)
+#else
+static void onThreadExit(void* i_pCache)
+#endif
+{
+	ThreadCache& cache = *static_cast<ThreadCache*>(i_pCache);
+	flushCache(cache);
+
+	// The key is cleared now. A later destructor that frees again caches those blocks and sets it anew, and the key's
+	// destructors run again (up to PTHREAD_DESTRUCTOR_ITERATIONS times, the same for FLS) to flush them
+	cache.m_bExitHookSet = false;
+}
+
+// Makes sure the blocks this thread is about to cache are flushed when it exits
+static void setThreadExitHook(ThreadCache& io_cache)
+{
+	// Set first: storing the key's value may allocate, which comes right back here
+	io_cache.m_bExitHookSet = true;
+
+#if _WIN32
+	FlsSetValue(s_threadExitKey, &io_cache);
+#else
+	pthread_setspecific(s_threadExitKey, &io_cache);
+#endif
+}
+
+bool InitializeThreadCaches()
+{
+#if _WIN32
+	s_threadExitKey = FlsAlloc(onThreadExit);
+	return s_threadExitKey != FLS_OUT_OF_INDEXES;
+#else
+	s_bThreadExitKeyCreated = pthread_key_create(&s_threadExitKey, onThreadExit) == 0;
+	return s_bThreadExitKeyCreated;
+#endif
+}
+
+void SetThreadCacheDepth(unsigned int i_sizeClass, unsigned int i_depth)
+{
+	assert(i_sizeClass < FSA_MAX_SIZE_CLASSES);
+	assert(i_depth <= THREAD_CACHE_MAX_DEPTH);
+
+	s_threadCacheDepth[i_sizeClass] = i_depth < THREAD_CACHE_MAX_DEPTH ? i_depth : THREAD_CACHE_MAX_DEPTH;
+}
+
+void* ThreadCacheAlloc(unsigned int i_sizeClass)
+{
+	ThreadCache& cache = t_ThreadCache;
+	unsigned int& blockCount = cache.m_blockCount[i_sizeClass];
+
+	if (blockCount == 0)
+	{
+		const unsigned int depth = s_threadCacheDepth[i_sizeClass];
+		GrowableFixedSizeAllocator* pAllocator = g_pFixedSizeAllocators[i_sizeClass];
+
+		if (depth == 0)
+		{
+			// Caching is off for this class
+			ScopedSpinLock lock(g_FixedSizeAllocatorLocks[i_sizeClass]);
+			return pAllocator->Alloc();
+		}
+
+		if (!cache.m_bExitHookSet)
+		{
+			setThreadExitHook(cache);
+		}
+
+		// Refill half of the stack, leaving the other half for frees before the next flush
+		const unsigned int refillCount = (depth + 1) / 2;
+		{
+			ScopedSpinLock lock(g_FixedSizeAllocatorLocks[i_sizeClass]);
+			blockCount = static_cast<unsigned int>(pAllocator->AllocBatch(cache.m_pBlocks[i_sizeClass], refillCount));
+		}
+
+		if (blockCount == 0)
+		{
+			return nullptr;
+		}
+	}
+
+	return cache.m_pBlocks[i_sizeClass][--blockCount];
+}
+
+void ThreadCacheFree(unsigned int i_sizeClass, void* i_ptr)
+{
+	ThreadCache& cache = t_ThreadCache;
+	GrowableFixedSizeAllocator* pAllocator = g_pFixedSizeAllocators[i_sizeClass];
+	const unsigned int depth = s_threadCacheDepth[i_sizeClass];
+
+	if (depth == 0)
+	{
+		// Caching is off for this class
+		ScopedSpinLock lock(g_FixedSizeAllocatorLocks[i_sizeClass]);
+		pAllocator->Free(i_ptr);
+		return;
+	}
+
+	// Interior pointers would be handed out again from the cache, the allocator ignores them so do the same here
+	if (!pAllocator->IsBlockAddress(i_ptr))
+	{
+		return;
+	}
+
+#ifdef _DEBUG
+	// Cached blocks skip the allocator's checks until they are flushed, catch bad and double frees here instead
+	{
+		ScopedSpinLock lock(g_FixedSizeAllocatorLocks[i_sizeClass]);
+		assert(pAllocator->IsAllocated(i_ptr));
+	}
+	for (unsigned int i = 0; i < cache.m_blockCount[i_sizeClass]; i++)
+	{
+		assert(cache.m_pBlocks[i_sizeClass][i] != i_ptr);
+	}
+#endif
+
+	if (!cache.m_bExitHookSet)
+	{
+		setThreadExitHook(cache);
+	}
+
+	// Full: flush the older half, the blocks freed last are the ones still warm in this core's cache
+	if (cache.m_blockCount[i_sizeClass] >= depth)
+	{
+		flushBlocks(cache, i_sizeClass, cache.m_blockCount[i_sizeClass] - depth / 2);
+	}
+
+	cache.m_pBlocks[i_sizeClass][cache.m_blockCount[i_sizeClass]++] = i_ptr;
+}
+
+void FlushThreadCache()
+{
+	flushCache(t_ThreadCache);
+}
+
+void DestroyThreadCaches()
+{
+	FlushThreadCache();
+	t_ThreadCache.m_bExitHookSet = false;
+
+#if _WIN32
+	if (s_threadExitKey != FLS_OUT_OF_INDEXES)
+	{
+		FlsSetValue(s_threadExitKey, nullptr);
+		FlsFree(s_threadExitKey);
+		s_threadExitKey = FLS_OUT_OF_INDEXES;
+	}
+#else
+	if (s_bThreadExitKeyCreated)
+	{
+		pthread_setspecific(s_threadExitKey, nullptr);
+		pthread_key_delete(s_threadExitKey);
+		s_bThreadExitKeyCreated = false;
+	}
+#endif
+}
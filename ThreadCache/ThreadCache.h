@@ -0,0 +1,31 @@
+#pragma once
+
+// Most blocks a thread can cache per size class
+const unsigned int THREAD_CACHE_MAX_DEPTH = 64;
+
+/**
+ * Per-thread magazine caches in front of the FixedSizeAllocators.
+ *
+ * Every thread keeps a small stack of blocks per size class. malloc pops from it and free pushes onto it without
+ * taking any lock. Only when a stack runs empty (or full) is half of its depth refilled from (or flushed back to)
+ * the shared FixedSizeAllocator, in one short critical section under that allocator's lock.
+ * A thread's cached blocks go back to the allocators when the thread exits.
+ */
+
+// InitializeThreadCaches - set up the thread exit hook, called by InitializeMemorySystem
+bool InitializeThreadCaches();
+
+// SetThreadCacheDepth - number of blocks each thread caches for i_sizeClass (at most THREAD_CACHE_MAX_DEPTH), set before other threads allocate
+void SetThreadCacheDepth(unsigned int i_sizeClass, unsigned int i_depth);
+
+// ThreadCacheAlloc - a block of i_sizeClass from this thread's cache, refilled from the allocator if needed. nullptr if the class is exhausted
+void* ThreadCacheAlloc(unsigned int i_sizeClass);
+
+// ThreadCacheFree - return a block of i_sizeClass to this thread's cache, flushing half of it to the allocator if it is full
+void ThreadCacheFree(unsigned int i_sizeClass, void* i_ptr);
+
+// FlushThreadCache - give every block this thread caches back to its allocator
+void FlushThreadCache();
+
+// DestroyThreadCaches - flush this thread's cache and remove the thread exit hook, called by DestroyMemorySystem
+void DestroyThreadCaches();
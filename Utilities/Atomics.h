@@ -0,0 +1,19 @@
+#pragma once
+
+#include <atomic>
+
+/**
+ * @brief Views a plain integer as an atomic one.
+ *
+ * Lets structures that are placed into raw memory without running constructors (BitArray storage,
+ * allocator counters) be updated atomically in place, without changing their type or layout for the
+ * single-threaded code paths that use them as plain integers.
+ */
+template <typename T>
+inline std::atomic<T>& AsAtomic(T& io_value)
+{
+    static_assert(sizeof(std::atomic<T>) == sizeof(T), "std::atomic<T> must have the layout of T");
+    static_assert(alignof(std::atomic<T>) == alignof(T), "std::atomic<T> must have the alignment of T");
+
+    return reinterpret_cast<std::atomic<T>&>(io_value);
+}
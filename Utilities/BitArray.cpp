@@ -1,6 +1,96 @@
 ﻿#include "BitArray.h"
+#include "Atomics.h"
+#include "BitScan.h"
 
 #include <intrin0.inl.h>
+#include <cstring>
+
+static inline unsigned long lowestSetBit(t_BitData i_bits)
+{
+    unsigned long bitIndex;
+
+#if _WIN32
+    _BitScanForward(&bitIndex, i_bits);
+#else
+    _BitScanForward64(&bitIndex, i_bits);
+#endif
+
+    return bitIndex;
+}
+
+// Fills in the element count of every summary level an array of i_elementCount elements needs and returns the level count
+static size_t getSummaryLevels(size_t i_elementCount, size_t o_levelElementCount[BITARRAY_MAX_SUMMARY_LEVELS])
+{
+    const size_t bitsPerElement = sizeof(t_BitData) * 8;
+
+    if (i_elementCount <= BITARRAY_SUMMARY_MIN_ELEMENTS)
+    {
+        return 0;
+    }
+
+    size_t levelCount = 0;
+    size_t elementCount = i_elementCount;
+    while (elementCount > 1 && levelCount < BITARRAY_MAX_SUMMARY_LEVELS)
+    {
+        elementCount = (elementCount + bitsPerElement - 1) / bitsPerElement;
+        o_levelElementCount[levelCount++] = elementCount;
+    }
+    return levelCount;
+}
+
+size_t GetBitArraySize(size_t i_numBits)
+{
+    const size_t bitsPerElement = sizeof(t_BitData) * 8;
+    const size_t elementCount = (i_numBits + bitsPerElement - 1) / bitsPerElement;
+
+    size_t levelElementCount[BITARRAY_MAX_SUMMARY_LEVELS];
+    const size_t levelCount = getSummaryLevels(elementCount, levelElementCount);
+
+    // Every summary level holds a "not full" and a "not empty" array
+    size_t summaryElementCount = 0;
+    for (size_t level = 0; level < levelCount; level++)
+    {
+        summaryElementCount += 2 * levelElementCount[level];
+    }
+
+    return sizeof(BitArray) + sizeof(t_BitData) * (elementCount + summaryElementCount);
+}
+
+BitArray* CreateBitArray(void* baseAddr, size_t i_numBits, bool i_bInitToZero)
+{
+    BitArray* pBitArray = static_cast<BitArray*>(baseAddr);
+
+    // Initialize BitArray members
+    pBitArray->m_bitLength = i_numBits;
+    pBitArray->bitsPerElement = sizeof(t_BitData) * 8;
+    pBitArray->m_elementCount = (i_numBits + pBitArray->bitsPerElement - 1) / pBitArray->bitsPerElement;
+
+    const auto newAddress = PointerAdd(pBitArray, sizeof(BitArray));
+    pBitArray->m_pBits = static_cast<t_BitData*>(newAddress);
+
+    // Summary levels follow the bits, the "not full" and "not empty" arrays of each level side by side
+    pBitArray->m_summaryLevelCount = getSummaryLevels(pBitArray->m_elementCount, pBitArray->m_summaryElementCount);
+
+    t_BitData* pSummary = pBitArray->m_pBits + pBitArray->m_elementCount;
+    for (size_t level = 0; level < pBitArray->m_summaryLevelCount; level++)
+    {
+        pBitArray->m_pNotFullSummary[level] = pSummary;
+        pSummary += pBitArray->m_summaryElementCount[level];
+        pBitArray->m_pNotEmptySummary[level] = pSummary;
+        pSummary += pBitArray->m_summaryElementCount[level];
+    }
+
+    if (i_bInitToZero)
+    {
+        pBitArray->ClearAll();
+    }
+    else
+    {
+        pBitArray->SetAll();
+    }
+
+    return pBitArray;
+}
 
 BitArray::BitArray() = default;
 
@@ -9,20 +99,27 @@ BitArray::~BitArray()
 
 bool BitArray::FindFirstSetBit(size_t& o_firstSetBitIndex) const
 {
-    return findBit(true, o_firstSetBitIndex);
+    return findBit(true, 0, o_firstSetBitIndex);
 }
 
 bool BitArray::FindFirstClearBit(size_t& o_firstClearBitIndex) const
 {
-    return findBit(false, o_firstClearBitIndex);
+    return findBit(false, 0, o_firstClearBitIndex);
+}
+
+bool BitArray::FindFirstClearBit(size_t i_startBitIndex, size_t& o_firstClearBitIndex) const
+{
+    return findBit(false, i_startBitIndex, o_firstClearBitIndex);
 }
 
 void BitArray::ClearAll() const {
     memset(m_pBits, 0, sizeof(t_BitData) * m_elementCount);
+    rebuildSummaries();
 }
 
 void BitArray::SetAll() const {
     memset(m_pBits, 0xFF, sizeof(t_BitData) * m_elementCount);
+    rebuildSummaries();
 }
 
 bool BitArray::AreAllBitsClear() const 
@@ -68,14 +165,24 @@ void BitArray::SetBit(size_t i_bitNumber) const
 {
     const size_t elementIndex = i_bitNumber / bitsPerElement;
     const size_t bitIndex = i_bitNumber % bitsPerElement;
+    const t_BitData oldBits = m_pBits[elementIndex];
     m_pBits[elementIndex] |= (static_cast<t_BitData>(1) << bitIndex);
+
+    if (m_summaryLevelCount != 0) {
+        updateSummaries(elementIndex, oldBits, m_pBits[elementIndex]);
+    }
 }
 
 void BitArray::ClearBit(size_t i_bitNumber) const
 {
     const size_t elementIndex = i_bitNumber / bitsPerElement;
     const size_t bitIndex = i_bitNumber % bitsPerElement;
+    const t_BitData oldBits = m_pBits[elementIndex];
     m_pBits[elementIndex] &= ~(static_cast<t_BitData>(1) << bitIndex);
+
+    if (m_summaryLevelCount != 0) {
+        updateSummaries(elementIndex, oldBits, m_pBits[elementIndex]);
+    }
 }
 
 bool BitArray::operator[](size_t i_bitIndex) const
@@ -83,29 +190,228 @@ bool BitArray::operator[](size_t i_bitIndex) const
     return IsBitSet(i_bitIndex);
 }
 
+bool BitArray::AtomicSetFirstClearBit(size_t i_startBitIndex, size_t& o_bitIndex) const
+{
+    const size_t startElement = (i_startBitIndex / bitsPerElement) % m_elementCount;
+
+    for (size_t i = 0; i < m_elementCount; i++) {
+        size_t elementIndex = startElement + i;
+        if (elementIndex >= m_elementCount) {
+            elementIndex -= m_elementCount;
+        }
+
+        std::atomic<t_BitData>& element = AsAtomic(m_pBits[elementIndex]);
+        const t_BitData padding = getPaddingBits(elementIndex);
+
+        // Retry the same element for as long as it has a clear bit, a failed CAS reloads its current value
+        t_BitData Bits = element.load(std::memory_order_relaxed);
+        while ((Bits | padding) != ~static_cast<t_BitData>(0)) {
+            const unsigned long bitIndex = lowestSetBit(~(Bits | padding));
+            if (element.compare_exchange_weak(Bits, Bits | (static_cast<t_BitData>(1) << bitIndex), std::memory_order_acquire, std::memory_order_relaxed)) {
+                o_bitIndex = elementIndex * bitsPerElement + bitIndex;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
 
-bool BitArray::findBit(bool findSetBit, size_t& o_bitIndex) const
+bool BitArray::AtomicClearBit(size_t i_bitNumber) const
 {
-    size_t elementIndex = 0;
-    const t_BitData targetValue = findSetBit ? 0 : ~static_cast<t_BitData>(0);
+    const size_t elementIndex = i_bitNumber / bitsPerElement;
+    const t_BitData bit = static_cast<t_BitData>(1) << (i_bitNumber % bitsPerElement);
+    return (AsAtomic(m_pBits[elementIndex]).fetch_and(~bit, std::memory_order_release) & bit) != 0;
+}
+
+// The i_maxCount lowest set bits of i_bits
+static t_BitData lowestSetBits(t_BitData i_bits, size_t i_maxCount)
+{
+    if (CountSetBits(i_bits) <= i_maxCount) {
+        return i_bits;
+    }
+
+    t_BitData Bits = 0;
+    for (size_t i = 0; i < i_maxCount; i++) {
+        Bits |= i_bits & (~i_bits + 1);
+        i_bits &= i_bits - 1;
+    }
+    return Bits;
+}
 
-    while ((m_pBits[elementIndex] == targetValue) && (elementIndex < m_elementCount)) {
-        elementIndex++;
+t_BitData BitArray::SetClearBits(size_t i_elementIndex, size_t i_maxCount) const
+{
+    const t_BitData oldBits = m_pBits[i_elementIndex];
+    const t_BitData claimedBits = lowestSetBits(~(oldBits | getPaddingBits(i_elementIndex)), i_maxCount);
+    m_pBits[i_elementIndex] = oldBits | claimedBits;
+
+    if (m_summaryLevelCount != 0) {
+        updateSummaries(i_elementIndex, oldBits, m_pBits[i_elementIndex]);
+    }
+    return claimedBits;
+}
+
+void BitArray::ClearBits(size_t i_elementIndex, t_BitData i_bits) const
+{
+    const t_BitData oldBits = m_pBits[i_elementIndex];
+    m_pBits[i_elementIndex] &= ~i_bits;
+
+    if (m_summaryLevelCount != 0) {
+        updateSummaries(i_elementIndex, oldBits, m_pBits[i_elementIndex]);
     }
+}
 
-    if (elementIndex == m_elementCount) {
+t_BitData BitArray::AtomicSetClearBits(size_t i_elementIndex, size_t i_maxCount) const
+{
+    std::atomic<t_BitData>& element = AsAtomic(m_pBits[i_elementIndex]);
+    const t_BitData padding = getPaddingBits(i_elementIndex);
+
+    // A failed CAS reloads the element, the bits to claim are picked again from its current value
+    t_BitData Bits = element.load(std::memory_order_relaxed);
+    t_BitData claimedBits;
+    do {
+        claimedBits = lowestSetBits(~(Bits | padding), i_maxCount);
+        if (claimedBits == 0) {
+            return 0;
+        }
+    } while (!element.compare_exchange_weak(Bits, Bits | claimedBits, std::memory_order_acquire, std::memory_order_relaxed));
+
+    return claimedBits;
+}
+
+t_BitData BitArray::AtomicClearBits(size_t i_elementIndex, t_BitData i_bits) const
+{
+    return AsAtomic(m_pBits[i_elementIndex]).fetch_and(~i_bits, std::memory_order_release) & i_bits;
+}
+
+bool BitArray::AtomicIsBitSet(size_t i_bitNumber) const
+{
+    const size_t elementIndex = i_bitNumber / bitsPerElement;
+    const size_t bitIndex = i_bitNumber % bitsPerElement;
+    return (AsAtomic(m_pBits[elementIndex]).load(std::memory_order_acquire) & (static_cast<t_BitData>(1) << bitIndex)) != 0;
+}
+
+t_BitData BitArray::getPaddingBits(size_t i_elementIndex) const
+{
+    const size_t paddingBits = m_elementCount * bitsPerElement - m_bitLength;
+    if (paddingBits == 0 || i_elementIndex != m_elementCount - 1) {
+        return 0;
+    }
+    return ~static_cast<t_BitData>(0) << (bitsPerElement - paddingBits);
+}
+
+bool BitArray::findBit(bool findSetBit, size_t i_startBitIndex, size_t& o_bitIndex) const
+{
+    if (i_startBitIndex >= m_bitLength) {
         return false;
     }
 
-    t_BitData Bits = findSetBit ? m_pBits[elementIndex] : ~m_pBits[elementIndex];
-    unsigned long bitIndex;
+    // Climb: search the rest of the current element, and when it has nothing left move on to
+    // the next element by looking one summary level up. Without summaries this is a plain element scan.
+    size_t level = 0;
+    size_t index = i_startBitIndex;
 
-#if _WIN32
-    _BitScanForward(&bitIndex, Bits);
-#else
-    _BitScanForward64(&bitIndex, Bits);
-#endif
+    while (true) {
+        const size_t elementIndex = index / bitsPerElement;
+        const size_t elementCount = (level == 0) ? m_elementCount : m_summaryElementCount[level - 1];
 
-    o_bitIndex = elementIndex * (sizeof(t_BitData) * 8) + bitIndex;
-    return true;
+        if (elementIndex >= elementCount) {
+            return false;
+        }
+
+        // Bits we are looking for show up as 1s; mask off the ones below the start index
+        t_BitData Bits = getSearchElement(findSetBit, level, elementIndex);
+        Bits &= ~static_cast<t_BitData>(0) << (index % bitsPerElement);
+
+        if (Bits != 0) {
+            index = elementIndex * bitsPerElement + lowestSetBit(Bits);
+            break;
+        }
+
+        if (level == m_summaryLevelCount) {
+            // Nothing above the top level, keep scanning it
+            index = (elementIndex + 1) * bitsPerElement;
+        }
+        else {
+            index = elementIndex + 1;
+            level++;
+        }
+    }
+
+    // Descend: every summary bit we follow leads to an element that holds a hit
+    while (level > 0) {
+        level--;
+        index = index * bitsPerElement + lowestSetBit(getSearchElement(findSetBit, level, index));
+    }
+
+    o_bitIndex = index;
+
+    // The tail of the last element is padding, not part of the array
+    return o_bitIndex < m_bitLength;
+}
+
+t_BitData BitArray::getSearchElement(bool findSetBit, size_t i_level, size_t i_elementIndex) const
+{
+    if (i_level == 0) {
+        return findSetBit ? m_pBits[i_elementIndex] : ~m_pBits[i_elementIndex];
+    }
+
+    return findSetBit ? m_pNotEmptySummary[i_level - 1][i_elementIndex] : m_pNotFullSummary[i_level - 1][i_elementIndex];
+}
+
+void BitArray::updateSummaries(size_t i_elementIndex, t_BitData i_oldBits, t_BitData i_newBits) const
+{
+    const t_BitData allSet = ~static_cast<t_BitData>(0);
+
+    if ((i_oldBits != allSet) != (i_newBits != allSet)) {
+        updateSummaryBit(m_pNotFullSummary, i_elementIndex, i_newBits != allSet);
+    }
+
+    if ((i_oldBits != 0) != (i_newBits != 0)) {
+        updateSummaryBit(m_pNotEmptySummary, i_elementIndex, i_newBits != 0);
+    }
+}
+
+void BitArray::updateSummaryBit(t_BitData* const* i_pSummary, size_t i_childIndex, bool i_bChildActive) const
+{
+    for (size_t level = 0; level < m_summaryLevelCount; level++) {
+        t_BitData& element = i_pSummary[level][i_childIndex / bitsPerElement];
+        const bool bWasActive = element != 0;
+        const t_BitData childBit = static_cast<t_BitData>(1) << (i_childIndex % bitsPerElement);
+
+        if (i_bChildActive) {
+            element |= childBit;
+        }
+        else {
+            element &= ~childBit;
+        }
+
+        // The level above only records whether this element is non-zero
+        if ((element != 0) == bWasActive) {
+            return;
+        }
+
+        i_bChildActive = element != 0;
+        i_childIndex /= bitsPerElement;
+    }
+}
+
+void BitArray::rebuildSummaries() const
+{
+    for (size_t level = 0; level < m_summaryLevelCount; level++) {
+        memset(m_pNotFullSummary[level], 0, sizeof(t_BitData) * m_summaryElementCount[level]);
+        memset(m_pNotEmptySummary[level], 0, sizeof(t_BitData) * m_summaryElementCount[level]);
+
+        const size_t childCount = (level == 0) ? m_elementCount : m_summaryElementCount[level - 1];
+        for (size_t child = 0; child < childCount; child++) {
+            const t_BitData childBit = static_cast<t_BitData>(1) << (child % bitsPerElement);
+
+            if (getSearchElement(false, level, child) != 0) {
+                m_pNotFullSummary[level][child / bitsPerElement] |= childBit;
+            }
+            if (getSearchElement(true, level, child) != 0) {
+                m_pNotEmptySummary[level][child / bitsPerElement] |= childBit;
+            }
+        }
+    }
 }
@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include <cstddef>
 #include <cstdint>
 
 #include "PointerMath.h"
@@ -9,6 +10,12 @@ typedef uint32_t t_BitData;
 typedef uint64_t t_BitData;
 #endif // WIN32
 
+// Arrays with more elements than this get summary levels on top of m_pBits
+const size_t BITARRAY_SUMMARY_MIN_ELEMENTS = 8;
+
+// 32-bit elements: 4 levels summarize 32^5 (~33M) bits down to one word, 64-bit elements go far beyond that
+const size_t BITARRAY_MAX_SUMMARY_LEVELS = 4;
+
 /**
  * @class BitArray
  *
@@ -17,6 +24,12 @@ typedef uint64_t t_BitData;
  * The BitArray class provides methods to manipulate individual bits within the array.
  * It supports operations like setting all bits, clearing all bits, checking if all bits are clear or set,
  * setting or clearing a specific bit, and finding the index of the first set or clear bit.
+ *
+ * Large arrays (more than BITARRAY_SUMMARY_MIN_ELEMENTS elements) also keep summary levels: bit k of a
+ * level-1 "not full" word says whether element k of m_pBits still has a clear bit, and bit k of a level-1
+ * "not empty" word says whether it has a set bit. Each further level summarizes the one below it the same way,
+ * so FindFirstClearBit/FindFirstSetBit descend one word per level instead of scanning every element.
+ * SetBit/ClearBit keep the summaries up to date; callers use the exact same API either way.
  */
 class BitArray
 {
@@ -29,6 +42,11 @@ public:
     size_t m_elementCount;
     t_BitData* m_pBits;
 
+    size_t m_summaryLevelCount;                                         // 0 for small arrays
+    size_t m_summaryElementCount[BITARRAY_MAX_SUMMARY_LEVELS];
+    t_BitData* m_pNotFullSummary[BITARRAY_MAX_SUMMARY_LEVELS];          // Level i summarizes level i - 1, level 0 summarizes m_pBits
+    t_BitData* m_pNotEmptySummary[BITARRAY_MAX_SUMMARY_LEVELS];
+
     void ClearAll() const;
 
     void SetAll() const;
@@ -51,9 +69,83 @@ public:
     
     bool FindFirstClearBit(size_t& o_firstClearBitIndex) const;
 
+    /**
+     * @brief Finds the first clear bit at or after the given bit index.
+     *
+     * Lets callers that know a prefix of the array is fully set (e.g. a "first possibly-free block" hint)
+     * skip straight past it instead of rescanning from bit zero.
+     *
+     * @param i_startBitIndex Index of the first bit to consider.
+     * @param o_firstClearBitIndex Output parameter that will hold the index of the found bit.
+     *
+     * @return True if a clear bit was found, false otherwise.
+     */
+    bool FindFirstClearBit(size_t i_startBitIndex, size_t& o_firstClearBitIndex) const;
+
+    /**
+     * @brief Atomically sets the first clear bit at or after the given bit index, wrapping around to bit zero.
+     *
+     * The Atomic* methods work on m_pBits only, one compare-and-swap per element, and leave the summary levels alone.
+     * Any number of threads may use them on the same array at the same time, but an array used through them must not
+     * be used through SetBit, ClearBit or the FindFirst* methods meanwhile.
+     *
+     * @param i_startBitIndex Index of the bit to start the search at, spreading threads over different elements
+     *                        keeps them from competing for the same one.
+     * @param o_bitIndex Output parameter that will hold the index of the bit this call set.
+     *
+     * @return True if a clear bit was found and set, false if every bit was set when its element was looked at.
+     */
+    bool AtomicSetFirstClearBit(size_t i_startBitIndex, size_t& o_bitIndex) const;
+
+    /**
+     * @brief Atomically clears the given bit, see AtomicSetFirstClearBit.
+     *
+     * @return True if the bit was set before, false if another thread cleared it first.
+     */
+    bool AtomicClearBit(size_t i_bitNumber) const;
+
+    /**
+     * @brief Atomically reads the given bit, see AtomicSetFirstClearBit.
+     */
+    bool AtomicIsBitSet(size_t i_bitNumber) const;
+
+    /**
+     * @brief Sets up to i_maxCount of the lowest clear bits of element i_elementIndex of m_pBits in one go.
+     *
+     * Callers claiming many bits at once (batch allocation) take a whole element per call instead of one bit.
+     *
+     * @return The bits of the element this call set, 0 if it had no clear bit.
+     */
+    t_BitData SetClearBits(size_t i_elementIndex, size_t i_maxCount) const;
+
+    /**
+     * @brief Clears the bits of i_bits in element i_elementIndex of m_pBits in one go.
+     */
+    void ClearBits(size_t i_elementIndex, t_BitData i_bits) const;
+
+    /**
+     * @brief Atomically sets up to i_maxCount of the lowest clear bits of element i_elementIndex, see SetClearBits
+     *        and AtomicSetFirstClearBit.
+     *
+     * @return The bits of the element this call set, 0 if it had no clear bit.
+     */
+    t_BitData AtomicSetClearBits(size_t i_elementIndex, size_t i_maxCount) const;
+
+    /**
+     * @brief Atomically clears the bits of i_bits in element i_elementIndex, see AtomicSetFirstClearBit.
+     *
+     * @return The bits of i_bits that were set before, the others were cleared by another thread first.
+     */
+    t_BitData AtomicClearBits(size_t i_elementIndex, t_BitData i_bits) const;
+
     bool operator[](size_t i_bitIndex) const;
 
 private:
+    /**
+     * @brief Returns the padding bits past m_bitLength within element i_elementIndex, which must never be claimed.
+     */
+    t_BitData getPaddingBits(size_t i_elementIndex) const;
+
     /**
      * @brief Finds the specified bit in the BitArray object.
      *
@@ -64,30 +156,43 @@ private:
      *
      * @param findSetBit Flag indicating whether to find a set bit or a clear bit.
      *                   Pass 'true' to find set bit, 'false' to find clear bit.
+     * @param i_startBitIndex Index of the first bit to consider; the scan runs a whole element at a time from there.
      * @param o_bitIndex Output parameter that will hold the index of the found bit.
      *                   Must be passed by reference.
      *
      * @return True if the bit is found, false otherwise.
      */
-    bool findBit(bool findSetBit, size_t& o_bitIndex) const;
+    bool findBit(bool findSetBit, size_t i_startBitIndex, size_t& o_bitIndex) const;
+
+    /**
+     * @brief Returns element i_elementIndex of the given level with the bits being searched for set,
+     *        level 0 being m_pBits itself and level n being summary level n - 1.
+     */
+    t_BitData getSearchElement(bool findSetBit, size_t i_level, size_t i_elementIndex) const;
+
+    /**
+     * @brief Propagates a change of element i_elementIndex of m_pBits from i_oldBits to i_newBits into the summaries.
+     */
+    void updateSummaries(size_t i_elementIndex, t_BitData i_oldBits, t_BitData i_newBits) const;
+
+    /**
+     * @brief Sets or clears the summary bit of one child and walks up as long as a whole summary element flips
+     *        between zero and non-zero.
+     */
+    void updateSummaryBit(t_BitData* const* i_pSummary, size_t i_childIndex, bool i_bChildActive) const;
+
+    /**
+     * @brief Recomputes every summary level from m_pBits.
+     */
+    void rebuildSummaries() const;
+
+    friend BitArray* CreateBitArray(void* baseAddr, size_t i_numBits, bool i_bInitToZero);
 };
 
-inline BitArray* CreateBitArray(void* baseAddr, size_t i_numBits, bool i_bInitToZero)
-{
-    BitArray* pBitArray = static_cast<BitArray*>(baseAddr);
+/**
+ * @brief Returns the number of bytes CreateBitArray needs for a BitArray of i_numBits bits,
+ *        including the BitArray object itself, its bit storage and its summary levels.
+ */
+size_t GetBitArraySize(size_t i_numBits);
 
-    // Initialize BitArray members
-    pBitArray->m_bitLength = i_numBits;
-    pBitArray->bitsPerElement = sizeof(t_BitData) * 8;
-    pBitArray->m_elementCount = (i_numBits + pBitArray->bitsPerElement - 1) / pBitArray->bitsPerElement;
-    
-    const auto newAddress = PointerAdd(pBitArray, sizeof(BitArray));
-    pBitArray->m_pBits = static_cast<t_BitData*>(newAddress);
-    
-    for (size_t i = 0; i < pBitArray->m_elementCount; i++)
-    {
-        pBitArray->m_pBits[i] = i_bInitToZero ? 0 : 1;
-    }
-    
-    return pBitArray;
-}
+BitArray* CreateBitArray(void* baseAddr, size_t i_numBits, bool i_bInitToZero);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if _MSC_VER
+#include <intrin.h>
+#endif
+
+// FindLowestSetBit - index of the lowest set bit, i_bits must not be zero
+inline unsigned int FindLowestSetBit(uint32_t i_bits)
+{
+#if _MSC_VER
+    unsigned long bitIndex;
+    _BitScanForward(&bitIndex, i_bits);
+    return bitIndex;
+#else
+    return __builtin_ctz(i_bits);
+#endif
+}
+
+// FindLowestSetBit - index of the lowest set bit, i_bits must not be zero
+inline unsigned int FindLowestSetBit(uint64_t i_bits)
+{
+#if _MSC_VER && _WIN64
+    unsigned long bitIndex;
+    _BitScanForward64(&bitIndex, i_bits);
+    return bitIndex;
+#elif _MSC_VER
+    const uint32_t lowBits = static_cast<uint32_t>(i_bits);
+    return lowBits ? FindLowestSetBit(lowBits) : 32 + FindLowestSetBit(static_cast<uint32_t>(i_bits >> 32));
+#else
+    return __builtin_ctzll(i_bits);
+#endif
+}
+
+// CountSetBits - number of set bits
+inline unsigned int CountSetBits(uint64_t i_bits)
+{
+#if _MSC_VER && _WIN64
+    return static_cast<unsigned int>(__popcnt64(i_bits));
+#elif _MSC_VER
+    return __popcnt(static_cast<uint32_t>(i_bits)) + __popcnt(static_cast<uint32_t>(i_bits >> 32));
+#else
+    return __builtin_popcountll(i_bits);
+#endif
+}
+
+// FindHighestSetBit - index of the highest set bit, i_size must not be zero
+inline unsigned int FindHighestSetBit(size_t i_size)
+{
+#if _MSC_VER && _WIN64
+    unsigned long bitIndex;
+    _BitScanReverse64(&bitIndex, i_size);
+    return bitIndex;
+#elif _MSC_VER
+    unsigned long bitIndex;
+    _BitScanReverse(&bitIndex, i_size);
+    return bitIndex;
+#else
+    return static_cast<unsigned int>(sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(i_size));
+#endif
+}
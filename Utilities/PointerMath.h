@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 inline void* PointerAdd(const void* ptr, size_t offset)
 {
     return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) + offset);
@@ -8,4 +11,10 @@ inline void* PointerAdd(const void* ptr, size_t offset)
 inline void* PointerSub(const void* ptr, size_t offset)
 {
     return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) - offset);
-}
\ No newline at end of file
+}
+
+// Rounds ptr up to the next multiple of alignment, which must be a power of 2
+inline void* PointerAlignUp(const void* ptr, size_t alignment)
+{
+    return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(ptr) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+}
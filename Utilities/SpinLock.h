@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+/**
+ * @brief A minimal test-and-set lock for critical sections that are only a handful of instructions long.
+ *
+ * Constant-initialized and trivially destructible, so it can guard allocators that are in use before and after
+ * static constructors and destructors run.
+ */
+class SpinLock
+{
+public:
+    void Lock()
+    {
+        while (m_flag.test_and_set(std::memory_order_acquire))
+        {
+            // Hand the core to the owner instead of burning it, the critical sections are short but may be preempted
+            std::this_thread::yield();
+        }
+    }
+
+    // TryLock - take the lock only if nobody holds it, for callers that have somewhere else to go
+    bool TryLock()
+    {
+        return !m_flag.test_and_set(std::memory_order_acquire);
+    }
+
+    void Unlock()
+    {
+        m_flag.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
+};
+
+/**
+ * @brief Holds a SpinLock for the lifetime of the scope.
+ */
+class ScopedSpinLock
+{
+public:
+    explicit ScopedSpinLock(SpinLock& i_lock)
+        : m_lock(i_lock)
+    {
+        m_lock.Lock();
+    }
+
+    ~ScopedSpinLock()
+    {
+        m_lock.Unlock();
+    }
+
+    ScopedSpinLock(const ScopedSpinLock&) = delete;
+    ScopedSpinLock& operator=(const ScopedSpinLock&) = delete;
+
+private:
+    SpinLock& m_lock;
+};
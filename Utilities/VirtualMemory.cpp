@@ -0,0 +1,66 @@
+#include "VirtualMemory.h"
+
+#include <cassert>
+
+#if _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static size_t queryPageSize()
+{
+#if _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return systemInfo.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+size_t GetVirtualMemoryPageSize()
+{
+    static const size_t s_pageSize = queryPageSize();
+    return s_pageSize;
+}
+
+void* MapPages(size_t i_size)
+{
+    assert(i_size > 0 && i_size % GetVirtualMemoryPageSize() == 0);
+
+#if _WIN32
+    return VirtualAlloc(nullptr, i_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* pAddress = mmap(nullptr, i_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return pAddress != MAP_FAILED ? pAddress : nullptr;
+#endif
+}
+
+void UnmapPages(void* i_pAddress, size_t i_size)
+{
+    assert(i_pAddress != nullptr);
+
+#if _WIN32
+    (void)i_size;
+    VirtualFree(i_pAddress, 0, MEM_RELEASE);
+#else
+    munmap(i_pAddress, i_size);
+#endif
+}
+
+void DiscardPages(void* i_pAddress, size_t i_size)
+{
+    assert(reinterpret_cast<size_t>(i_pAddress) % GetVirtualMemoryPageSize() == 0 && i_size % GetVirtualMemoryPageSize() == 0);
+
+    if (i_size == 0)
+        return;
+
+#if _WIN32
+    // MEM_RESET keeps the pages committed, unlike MEM_DECOMMIT they need no recommit before the next use
+    VirtualAlloc(i_pAddress, i_size, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(i_pAddress, i_size, MADV_DONTNEED);
+#endif
+}
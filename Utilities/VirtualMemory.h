@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Thin layer over the OS's page mapping calls, VirtualAlloc / VirtualFree on Windows and mmap / munmap / madvise elsewhere.
+ *
+ * Mappings are made in whole pages and come back zeroed.
+ */
+
+// GetVirtualMemoryPageSize - size of a page, every mapping covers a multiple of it and starts on one
+size_t GetVirtualMemoryPageSize();
+
+// MapPages - map i_size bytes of zeroed read/write memory, i_size must be a multiple of the page size. nullptr on failure
+void* MapPages(size_t i_size);
+
+// UnmapPages - give a mapping back to the OS, i_size must be the size it was mapped with
+void UnmapPages(void* i_pAddress, size_t i_size);
+
+// DiscardPages - tell the OS the contents of whole pages are no longer needed, so it can take their physical memory back.
+//                They stay mapped read/write, a later touch gets them back zeroed or unchanged
+void DiscardPages(void* i_pAddress, size_t i_size);
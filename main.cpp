@@ -1,12 +1,31 @@
 #include <Windows.h>
 
+#include "Allocators.h"
 #include "MemorySystem.h"
 #include "FixedSizeAllocator/FixedSizeAllocator.h"
+#include "LargeAllocator/LargeAllocator.h"
+#include "LinearAllocator/LinearAllocator.h"
+#include "MemoryResource/MemoryResource.h"
+#include "ObjectPool/ObjectPool.h"
+#include "SizeClassProfiler/SizeClassProfiler.h"
+#include "ThreadCache/ThreadCache.h"
 #include "Utilities/BitArray.h"
+#include "Utilities/VirtualMemory.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#if !_WIN32
+#include <pthread.h>
+#endif
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory_resource>
 #include <random>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #ifdef _DEBUG
@@ -18,9 +37,177 @@
 bool MemorySystem_UnitTest();
 bool BitArray_UnitTest();
 bool FixSizeAllocator_UnitTest();
+bool FixedSizeAllocatorPolicy_UnitTest();
+bool ConcurrentFixedSizeAllocator_UnitTest();
+bool GrowableFixedSizeAllocator_UnitTest();
+bool ThreadCache_UnitTest();
+bool BatchAllocation_UnitTest();
+bool LargeAllocation_UnitTest();
+bool HeapArena_UnitTest();
+bool LinearAllocator_UnitTest();
+bool MemoryResource_UnitTest();
+bool ObjectPool_UnitTest();
+bool SizeClassProfiler_UnitTest(void * i_pHeapMemory, size_t i_sizeHeap, unsigned int i_numDescriptors, bool i_bPrintSizeClasses);
+bool HeapManager_UnitTest();
+bool HeapManager_UnitTest()
+{
+	const size_t sizeHeap = 256 * 1024;
+	void * pHeapMemory = HeapAlloc(GetProcessHeap(), 0, sizeHeap);
+	assert(pHeapMemory);
+
+	// once with headers in front of the blocks, once with the blocks described out of band by a descriptor pool
+	const unsigned int descriptorCounts[] = { 0, 1024 };
+	for (unsigned int numDescriptors : descriptorCounts)
+	{
+		HeapManager* pHeapManager = CreateHeapManager(pHeapMemory, sizeHeap, numDescriptors);
+		const size_t initialLargestFreeBlock = GetLargestFreeBlock(pHeapManager);
+
+		// allocate a mix of sizes and alignments, every block has to honour its alignment
+		std::vector<void *> AllocatedAddresses;
+		AllocatedAddresses.reserve(1024);
+
+		std::default_random_engine engine;
+		for (int i = 0; i < 1024; i++)
+		{
+			const size_t size = 1 + engine() % 512;
+			const size_t alignment = static_cast<size_t>(1) << (engine() % 8);
+
+			void * pPtr = Alloc(pHeapManager, size, alignment);
+			if (pPtr == nullptr)
+				break;
+
+			assert((reinterpret_cast<uintptr_t>(pPtr) & (alignment - 1)) == 0);
+			assert(IsAllocated(pHeapManager, pPtr));
+			AllocatedAddresses.push_back(pPtr);
+		}
+		assert(!AllocatedAddresses.empty());
+
+		// free them in a random order, a second free of the same pointer has to fail. A bounded collect walks the heap in
+		// between and has to keep up with the blocks merging under it
+		std::shuffle(AllocatedAddresses.begin(), AllocatedAddresses.end(), engine);
+		size_t blocksVisited;
+		for (void * pPtr : AllocatedAddresses)
+		{
+			bool freeResult = Free(pHeapManager, pPtr);
+			assert(freeResult);
+			freeResult = Free(pHeapManager, pPtr);
+			assert(!freeResult);
+			Collect(pHeapManager, 4, blocksVisited);
+			assert(blocksVisited <= 4);
+		}
+		assert(GetAllOutstandingBlockSize(pHeapManager) == 0);
+
+		// every free merged with its free neighbours, so the heap is one single block again without collecting
+		assert(GetLargestFreeBlock(pHeapManager) == initialLargestFreeBlock);
+		Collect(pHeapManager);
+		assert(GetLargestFreeBlock(pHeapManager) == initialLargestFreeBlock);
+
+		// a pointer into the middle of a block is no allocation, even if the data in front of it looks like an allocated header
+		char * pBlock = static_cast<char *>(Alloc(pHeapManager, 256, 16));
+		memset(pBlock, 0x11, 256);
+		assert(!IsAllocated(pHeapManager, pBlock + 128));
+		bool freeResult = Free(pHeapManager, pBlock + 128);
+		assert(!freeResult);
+		freeResult = Free(pHeapManager, pBlock);
+		assert(freeResult);
+		assert(GetLargestFreeBlock(pHeapManager) == initialLargestFreeBlock);
+
+		// realloc grows into the free block after it and shrinks in place, it only moves when that block is taken
+		char * pGrowing = static_cast<char *>(Alloc(pHeapManager, 100, 16));
+		memset(pGrowing, 0x5A, 100);
+		void * pResized = Realloc(pHeapManager, pGrowing, 4000);
+		assert(pResized == pGrowing);
+		assert(pHeapManager->GetUsableSize(pGrowing) >= 4000);
+		pResized = Realloc(pHeapManager, pGrowing, 200);
+		assert(pResized == pGrowing);
+		assert(pHeapManager->GetUsableSize(pGrowing) < 4000);
+
+		void * pNeighbour = Alloc(pHeapManager, 100, 16);
+		assert(pNeighbour > pGrowing);
+		char * pMoved = static_cast<char *>(Realloc(pHeapManager, pGrowing, 4000));
+		assert(pMoved != pGrowing && !IsAllocated(pHeapManager, pGrowing));
+		for (size_t i = 0; i < 100; i++)
+			assert(pMoved[i] == 0x5A);
+		pResized = Realloc(pHeapManager, pGrowing, 100);
+		assert(pResized == nullptr);
+
+		freeResult = Free(pHeapManager, pMoved);
+		assert(freeResult);
+		freeResult = Free(pHeapManager, pNeighbour);
+		assert(freeResult);
+		assert(GetAllOutstandingBlockSize(pHeapManager) == 0);
+		assert(GetLargestFreeBlock(pHeapManager) == initialLargestFreeBlock);
+
+		// the gap in front of an over-aligned block becomes a free block, and is never a whole alignment larger than the
+		// smallest block of this mode: without a MemoryBlock in front of it when the blocks are described by descriptors
+		const size_t minGap = pHeapManager->GetBlockOverhead() + HEAP_MIN_BLOCK_SIZE;
+		for (size_t padSize = 16; padSize <= 128; padSize += 16)
+		{
+			char * pPad = static_cast<char *>(Alloc(pHeapManager, padSize, 16));
+			char * pAligned = static_cast<char *>(Alloc(pHeapManager, 16, 64));
+			assert(pAligned != nullptr && reinterpret_cast<uintptr_t>(pAligned) % 64 == 0);
+
+			const size_t gap = pAligned - (pPad + padSize + pHeapManager->GetBlockOverhead());
+			assert(gap == 0 || (gap >= minGap && gap < minGap + 64));
+
+			freeResult = Free(pHeapManager, pAligned);
+			assert(freeResult);
+			freeResult = Free(pHeapManager, pPad);
+			assert(freeResult);
+		}
+		assert(GetLargestFreeBlock(pHeapManager) == initialLargestFreeBlock);
+
+		Destroy(pHeapManager);
+	}
+
+	// with the descriptors used up allocations fail cleanly (the last block can't be split and keeps the rest of the heap),
+	// and a free hands one back
+	{
+		HeapManager* pHeapManager = CreateHeapManager(pHeapMemory, sizeHeap, 16);
+		assert(pHeapManager->GetBlockOverhead() == 0);
+
+		std::vector<void *> AllocatedAddresses;
+		void * pPtr;
+		while ((pPtr = Alloc(pHeapManager, 64, 16)) != nullptr)
+			AllocatedAddresses.push_back(pPtr);
+		assert(!AllocatedAddresses.empty() && AllocatedAddresses.size() <= 16);
 
-int main(int i_arg, char **)
+		bool freeResult = Free(pHeapManager, AllocatedAddresses.back());
+		assert(freeResult);
+		AllocatedAddresses.pop_back();
+		pPtr = Alloc(pHeapManager, 64, 16);
+		assert(pPtr != nullptr);
+		AllocatedAddresses.push_back(pPtr);
+
+		for (void * pAllocated : AllocatedAddresses)
+		{
+			freeResult = Free(pHeapManager, pAllocated);
+			assert(freeResult);
+		}
+		assert(GetAllOutstandingBlockSize(pHeapManager) == 0);
+
+		Destroy(pHeapManager);
+	}
+
+	// a heap too small for its descriptor pool can't be created
+	assert(CreateHeapManager(pHeapMemory, sizeHeap, 1024 * 1024) == nullptr);
+
+	HeapFree(GetProcessHeap(), 0, pHeapMemory);
+
+	return true;
+}
+
+void FixedSizeAllocator_Benchmark();
+void ConcurrentFixedSizeAllocator_Benchmark();
+void LinearAllocator_Benchmark();
+void ContainerAllocator_Benchmark();
+void ObjectPool_Benchmark();
+
+int main(int i_arg, char ** i_argv)
 {
+	// --size-classes prints a size class table fitted to the requests MemorySystem_UnitTest makes
+	const bool bPrintSizeClasses = i_arg > 1 && strcmp(i_argv[1], "--size-classes") == 0;
+
 	const size_t 		sizeHeap = 1024 * 1024;
 
 	// you may not need this if you don't use a descriptor pool
@@ -33,8 +220,10 @@ int main(int i_arg, char **)
 	// Create your HeapManager and FixedSizeAllocators.
 	InitializeMemorySystem(pHeapMemory, sizeHeap, numDescriptors);
 
+	StartSizeHistogram();
 	bool success = MemorySystem_UnitTest();
 	assert(success);
+	StopSizeHistogram();
 
 	success = BitArray_UnitTest();
 	assert(success);
@@ -42,14 +231,56 @@ int main(int i_arg, char **)
 	success = FixSizeAllocator_UnitTest();
 	assert(success);
 
+	success = FixedSizeAllocatorPolicy_UnitTest();
+	assert(success);
+
+	success = ConcurrentFixedSizeAllocator_UnitTest();
+	assert(success);
+
+	success = GrowableFixedSizeAllocator_UnitTest();
+	assert(success);
+
+	success = ThreadCache_UnitTest();
+	assert(success);
+
+	success = BatchAllocation_UnitTest();
+	assert(success);
+
+	success = LargeAllocation_UnitTest();
+	assert(success);
+
+	success = HeapArena_UnitTest();
+	assert(success);
+
+	success = LinearAllocator_UnitTest();
+	assert(success);
+
+	success = MemoryResource_UnitTest();
+	assert(success);
+
+	success = ObjectPool_UnitTest();
+	assert(success);
+
+	success = HeapManager_UnitTest();
+	assert(success);
+
 	if (success)
 	{
 		printf("All unit test passed.\n");
 	}
 
+	FixedSizeAllocator_Benchmark();
+	ConcurrentFixedSizeAllocator_Benchmark();
+	LinearAllocator_Benchmark();
+	ContainerAllocator_Benchmark();
+	ObjectPool_Benchmark();
+
 	// Clean up your Memory System (HeapManager and FixedSizeAllocators)
 	DestroyMemorySystem();
 
+	success = SizeClassProfiler_UnitTest(pHeapMemory, sizeHeap, numDescriptors, bPrintSizeClasses);
+	assert(success);
+
 	HeapFree(GetProcessHeap(), 0, pHeapMemory);
 
 	// in a Debug build make sure we didn't leak any memory.
@@ -75,6 +306,100 @@ bool MemorySystem_UnitTest()
 	// prevents new returning null when std::vector expands the underlying array
 	AllocatedAddresses.reserve(10 * 1024);
 
+	// the page map routes frees and usable size queries straight to the owning allocator
+	void * pSmallPtr = malloc(20);
+	void * pLargePtr = malloc(2000);
+	assert(GetPageOwner(pSmallPtr) == GetSizeClassIndex(20) && GetUsableSize(pSmallPtr) == g_pFixedSizeAllocators[GetSizeClassIndex(20)]->m_blockSize);
+	assert(GetPageOwner(pLargePtr) == PAGE_OWNER_HEAP_MANAGER && GetUsableSize(pLargePtr) >= 2000);
+	assert(GetPageOwner(&numAllocs) == PAGE_OWNER_NONE);
+	assert(reinterpret_cast<uintptr_t>(pLargePtr) % MALLOC_MIN_ALIGNMENT == 0);
+	assert(g_pHeapManager->IsAllocated(pLargePtr));
+	free(pSmallPtr);
+	free(pLargePtr);
+	free(nullptr);
+
+	// size class blocks of a cache line or more start on one
+	void * pCacheLinePtr = malloc(100);
+	assert(GetPageOwner(pCacheLinePtr) < g_FixedSizeAllocatorsCount && reinterpret_cast<uintptr_t>(pCacheLinePtr) % FSA_CACHE_LINE_SIZE == 0);
+	free(pCacheLinePtr);
+
+	// realloc keeps a block as long as the new size fits its class, and moves it to the heap once it doesn't
+	char * pResized = static_cast<char *>(malloc(20));
+	const size_t classBlockSize = GetUsableSize(pResized);
+	memset(pResized, 0x3C, classBlockSize);
+	char * pKept = static_cast<char *>(realloc(pResized, classBlockSize));
+	assert(pKept == pResized);
+	pKept = static_cast<char *>(realloc(pResized, 1));
+	assert(pKept == pResized);
+	pResized = static_cast<char *>(realloc(pResized, 2000));
+	assert(GetPageOwner(pResized) == PAGE_OWNER_HEAP_MANAGER && pResized[classBlockSize - 1] == 0x3C);
+	pResized = static_cast<char *>(realloc(pResized, 3000));
+	assert(pResized != nullptr && pResized[0] == 0x3C);
+	pResized = static_cast<char *>(realloc(pResized, 0));
+	assert(pResized == nullptr);
+
+	// calloc hands out zeroed memory, even when the block was just freed dirty
+	unsigned char * pDirty = static_cast<unsigned char *>(malloc(200));
+	memset(pDirty, 0xFF, 200);
+	free(pDirty);
+	unsigned char * pZeroed = static_cast<unsigned char *>(calloc(50, 4));
+	for (size_t i = 0; i < 200; i++)
+		assert(pZeroed[i] == 0);
+	free(pZeroed);
+	void * pOverflow = calloc(SIZE_MAX / 2, 4);
+	assert(pOverflow == nullptr);
+
+	// aligned allocations honour their alignment whether they come from a size class or the heap
+	for (size_t alignment : { 32, 64, 256, 4096 })
+	{
+		for (size_t size : { 8, 100, 3000 })
+		{
+			void * pAligned = aligned_alloc(alignment, size);
+			assert(pAligned != nullptr && reinterpret_cast<uintptr_t>(pAligned) % alignment == 0);
+			assert(malloc_usable_size(pAligned) >= size);
+			free(pAligned);
+
+			void * pMemaligned = nullptr;
+			const int memalignResult = posix_memalign(&pMemaligned, alignment, size);
+			assert(memalignResult == 0);
+			assert(reinterpret_cast<uintptr_t>(pMemaligned) % alignment == 0);
+			free(pMemaligned);
+		}
+	}
+	void * pUnaligned = nullptr;
+	int memalignResult = posix_memalign(&pUnaligned, 24, 100);
+	assert(memalignResult == EINVAL && pUnaligned == nullptr);
+
+#if !_WIN32
+	// the C library declares these too, ours have to replace them or free gets blocks it doesn't know
+	void * pOurs = aligned_alloc(64, 100);
+	assert(GetPageOwner(pOurs) < g_FixedSizeAllocatorsCount && malloc_usable_size(pOurs) >= 100);
+	free(pOurs);
+	void * pMemalignedOurs = nullptr;
+	memalignResult = posix_memalign(&pMemalignedOurs, 64, 100);
+	assert(memalignResult == 0 && pMemalignedOurs == pOurs);
+	free(pMemalignedOurs);
+#endif
+
+	// aligned new and sized delete go through the memory system too
+	struct alignas(128) CacheLinePair { char m_bytes[128]; };
+	CacheLinePair * pPair = new CacheLinePair;
+	assert(reinterpret_cast<uintptr_t>(pPair) % 128 == 0 && GetPageOwner(pPair) != PAGE_OWNER_NONE);
+	delete pPair;
+
+	const size_t outstandingBeforeNew = GetAllOutstandingBlockSize(g_pHeapManager);
+	char * pLargeArray = new char[4000];
+	assert(GetAllOutstandingBlockSize(g_pHeapManager) > outstandingBeforeNew);
+	::operator delete[](pLargeArray, 4000);
+	assert(GetAllOutstandingBlockSize(g_pHeapManager) == outstandingBeforeNew);
+
+	// the HeapManager validates the MemoryBlock in front of a pointer, stale and interior pointers are rejected
+	assert(!g_pHeapManager->IsAllocated(pLargePtr));
+	bool freeResult = g_pHeapManager->Free(pLargePtr);
+	assert(!freeResult);
+	freeResult = g_pHeapManager->Free(static_cast<char *>(pLargePtr) + 16);
+	assert(!freeResult);
+
 	// allocate memory of random sizes up to 1024 bytes from the heap manager
 	// until it runs out of memory
 	do
@@ -97,6 +422,7 @@ bool MemorySystem_UnitTest()
 				break;
 		}
 
+		assert((reinterpret_cast<uintptr_t>(pPtr) & (MALLOC_MIN_ALIGNMENT - 1)) == 0);
 		AllocatedAddresses.push_back(pPtr);
 		numAllocs++;
 
@@ -116,7 +442,12 @@ bool MemorySystem_UnitTest()
 		}
 		else if ((rand() % garbageCollectAboutEvery) == 0)
 		{
-			Collect();
+			// a frame's worth of collecting, it picks up where the last one left off
+			const CollectBudget budget = { 8, 0 };
+			CollectProgress progress;
+			Collect(budget, &progress);
+			assert(progress.bPassComplete || progress.nodesVisited == budget.maxNodes);
+			assert(progress.fragmentation >= 0.0f && progress.fragmentation < 1.0f);
 
 			numCollects++;
 		}
@@ -138,7 +469,12 @@ bool MemorySystem_UnitTest()
 			delete[] pPtrToFree;
 		}
 
-		// do garbage collection
+		// do garbage collection, in small steps until a pass completes
+		const CollectBudget budget = { 4, 0 };
+		CollectProgress progress = {};
+		for (int i = 0; i < 100000 && !progress.bPassComplete; i++)
+			Collect(budget, &progress);
+		assert(progress.bPassComplete);
 		Collect();
 		// our heap should be one single block, all the memory it started with
 
@@ -172,7 +508,7 @@ bool MemorySystem_UnitTest()
 bool BitArray_UnitTest()
 {
 	size_t numBits = 64; // Example size
-	BitArray* bitArray = CreateBitArray(malloc(sizeof(BitArray) + sizeof(t_BitData) * (numBits / 8)), numBits, true);
+	BitArray* bitArray = CreateBitArray(malloc(GetBitArraySize(numBits)), numBits, true);
 
 	// Test ClearAll and AreAllBitsClear
 	bitArray->ClearAll();
@@ -206,6 +542,57 @@ bool BitArray_UnitTest()
 
 	free(bitArray);
 
+	// Large arrays search through their summary levels, check them against a plain bool array
+	const size_t numLargeBits = 1000 * 1000 + 7;
+	BitArray* largeBitArray = CreateBitArray(HeapAlloc(GetProcessHeap(), 0, GetBitArraySize(numLargeBits)), numLargeBits, true);
+	assert(largeBitArray->m_summaryLevelCount > 0);
+
+	bool* referenceBits = static_cast<bool*>(HeapAlloc(GetProcessHeap(), 0, numLargeBits));
+	memset(referenceBits, 0, numLargeBits);
+
+	assert(largeBitArray->FindFirstSetBit(firstSetBitIndex) == false);
+	largeBitArray->SetBit(numLargeBits - 1);
+	assert(largeBitArray->FindFirstSetBit(firstSetBitIndex) == true && firstSetBitIndex == numLargeBits - 1);
+	largeBitArray->ClearBit(numLargeBits - 1);
+
+	std::default_random_engine engine;
+	std::uniform_int_distribution<size_t> bitDistribution(0, numLargeBits - 1);
+	for (int round = 0; round < 4; round++)
+	{
+		// Fill most of the array, then punch a few holes, then check searches from random start points
+		for (size_t i = 0; i < numLargeBits / 2; i++)
+		{
+			const size_t bit = bitDistribution(engine);
+			largeBitArray->SetBit(bit);
+			referenceBits[bit] = true;
+		}
+		for (size_t i = 0; i < 64; i++)
+		{
+			const size_t bit = bitDistribution(engine);
+			largeBitArray->ClearBit(bit);
+			referenceBits[bit] = false;
+		}
+		for (size_t i = 0; i < 256; i++)
+		{
+			const size_t startBit = bitDistribution(engine);
+			size_t expectedIndex = startBit;
+			while (expectedIndex < numLargeBits && referenceBits[expectedIndex])
+				expectedIndex++;
+
+			const bool bFound = largeBitArray->FindFirstClearBit(startBit, firstClearBitIndex);
+			assert(bFound == (expectedIndex < numLargeBits));
+			assert(!bFound || firstClearBitIndex == expectedIndex);
+		}
+	}
+
+	largeBitArray->SetAll();
+	assert(largeBitArray->FindFirstClearBit(firstClearBitIndex) == false);
+	largeBitArray->ClearBit(123456);
+	assert(largeBitArray->FindFirstClearBit(firstClearBitIndex) == true && firstClearBitIndex == 123456);
+
+	HeapFree(GetProcessHeap(), 0, referenceBits);
+	HeapFree(GetProcessHeap(), 0, largeBitArray);
+
 	return true;
 }
 
@@ -215,6 +602,7 @@ bool FixSizeAllocator_UnitTest()
 	const size_t blockSize = 32; // Example block size
 	const size_t blockNum = 10;  // Number of blocks
 	char heapBase[1024];         // Simulated heap space
+	assert(GetFixedSizeAllocatorSize(blockSize, blockNum) <= sizeof(heapBase));
 
 	// Create a FixedSizeAllocator instance
 	FixedSizeAllocator* allocator = CreateFixedSizeAllocator(blockSize, blockNum, heapBase);
@@ -255,3 +643,1277 @@ bool FixSizeAllocator_UnitTest()
 
 	return true;
 }
+
+// Runs the same random sequence of Alloc and Free calls on a BasicFixedSizeAllocator and records what happened: the block
+// index every Alloc returned (blockNum when it failed) and the result of every Free
+template <size_t BlockSize, class Policy>
+std::vector<size_t> FixedSizeAllocatorPolicy_Trace(size_t blockSize)
+{
+	typedef BasicFixedSizeAllocator<BlockSize, Policy> Allocator;
+
+	const size_t blockNum = 100;
+	const size_t blockStride = Allocator::GetBlockStride(blockSize);
+
+	void * pMemory = HeapAlloc(GetProcessHeap(), 0, Allocator::GetSize(blockSize, blockNum));
+	Allocator* allocator = Allocator::Create(blockSize, blockNum, pMemory, false);
+
+	std::vector<size_t> trace;
+	std::vector<void *> heldBlocks;
+	std::default_random_engine engine;
+	for (int i = 0; i < 5000; i++)
+	{
+		if (heldBlocks.empty() || engine() % 3 != 0)
+		{
+			void * pBlock = allocator->Alloc();
+			if (pBlock == nullptr)
+			{
+				trace.push_back(blockNum);
+				continue;
+			}
+
+			memset(pBlock, i, blockSize);
+			trace.push_back((static_cast<char *>(pBlock) - static_cast<char *>(allocator->m_blockBaseAddr)) / blockStride);
+			heldBlocks.push_back(pBlock);
+			continue;
+		}
+
+		const size_t held = engine() % heldBlocks.size();
+		void * pBlock = heldBlocks[held];
+		heldBlocks.erase(heldBlocks.begin() + held);
+
+		trace.push_back(allocator->Free(pBlock));
+		trace.push_back(allocator->Free(pBlock));
+		trace.push_back(allocator->Free(static_cast<char *>(pBlock) + 1));
+	}
+
+	allocator->Destroy();
+	HeapFree(GetProcessHeap(), 0, pMemory);
+	return trace;
+}
+
+bool FixedSizeAllocatorPolicy_UnitTest()
+{
+	typedef BasicFixedSizeAllocator<32, ReleaseFixedSizeAllocatorPolicy> ReleaseAllocator;
+	typedef BasicFixedSizeAllocator<32, DebugFixedSizeAllocatorPolicy> DebugAllocator;
+
+	// the release policies take no space, the stats are all the debug ones add
+	static_assert(sizeof(ReleaseAllocator) == sizeof(BasicFixedSizeAllocator<FSA_DYNAMIC_BLOCK_SIZE, ReleaseFixedSizeAllocatorPolicy>), "NoStats must not take space");
+	static_assert(sizeof(DebugAllocator) == sizeof(ReleaseAllocator) + sizeof(CountingStats), "Policies must not add members");
+
+	// release and debug builds, compile-time and runtime block sizes all hand out the same blocks and reject the same frees
+	const std::vector<size_t> trace = FixedSizeAllocatorPolicy_Trace<32, ReleaseFixedSizeAllocatorPolicy>(32);
+	assert(trace == (FixedSizeAllocatorPolicy_Trace<32, DebugFixedSizeAllocatorPolicy>(32)));
+	assert(trace == (FixedSizeAllocatorPolicy_Trace<FSA_DYNAMIC_BLOCK_SIZE, ReleaseFixedSizeAllocatorPolicy>(32)));
+	assert(trace == (FixedSizeAllocatorPolicy_Trace<FSA_DYNAMIC_BLOCK_SIZE, DebugFixedSizeAllocatorPolicy>(32)));
+
+	const size_t blockNum = 4;
+	{
+		// without guardbands the blocks are packed
+		void * pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize<32, ReleaseFixedSizeAllocatorPolicy>(blockNum));
+		ReleaseAllocator* allocator = CreateFixedSizeAllocator<32, ReleaseFixedSizeAllocatorPolicy>(blockNum, pMemory);
+		char * pFirst = static_cast<char *>(allocator->Alloc());
+		char * pSecond = static_cast<char *>(allocator->Alloc());
+		assert(pFirst == allocator->m_blockBaseAddr && pSecond == pFirst + 32);
+		HeapFree(GetProcessHeap(), 0, pMemory);
+	}
+	{
+		// the debug policies fill blocks, catch overruns and count what happened
+		void * pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize<32, DebugFixedSizeAllocatorPolicy>(blockNum));
+		DebugAllocator* allocator = CreateFixedSizeAllocator<32, DebugFixedSizeAllocatorPolicy>(blockNum, pMemory);
+		unsigned char * pBlock = static_cast<unsigned char *>(allocator->Alloc());
+		assert(std::all_of(pBlock, pBlock + 32, [](unsigned char byte) { return byte == 0xCD; }));
+
+		bool freeResult = allocator->Free(pBlock);
+		assert(freeResult);
+		assert(std::all_of(pBlock, pBlock + 32, [](unsigned char byte) { return byte == 0xDD; }));
+
+		pBlock = static_cast<unsigned char *>(allocator->Alloc());
+		pBlock[32] = 0;
+		freeResult = allocator->Free(pBlock);
+		assert(!freeResult);
+		assert(allocator->m_allocCount == 2 && allocator->m_freeCount == 1 && allocator->m_badFreeCount == 1);
+		HeapFree(GetProcessHeap(), 0, pMemory);
+	}
+
+	return true;
+}
+
+bool ConcurrentFixedSizeAllocator_UnitTest()
+{
+	const size_t blockSize = 32;
+	const size_t blockNum = 1000;	// small enough for the workers to run it dry now and then
+	const unsigned int numThreads = 8;
+
+	void * pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize(blockSize, blockNum));
+	assert(pMemory);
+
+	FixedSizeAllocator* allocator = CreateFixedSizeAllocator(blockSize, blockNum, pMemory, true);
+	assert(allocator->m_bConcurrent);
+
+	// every worker stamps the blocks it holds with its own id, a block handed out twice gets stamped over
+	std::atomic<void *> mailboxes[numThreads];
+	for (std::atomic<void *>& mailbox : mailboxes)
+		mailbox = nullptr;
+
+	std::atomic<bool> bStampsIntact(true);
+	{
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t < numThreads; t++)
+		{
+			workers.emplace_back([t, allocator, &mailboxes, &bStampsIntact]()
+			{
+				const size_t maxHeldBlocks = 150;
+				unsigned char * heldBlocks[maxHeldBlocks];
+				size_t heldCount = 0;
+
+				std::default_random_engine engine(t);
+				for (int i = 0; i < 50000; i++)
+				{
+					if (heldCount < maxHeldBlocks && (heldCount == 0 || engine() % 2 == 0))
+					{
+						unsigned char * pBlock = static_cast<unsigned char *>(allocator->Alloc());
+						if (pBlock == nullptr)
+							continue;
+
+						memset(pBlock, static_cast<int>(t), blockSize);
+						heldBlocks[heldCount++] = pBlock;
+						continue;
+					}
+
+					unsigned char * pBlock = heldBlocks[engine() % heldCount];
+					std::swap(pBlock, heldBlocks[--heldCount]);
+					for (size_t byte = 0; byte < blockSize; byte++)
+					{
+						if (pBlock[byte] != t)
+							bStampsIntact = false;
+					}
+
+					// now and then a block is freed by the neighbour instead
+					if (engine() % 8 == 0)
+						pBlock = static_cast<unsigned char *>(mailboxes[(t + 1) % numThreads].exchange(pBlock));
+
+					if (pBlock != nullptr && !allocator->Free(pBlock))
+						bStampsIntact = false;
+				}
+
+				for (size_t i = 0; i < heldCount; i++)
+					allocator->Free(heldBlocks[i]);
+			});
+		}
+
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+	assert(bStampsIntact);
+
+	for (std::atomic<void *>& mailbox : mailboxes)
+	{
+		void * pBlock = mailbox.exchange(nullptr);
+		if (pBlock != nullptr)
+		{
+			const bool freeResult = allocator->Free(pBlock);
+			assert(freeResult);
+		}
+	}
+
+	// every block came back exactly once
+	assert(allocator->m_freeBlockNum == blockNum);
+	assert(allocator->m_BitArray.AreAllBitsClear());
+
+	allocator->Destroy();
+	HeapFree(GetProcessHeap(), 0, pMemory);
+
+	return true;
+}
+
+bool GrowableFixedSizeAllocator_UnitTest()
+{
+	// drive the 16 byte class directly, its cached blocks would hide the slabs it uses
+	FlushThreadCache();
+
+	GrowableFixedSizeAllocator* allocator = g_pFixedSizeAllocators[0];
+	ScopedSpinLock lock(g_FixedSizeAllocatorLocks[0]);
+
+	const size_t initialSlabCount = allocator->m_slabCount;
+	const size_t initialOutstandingBlocks = allocator->m_blockNum - allocator->m_freeBlockNum;
+	assert(initialSlabCount == allocator->m_reservedSlabCount);
+
+	// allocate well past the reserved blocks, the allocator grows by slabs instead of running out
+	const size_t numBlocks = allocator->m_blockNum + 3 * allocator->m_slabBlockNum;
+	std::vector<void *> blocks;
+	blocks.reserve(numBlocks);
+	for (size_t i = 0; i < numBlocks; i++)
+	{
+		void * pBlock = allocator->Alloc();
+		assert(pBlock != nullptr);
+		assert(GetPageOwner(pBlock) == 0 && allocator->IsAllocated(pBlock));
+		blocks.push_back(pBlock);
+	}
+	assert(allocator->m_slabCount >= initialSlabCount + 3);
+
+	// a block is freed exactly once, and emptied slabs go back to the heap but for FSA_MAX_EMPTY_SLABS of them
+	std::shuffle(blocks.begin(), blocks.end(), std::default_random_engine());
+	for (void * pBlock : blocks)
+	{
+		bool freeResult = allocator->Free(pBlock);
+		assert(freeResult);
+		freeResult = allocator->Free(pBlock);
+		assert(!freeResult);
+	}
+	assert(allocator->m_blockNum - allocator->m_freeBlockNum == initialOutstandingBlocks);
+	assert(allocator->m_emptySlabCount <= FSA_MAX_EMPTY_SLABS);
+
+	// the reserved slabs stay no matter what, releasing a slab at a time gets there too
+	size_t slabsVisited;
+	while (!allocator->ReleaseEmptySlabs(1, slabsVisited))
+		assert(slabsVisited == 1);
+	assert(allocator->m_slabCount == initialSlabCount && allocator->m_emptySlabCount == 0);
+
+	return true;
+}
+
+bool ThreadCache_UnitTest()
+{
+	// blocks cached by this thread would look like outstanding allocations
+	FlushThreadCache();
+
+	size_t initialOutstandingBlocks[FSA_MAX_SIZE_CLASSES];
+	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+		initialOutstandingBlocks[i] = g_pFixedSizeAllocators[i]->m_blockNum - g_pFixedSizeAllocators[i]->m_freeBlockNum;
+
+	// every worker allocates through its own cache and hands every block to its neighbour, which frees it
+	const unsigned int numThreads = 4;
+	std::atomic<void *> mailboxes[numThreads];
+	for (std::atomic<void *>& mailbox : mailboxes)
+		mailbox = nullptr;
+
+	{
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t < numThreads; t++)
+		{
+			workers.emplace_back([t, &mailboxes]()
+			{
+				std::default_random_engine engine(t);
+				for (int i = 0; i < 20000; i++)
+				{
+					const size_t size = 1 + engine() % SIZE_CLASS_MAX_SIZE;
+					unsigned char * pPtr = static_cast<unsigned char *>(malloc(size));
+					if (pPtr == nullptr)
+						continue;
+
+					memset(pPtr, static_cast<int>(t), size);
+
+					void * pReceived = mailboxes[(t + 1) % numThreads].exchange(pPtr);
+					free(pReceived);
+				}
+			});
+		}
+
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	for (std::atomic<void *>& mailbox : mailboxes)
+		free(mailbox.exchange(nullptr));
+
+#if !_WIN32
+	// a thread-exit destructor that frees again after the cache was flushed has those blocks flushed as well. It sets its
+	// key again the first time, so it frees in the second round of destructors whatever order the keys run in
+	static pthread_key_t s_lateFreeKey;
+	static bool s_bLateFreeArmed;
+	s_bLateFreeArmed = false;
+	const int keyResult = pthread_key_create(&s_lateFreeKey, [](void *)
+	{
+		if (!s_bLateFreeArmed)
+		{
+			s_bLateFreeArmed = true;
+			pthread_setspecific(s_lateFreeKey, &s_bLateFreeArmed);
+			return;
+		}
+		void * volatile pLate = malloc(24);
+		free(pLate);
+	});
+	assert(keyResult == 0);
+	(void)keyResult;
+	std::thread([]()
+	{
+		void * volatile pCached = malloc(24);
+		free(pCached);
+		pthread_setspecific(s_lateFreeKey, &s_bLateFreeArmed);
+	}).join();
+	pthread_key_delete(s_lateFreeKey);
+#endif
+
+	// exited workers flushed their caches, flushing this one returns every block to its allocator
+	FlushThreadCache();
+	for (unsigned int i = 0; i < g_FixedSizeAllocatorsCount; i++)
+		assert(g_pFixedSizeAllocators[i]->m_blockNum - g_pFixedSizeAllocators[i]->m_freeBlockNum == initialOutstandingBlocks[i]);
+
+	return true;
+}
+
+bool BatchAllocation_UnitTest()
+{
+	const size_t blockSize = 48;
+	const size_t blockNum = 300;
+	void * pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize(blockSize, blockNum));
+	assert(pMemory);
+
+	// regular and concurrent allocators alike hand out every block exactly once, a batch at a time
+	for (bool bConcurrent : { false, true })
+	{
+		FixedSizeAllocator* allocator = CreateFixedSizeAllocator(blockSize, blockNum, pMemory, bConcurrent);
+
+		void * blocks[blockNum + 1];
+		size_t allocCount = allocator->AllocBatch(blocks, 100);
+		assert(allocCount == 100);
+		allocCount += allocator->AllocBatch(blocks + allocCount, blockNum + 1 - allocCount);
+		assert(allocCount == blockNum && allocator->m_freeBlockNum == 0);
+		const size_t emptyAllocCount = allocator->AllocBatch(blocks, 1);
+		assert(emptyAllocCount == 0);
+
+		std::vector<void *> sortedBlocks(blocks, blocks + blockNum);
+		std::sort(sortedBlocks.begin(), sortedBlocks.end());
+		assert(std::unique(sortedBlocks.begin(), sortedBlocks.end()) == sortedBlocks.end());
+		for (void * pBlock : sortedBlocks)
+			assert(allocator->IsAllocated(pBlock));
+
+		// a block listed twice and a pointer that isn't one of the blocks are skipped, the rest is freed
+		void * badBatch[] = { blocks[0], blocks[0], static_cast<char *>(blocks[1]) + 1 };
+		size_t freeCount = allocator->FreeBatch(badBatch, 3);
+		assert(freeCount == 1);
+		freeCount = allocator->FreeBatch(blocks + 1, blockNum - 1);
+		assert(freeCount == blockNum - 1);
+		assert(allocator->m_freeBlockNum == blockNum);
+		assert(allocator->m_BitArray.AreAllBitsClear());
+		freeCount = allocator->FreeBatch(blocks, blockNum);
+		assert(freeCount == 0);
+
+		allocator->Destroy();
+	}
+	HeapFree(GetProcessHeap(), 0, pMemory);
+
+	// HeapManager carves a batch of equal chunks back to back out of a single free block
+	{
+		const size_t sizeHeap = 64 * 1024;
+		void * pHeapMemory = HeapAlloc(GetProcessHeap(), 0, sizeHeap);
+		assert(pHeapMemory);
+
+		HeapManager* pHeapManager = CreateHeapManager(pHeapMemory, sizeHeap, 0);
+		const size_t initialLargestFreeBlock = GetLargestFreeBlock(pHeapManager);
+
+		void * chunks[64];
+		const size_t chunkCount = AllocBatch(pHeapManager, 100, 64, chunks);
+		assert(chunkCount == 64);
+		for (size_t i = 0; i < 64; i++)
+		{
+			assert(IsAllocated(pHeapManager, chunks[i]));
+			assert((reinterpret_cast<uintptr_t>(chunks[i]) & (HEAP_BLOCK_GRANULARITY - 1)) == 0);
+			if (i > 0)
+				assert(chunks[i] > chunks[i - 1]);
+		}
+
+		// more chunks than fit are carved until the heap runs out
+		std::vector<void *> manyChunks(sizeHeap / 256);
+		const size_t manyCount = AllocBatch(pHeapManager, 256, manyChunks.size(), manyChunks.data());
+		assert(manyCount > 0 && manyCount < manyChunks.size());
+
+		for (size_t i = 0; i < 64; i++)
+		{
+			const bool freeResult = Free(pHeapManager, chunks[i]);
+			assert(freeResult);
+		}
+		for (size_t i = 0; i < manyCount; i++)
+		{
+			const bool freeResult = Free(pHeapManager, manyChunks[i]);
+			assert(freeResult);
+		}
+		assert(GetAllOutstandingBlockSize(pHeapManager) == 0);
+		assert(GetLargestFreeBlock(pHeapManager) == initialLargestFreeBlock);
+
+		Destroy(pHeapManager);
+		HeapFree(GetProcessHeap(), 0, pHeapMemory);
+	}
+
+	// malloc_batch and free_batch route small sizes to their class and large ones to the heap
+	FlushThreadCache();
+	for (size_t size : { static_cast<size_t>(64), SIZE_CLASS_MAX_SIZE + 1 })
+	{
+		void * ptrs[200];
+		const size_t count = malloc_batch(size, ptrs, 200);
+		assert(count == 200);
+		for (size_t i = 0; i < count; i++)
+		{
+			assert(GetUsableSize(ptrs[i]) >= size);
+			memset(ptrs[i], static_cast<int>(i), size);
+		}
+
+		const size_t outstandingBefore = GetAllOutstandingBlockSize(g_pHeapManager);
+		free_batch(ptrs, count);
+		if (size > SIZE_CLASS_MAX_SIZE)
+			assert(GetAllOutstandingBlockSize(g_pHeapManager) < outstandingBefore);
+	}
+
+	return true;
+}
+
+bool LargeAllocation_UnitTest()
+{
+	// a large allocation is a mapping of its own, outside the heap region and zeroed
+	const size_t largeSize = 4 * LARGE_ALLOCATION_DEFAULT_THRESHOLD + 1;
+	const size_t outstandingBefore = GetAllOutstandingBlockSize(g_pHeapManager);
+
+	char * pLarge = static_cast<char *>(calloc(1, largeSize));
+	assert(pLarge != nullptr);
+	assert(GetPageOwner(pLarge) == PAGE_OWNER_NONE);
+	assert(GetUsableSize(pLarge) >= largeSize && malloc_usable_size(pLarge) == GetUsableSize(pLarge));
+	assert(GetAllOutstandingBlockSize(g_pHeapManager) == outstandingBefore);
+	for (size_t i = 0; i < largeSize; i += 4096)
+		assert(pLarge[i] == 0);
+	memset(pLarge, 0x3C, largeSize);
+
+	// growing moves to a new mapping, shrinking below the threshold moves into the heap
+	char * pGrown = static_cast<char *>(realloc(pLarge, 2 * largeSize));
+	assert(pGrown != nullptr && GetUsableSize(pGrown) >= 2 * largeSize);
+	assert(pGrown[0] == 0x3C && pGrown[largeSize - 1] == 0x3C);
+	char * pSmall = static_cast<char *>(realloc(pGrown, 4096));
+	assert(pSmall != nullptr && GetPageOwner(pSmall) == PAGE_OWNER_HEAP_MANAGER);
+	assert(pSmall[0] == 0x3C && pSmall[4095] == 0x3C);
+	free(pSmall);
+
+	// a freed mapping is cached and serves the next request of about its size, calloc zeroes it again
+	void * pFirst = malloc(largeSize);
+	free(pFirst);
+	char * pReused = static_cast<char *>(calloc(largeSize, 1));
+	assert(pReused == pFirst);
+	for (size_t i = 0; i < largeSize; i += 4096)
+		assert(pReused[i] == 0);
+	free(pReused);
+
+	// the threshold can be lowered, medium sized requests then stay out of the heap as well, and sized delete finds them
+	SetLargeAllocationThreshold(SIZE_CLASS_MAX_SIZE);
+	void * pMedium = ::operator new(2 * SIZE_CLASS_MAX_SIZE);
+	assert(pMedium != nullptr && GetPageOwner(pMedium) == PAGE_OWNER_NONE);
+	::operator delete(pMedium, 2 * SIZE_CLASS_MAX_SIZE);
+	assert(GetLargeAllocationSize(pMedium) == 0);
+	SetLargeAllocationThreshold(LARGE_ALLOCATION_DEFAULT_THRESHOLD);
+
+	// the aligned entry points map large requests too, up to the page alignment
+	void * pAligned = aligned_alloc(4096, largeSize);
+	assert(pAligned != nullptr && GetPageOwner(pAligned) == PAGE_OWNER_NONE);
+	assert((reinterpret_cast<uintptr_t>(pAligned) & 4095) == 0);
+	free(pAligned);
+
+	// collecting unmaps the cached mappings, foreign pointers are still ignored
+	Collect();
+	int notOurs = 0;
+	free(&notOurs);
+	assert(GetAllOutstandingBlockSize(g_pHeapManager) == outstandingBefore);
+
+	return true;
+}
+
+bool HeapArena_UnitTest()
+{
+	// a heap in mapped memory discards the pages of a block only once it stayed free through a whole decay step
+	const size_t arenaSize = HEAP_ARENA_SIZE;
+	void * pArenaMemory = MapPages(arenaSize);
+	assert(pArenaMemory != nullptr);
+	HeapManager * pArena = CreateHeapManager(pArenaMemory, arenaSize, 0);
+	assert(pArena != nullptr);
+
+	const size_t blockSize = 64 * 1024;
+	char * pBlocks[3];
+	for (char *& pBlock : pBlocks)
+	{
+		pBlock = static_cast<char *>(Alloc(pArena, blockSize, 16));
+		assert(pBlock != nullptr);
+		memset(pBlock, 0x5A, blockSize);
+	}
+	Free(pArena, pBlocks[1]);
+	size_t discardedSize = pArena->DecayFreePages();
+	assert(discardedSize == 0);
+	discardedSize = pArena->DecayFreePages();
+	assert(discardedSize >= blockSize - GetVirtualMemoryPageSize());
+	discardedSize = pArena->DecayFreePages();
+	assert(discardedSize == 0);
+	assert(pArena->m_emptyDecayCount == 0);
+
+	// discarded pages are usable again right away, and reusing a block restarts its decay
+	char * pReused = static_cast<char *>(Alloc(pArena, blockSize, 16));
+	assert(pReused == pBlocks[1]);
+	memset(pReused, 0x6B, blockSize);
+	assert(pReused[0] == 0x6B && pReused[blockSize - 1] == 0x6B && pBlocks[2][0] == 0x5A);
+	Free(pArena, pReused);
+	discardedSize = pArena->DecayFreePages();
+	assert(discardedSize < blockSize);
+
+	Free(pArena, pBlocks[0]);
+	Free(pArena, pBlocks[2]);
+	for (unsigned int i = 0; i < HEAP_ARENA_DECAY_PASSES; i++)
+		pArena->DecayFreePages();
+	assert(pArena->m_emptyDecayCount == HEAP_ARENA_DECAY_PASSES);
+	Collect(pArena);
+	Destroy(pArena);
+	UnmapPages(pArenaMemory, arenaSize);
+
+	// once the heap region is full, medium sized requests are served by arenas mapped on demand for this thread's thread arena
+	Collect();
+	const unsigned int threadArenaIndex = GetThreadArenaIndex();
+	ThreadArena & threadArena = g_ThreadArenas[threadArenaIndex];
+	assert(threadArena.m_pArenas == nullptr);
+	const size_t mediumSize = LARGE_ALLOCATION_DEFAULT_THRESHOLD / 2;
+	std::vector<void *> mediumPtrs;
+	while (mediumPtrs.empty() || GetPageOwner(mediumPtrs.back()) == PAGE_OWNER_HEAP_MANAGER)
+	{
+		void * ptr = malloc(mediumSize);
+		assert(ptr != nullptr);
+		mediumPtrs.push_back(ptr);
+	}
+	unsigned int ownerIndex;
+	assert(threadArena.m_pArenas != nullptr && FindHeapArena(mediumPtrs.back(), &ownerIndex) == threadArena.m_pArenas);
+	assert(ownerIndex == threadArenaIndex);
+	for (int i = 0; i < 40; i++)
+		mediumPtrs.push_back(malloc(mediumSize));
+	assert(threadArena.m_pArenas->m_pNextArena != nullptr);
+
+	char * pArenaBlock = static_cast<char *>(mediumPtrs.back());
+	assert(GetUsableSize(pArenaBlock) >= mediumSize && GetPageOwner(pArenaBlock) == PAGE_OWNER_NONE);
+	memset(pArenaBlock, 0x7C, mediumSize);
+	pArenaBlock = static_cast<char *>(realloc(pArenaBlock, mediumSize + 4096));
+	assert(pArenaBlock != nullptr && pArenaBlock[mediumSize - 1] == 0x7C);
+	mediumPtrs.back() = pArenaBlock;
+
+	// a thread of another thread arena queues the block instead of taking the lock, the next allocation here frees it
+	bool bQueued = false;
+	while (!bQueued)
+	{
+		std::thread([&] {
+			if (GetThreadArenaIndex() != threadArenaIndex)
+			{
+				free(pArenaBlock);
+				bQueued = true;
+			}
+		}).join();
+	}
+	assert(threadArena.m_pRemoteFrees.load() == pArenaBlock && FindHeapArena(pArenaBlock)->IsAllocated(pArenaBlock));
+	void * pNext = malloc(mediumSize);
+	assert(threadArena.m_pRemoteFrees.load() == nullptr);
+	assert(pNext == pArenaBlock || !FindHeapArena(pArenaBlock)->IsAllocated(pArenaBlock));
+	mediumPtrs.back() = pNext;
+
+	// arenas outlive a busy pass, and only the ones that stayed empty long enough are unmapped
+	for (size_t i = 1; i < mediumPtrs.size(); i++)
+		free(mediumPtrs[i]);
+	for (unsigned int i = 0; i < HEAP_ARENA_DECAY_PASSES; i++)
+	{
+		assert(threadArena.m_pArenas != nullptr);
+		Collect();
+	}
+	assert(threadArena.m_pArenas == nullptr);
+	free(mediumPtrs[0]);
+
+	// arena blocks are freed like any other, in batches too
+	void * ptrs[64];
+	const size_t count = malloc_batch(mediumSize, ptrs, 64);
+	assert(count == 64 && threadArena.m_pArenas != nullptr);
+	free_batch(ptrs, count);
+	CollectBudget budget = { 0, 0 };
+	for (unsigned int i = 0; i < HEAP_ARENA_DECAY_PASSES; i++)
+	{
+		const bool bFinished = Collect(budget);
+		assert(bFinished);
+	}
+	assert(threadArena.m_pArenas == nullptr);
+
+	return true;
+}
+
+bool LinearAllocator_UnitTest()
+{
+	const size_t scratchSize = 4096;
+	const size_t outstandingBefore = GetAllOutstandingBlockSize(g_pHeapManager);
+	LinearAllocator * pScratch;
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pScratch = CreateLinearAllocator(g_pHeapManager, scratchSize);
+	}
+	assert(pScratch != nullptr && pScratch->GetFreeSize() == scratchSize);
+
+	// allocations are bumped back to back, aligned as asked
+	char * pFirst = static_cast<char *>(pScratch->Alloc(10, 1));
+	char * pSecond = static_cast<char *>(pScratch->Alloc(24));
+	char * pThird = static_cast<char *>(pScratch->Alloc(8, 256));
+	assert(pFirst == pScratch->m_pBase && pScratch->Contains(pThird));
+	assert(reinterpret_cast<uintptr_t>(pSecond) % LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT == 0 && pSecond >= pFirst + 10 && pSecond < pFirst + 10 + LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT);
+	assert(reinterpret_cast<uintptr_t>(pThird) % 256 == 0 && pThird >= pSecond + 24);
+
+	// rewinding to a marker frees everything allocated after it at once
+	const LinearAllocator::Marker marker = pScratch->GetMarker();
+	void * pTemporary = pScratch->Alloc(100);
+	pScratch->Alloc(200);
+	pScratch->FreeToMarker(marker);
+	assert(pScratch->GetMarker() == marker);
+	void * pAgain = pScratch->Alloc(100);
+	assert(pAgain == pTemporary);
+
+	// the top end grows down towards the bottom end and has markers of its own
+	const LinearAllocator::Marker topMarker = pScratch->GetTopMarker();
+	char * pTop = static_cast<char *>(pScratch->AllocTop(64, 64));
+	assert(reinterpret_cast<uintptr_t>(pTop) % 64 == 0 && pTop + 64 <= static_cast<char *>(pScratch->m_pBase) + scratchSize);
+	void * pBelowTop = pScratch->AllocTop(16);
+	assert(pBelowTop < static_cast<void *>(pTop));
+
+	// the two ends never overlap
+	void * pTooLarge = pScratch->Alloc(pScratch->GetFreeSize() + 1, 1);
+	void * pTooLargeTop = pScratch->AllocTop(pScratch->GetFreeSize() + 1, 1);
+	assert(pTooLarge == nullptr && pTooLargeTop == nullptr);
+	void * pRest = pScratch->Alloc(pScratch->GetFreeSize(), 1);
+	assert(pRest != nullptr && pScratch->GetFreeSize() == 0);
+	void * pNoRoomTop = pScratch->AllocTop(1, 1);
+	void * pNoRoom = pScratch->Alloc(1, 1);
+	assert(pNoRoomTop == nullptr && pNoRoom == nullptr);
+	pScratch->FreeToTopMarker(topMarker);
+	void * pRoomTop = pScratch->AllocTop(1, 1);
+	assert(pRoomTop != nullptr);
+	pScratch->Clear();
+	assert(pScratch->GetFreeSize() == scratchSize);
+
+	// the whole chunk goes back to the HeapManager in one Free
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pScratch->Destroy();
+	}
+	assert(GetAllOutstandingBlockSize(g_pHeapManager) == outstandingBefore);
+
+	return true;
+}
+
+bool MemoryResource_UnitTest()
+{
+	// the nodes of a pmr list come from the FixedSizeAllocator it is pointed at, larger requests from upstream
+	const size_t blockSize = 32;
+	const size_t blockNum = 128;
+	void * pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize(blockSize, blockNum));
+	assert(pMemory);
+	FixedSizeAllocator * pAllocator = CreateFixedSizeAllocator(blockSize, blockNum, pMemory);
+	{
+		FixedSizeMemoryResource nodeResource(pAllocator, nullptr, GetSizeClassMemoryResource());
+		std::pmr::list<int> nodes(&nodeResource);
+		for (int i = 0; i < 100; i++)
+			nodes.push_back(i);
+		assert(pAllocator->m_freeBlockNum == blockNum - 100);
+
+		void * pLarge = nodeResource.allocate(4 * blockSize);
+		assert(!pAllocator->Contains(pLarge) && GetPageOwner(pLarge) != PAGE_OWNER_NONE);
+		nodeResource.deallocate(pLarge, 4 * blockSize);
+
+		// once the allocator is full the nodes spill upstream
+		for (int i = 0; i < 100; i++)
+			nodes.push_back(i);
+		assert(pAllocator->m_freeBlockNum == 0 && nodes.size() == 200);
+		nodes.clear();
+		assert(pAllocator->m_freeBlockNum == blockNum);
+	}
+	pAllocator->Destroy();
+	HeapFree(GetProcessHeap(), 0, pMemory);
+
+	// a HeapManager instance backs a pmr vector, every block goes back to it
+	const size_t sizeHeap = 64 * 1024;
+	void * pHeapMemory = HeapAlloc(GetProcessHeap(), 0, sizeHeap);
+	assert(pHeapMemory);
+	HeapManager * pHeapManager = CreateHeapManager(pHeapMemory, sizeHeap, 0);
+	{
+		HeapMemoryResource heapResource(pHeapManager);
+		std::pmr::vector<int> values(&heapResource);
+		for (int i = 0; i < 1000; i++)
+			values.push_back(i);
+		assert(pHeapManager->Contains(values.data()) && GetAllOutstandingBlockSize(pHeapManager) > 0);
+
+		void * pAligned = heapResource.allocate(100, 256);
+		assert(reinterpret_cast<uintptr_t>(pAligned) % 256 == 0);
+		heapResource.deallocate(pAligned, 100, 256);
+	}
+	assert(GetAllOutstandingBlockSize(pHeapManager) == 0);
+	Destroy(pHeapManager);
+	HeapFree(GetProcessHeap(), 0, pHeapMemory);
+
+	// the pool of pools routes every request to the size class that fits it, or to the heap
+	std::pmr::memory_resource * pSizeClasses = GetSizeClassMemoryResource();
+	void * pSmall = pSizeClasses->allocate(48);
+	void * pCacheLine = pSizeClasses->allocate(16, 64);
+	void * pMedium = pSizeClasses->allocate(SIZE_CLASS_MAX_SIZE + 1);
+	assert(GetPageOwner(pSmall) == GetSizeClassIndex(48));
+	assert(GetPageOwner(pCacheLine) < g_FixedSizeAllocatorsCount && reinterpret_cast<uintptr_t>(pCacheLine) % 64 == 0);
+	assert(GetPageOwner(pMedium) == PAGE_OWNER_HEAP_MANAGER || FindHeapArena(pMedium) != nullptr);
+	assert(pSizeClasses->is_equal(SizeClassMemoryResource()));
+	pSizeClasses->deallocate(pSmall, 48);
+	pSizeClasses->deallocate(pCacheLine, 16, 64);
+	pSizeClasses->deallocate(pMedium, SIZE_CLASS_MAX_SIZE + 1);
+
+	// Allocator<T> rebinds to the node type, and single nodes go straight to the size class of their size
+	static_assert(std::is_same<std::allocator_traits<Allocator<int>>::rebind_alloc<double>, Allocator<double>>::value, "Allocator must rebind");
+	{
+		std::list<int, Allocator<int>> nodes;
+		nodes.push_back(1);
+		assert(GetPageOwner(&nodes.back()) < g_FixedSizeAllocatorsCount);
+
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator<std::pair<const int, int>>> map;
+		for (int i = 0; i < 1000; i++)
+			map[i] = i;
+		for (int i = 0; i < 1000; i += 2)
+			map.erase(i);
+		assert(map.size() == 500 && map.at(501) == 501);
+
+		std::vector<int, Allocator<int>> values(4096, 7);
+		assert(GetUsableSize(values.data()) >= 4096 * sizeof(int) && values[4095] == 7);
+	}
+
+	return true;
+}
+
+// An object of the kind ObjectPool_UnitTest and ObjectPool_Benchmark pool, counting how many of it are alive
+struct PooledOrder
+{
+	static int s_liveCount;
+	static int s_constructCount;
+
+	int m_id;
+	double m_price;
+	std::vector<int> m_fills;
+
+	PooledOrder(int i_id = 0, double i_price = 0.0) : m_id(i_id), m_price(i_price)
+	{
+		s_liveCount++;
+		s_constructCount++;
+	}
+
+	~PooledOrder()
+	{
+		s_liveCount--;
+	}
+
+	// keep-constructed pools call this instead of the destructor, the fills keep their capacity
+	void Reset()
+	{
+		m_id = 0;
+		m_price = 0.0;
+		m_fills.clear();
+	}
+};
+
+int PooledOrder::s_liveCount = 0;
+int PooledOrder::s_constructCount = 0;
+
+struct alignas(32) PooledVector
+{
+	float m_values[8];
+};
+
+bool ObjectPool_UnitTest()
+{
+	const size_t capacity = 200;
+	const size_t outstandingBefore = GetAllOutstandingBlockSize(g_pHeapManager);
+
+	typedef ObjectPool<PooledOrder> OrderPool;
+	OrderPool * pPool;
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pPool = CreateObjectPool<PooledOrder>(g_pHeapManager, capacity);
+	}
+	assert(pPool != nullptr && pPool->GetCapacity() == capacity);
+
+	// objects are constructed from the arguments in blocks of the pool's own allocator
+	PooledOrder * pOrder = pPool->Create(7, 9.5);
+	assert(pOrder->m_id == 7 && pOrder->m_price == 9.5 && pPool->Contains(pOrder));
+	assert(reinterpret_cast<uintptr_t>(pOrder) % alignof(PooledOrder) == 0 && PooledOrder::s_liveCount == 1);
+	pPool->Destroy(pOrder);
+	assert(PooledOrder::s_liveCount == 0 && pPool->GetLiveCount() == 0);
+
+	// batches fill the pool and stop when it is full
+	PooledOrder * orders[capacity + 1];
+	const size_t createdCount = pPool->CreateBatch(orders, capacity + 1, 3);
+	PooledOrder * pOverflow = pPool->Create();
+	assert(createdCount == capacity && pOverflow == nullptr);
+	assert(PooledOrder::s_liveCount == static_cast<int>(capacity) && orders[capacity - 1]->m_id == 3);
+	for (size_t i = 0; i < capacity; i++)
+		orders[i]->m_id = static_cast<int>(i);
+
+	// the sweep sees every live object once, in address order, and may destroy the one it is on
+	size_t visited = 0;
+	PooledOrder * pPrevious = nullptr;
+	pPool->ForEachLive([&](PooledOrder & i_order)
+	{
+		assert(&i_order > pPrevious);
+		pPrevious = &i_order;
+		visited++;
+		if (i_order.m_id % 2)
+			pPool->Destroy(&i_order);
+	});
+	assert(visited == capacity && pPool->GetLiveCount() == capacity / 2);
+
+	visited = 0;
+	pPool->ForEachLive([&](PooledOrder & i_order)
+	{
+		assert(i_order.m_id % 2 == 0);
+		orders[visited++] = &i_order;
+	});
+	assert(visited == capacity / 2);
+	pPool->DestroyBatch(orders, visited / 2);
+	assert(pPool->GetLiveCount() == capacity / 4 && PooledOrder::s_liveCount == static_cast<int>(capacity / 4));
+
+	// destroying the pool destroys the objects still alive in it and gives the chunk back
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		DestroyObjectPool(pPool);
+	}
+	assert(PooledOrder::s_liveCount == 0 && GetAllOutstandingBlockSize(g_pHeapManager) == outstandingBefore);
+
+	// a keep-constructed pool constructs each block once, and recycled objects come back reset with their buffers
+	ObjectPool<PooledOrder, true> * pRecyclingPool;
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pRecyclingPool = CreateObjectPool<PooledOrder, true>(g_pHeapManager, capacity);
+	}
+	assert(pRecyclingPool != nullptr);
+	PooledOrder::s_constructCount = 0;
+
+	pOrder = pRecyclingPool->Create();
+	pOrder->m_id = 11;
+	pOrder->m_fills.assign(64, 1);
+	pRecyclingPool->Destroy(pOrder);
+	assert(PooledOrder::s_liveCount == 1 && pRecyclingPool->GetLiveCount() == 0);
+
+	PooledOrder * pRecycled = pRecyclingPool->Create();
+	assert(pRecycled == pOrder && pRecycled->m_id == 0 && pRecycled->m_fills.empty() && pRecycled->m_fills.capacity() >= 64);
+	size_t recycledCount = pRecyclingPool->CreateBatch(orders, 10);
+	assert(recycledCount == 10 && PooledOrder::s_constructCount == 11);
+	pRecyclingPool->DestroyBatch(orders, 10);
+	recycledCount = pRecyclingPool->CreateBatch(orders, 10);
+	assert(recycledCount == 10 && PooledOrder::s_constructCount == 11);
+
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		DestroyObjectPool(pRecyclingPool);
+	}
+	assert(PooledOrder::s_liveCount == 0 && GetAllOutstandingBlockSize(g_pHeapManager) == outstandingBefore);
+
+	// over-aligned types get blocks of their alignment
+	ObjectPool<PooledVector> * pVectorPool;
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pVectorPool = CreateObjectPool<PooledVector>(g_pHeapManager, 16);
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		PooledVector * pVector = pVectorPool->Create();
+		assert(reinterpret_cast<uintptr_t>(pVector) % alignof(PooledVector) == 0);
+	}
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		DestroyObjectPool(pVectorPool);
+	}
+
+	return true;
+}
+
+bool SizeClassProfiler_UnitTest(void * i_pHeapMemory, size_t i_sizeHeap, unsigned int i_numDescriptors, bool i_bPrintSizeClasses)
+{
+	// the memory system is destroyed, nothing here may allocate until it is initialized again
+	FSAInitData sizeClasses[FSA_MAX_SIZE_CLASSES];
+
+	// heavy 48, 64 and 128 byte traffic gets a class each, a single 1000 byte request still gets one
+	SizeHistogram histogram = {};
+	histogram.m_requestCount[48 / SIZE_CLASS_GRANULARITY] = 1000;
+	histogram.m_requestCount[64 / SIZE_CLASS_GRANULARITY] = 3000;
+	histogram.m_requestCount[128 / SIZE_CLASS_GRANULARITY] = 2000;
+	histogram.m_requestCount[1008 / SIZE_CLASS_GRANULARITY] = 1;
+	unsigned int classCount = ComputeSizeClasses(histogram, 4 * FSA_SLAB_SIZE, FSA_MAX_SIZE_CLASSES, sizeClasses);
+	assert(classCount == 4 && GetInternalFragmentation(histogram, sizeClasses, classCount) == 0);
+	assert(sizeClasses[0].blockSize == 48 && sizeClasses[1].blockSize == 64 && sizeClasses[2].blockSize == 128 && sizeClasses[3].blockSize == 1008);
+	assert(sizeClasses[1].blockNum > sizeClasses[0].blockNum && sizeClasses[3].blockNum == 1);
+
+	// the budget only pays for so many classes, the 48 byte requests have to share
+	classCount = ComputeSizeClasses(histogram, 3 * FSA_SLAB_SIZE, FSA_MAX_SIZE_CLASSES, sizeClasses);
+	assert(classCount == 3 && sizeClasses[0].blockSize == 64);
+
+	// fitted to the requests MemorySystem_UnitTest made, as many classes waste no more than the default ones
+	GetSizeHistogram(histogram);
+	classCount = ComputeSizeClasses(histogram, g_DefaultSizeClassCount * FSA_SLAB_SIZE, g_DefaultSizeClassCount, sizeClasses);
+	assert(classCount == g_DefaultSizeClassCount);
+	assert(GetInternalFragmentation(histogram, sizeClasses, classCount) <= GetInternalFragmentation(histogram, g_DefaultSizeClasses, g_DefaultSizeClassCount));
+
+	const size_t memoryBudget = 8 * FSA_SLAB_SIZE;
+	classCount = ComputeSizeClasses(histogram, memoryBudget, FSA_MAX_SIZE_CLASSES, sizeClasses);
+	assert(classCount > g_DefaultSizeClassCount && classCount <= memoryBudget / FSA_SLAB_SIZE);
+
+	// unsorted classes are rejected
+	const FSAInitData unsortedSizeClasses[] = { { 32, 100, 0 }, { 16, 100, 0 } };
+	assert(!InitializeMemorySystem(i_pHeapMemory, i_sizeHeap, i_numDescriptors, unsortedSizeClasses, 2));
+
+	// run the memory system on the fitted classes, every request goes to the smallest class it fits
+	if (!InitializeMemorySystem(i_pHeapMemory, i_sizeHeap, i_numDescriptors, sizeClasses, classCount))
+		return false;
+
+	assert(g_FixedSizeAllocatorsCount == classCount);
+	for (size_t size = 1; size <= SIZE_CLASS_MAX_SIZE; size++)
+	{
+		const unsigned int sizeClass = GetSizeClassIndex(size);
+		assert(sizeClass == classCount || sizeClasses[sizeClass].blockSize >= size);
+		assert(sizeClass == 0 || sizeClasses[sizeClass - 1].blockSize < size);
+	}
+
+	const bool success = MemorySystem_UnitTest();
+
+	if (i_bPrintSizeClasses)
+		PrintSizeClasses(sizeClasses, classCount);
+
+	DestroyMemorySystem();
+	return success;
+}
+
+void FixedSizeAllocator_Benchmark()
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const size_t blockSize = 16;
+	const size_t blockNum = 64 * 1024;
+	const size_t stepCount = 10;
+
+	// Keep both the pool and the bookkeeping off the allocator under test
+	void* pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize(blockSize, blockNum));
+	void** blocks = static_cast<void**>(HeapAlloc(GetProcessHeap(), 0, sizeof(void*) * blockNum));
+	assert(pMemory && blocks);
+
+	FixedSizeAllocator* allocator = CreateFixedSizeAllocator(blockSize, blockNum, pMemory);
+
+	printf("FixedSizeAllocator::Alloc latency, %zu blocks of %zu bytes:\n", blockNum, blockSize);
+
+	// Time every tenth of the pool on its own, the last step stops at 99% full
+	size_t allocatedCount = 0;
+	for (size_t step = 0; step < stepCount; step++)
+	{
+		const size_t startPercent = step * 100 / stepCount;
+		const size_t targetPercent = (step + 1 == stepCount) ? 99 : (step + 1) * 100 / stepCount;
+		const size_t targetCount = blockNum * targetPercent / 100;
+		const size_t startCount = allocatedCount;
+
+		const Clock::time_point start = Clock::now();
+		while (allocatedCount < targetCount)
+		{
+			blocks[allocatedCount++] = allocator->Alloc();
+		}
+		const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+		printf("  %3zu%% -> %3zu%% full: %6.1f ns/Alloc\n",
+			startPercent, targetPercent, elapsed.count() / (targetCount - startCount));
+	}
+
+	// At 99% full free random blocks and take them back, every Alloc has to find a hole somewhere in the pool
+	std::shuffle(blocks, blocks + allocatedCount, std::default_random_engine());
+
+	const size_t churnCount = allocatedCount / 10;
+	for (size_t i = 0; i < churnCount; i++)
+	{
+		allocator->Free(blocks[i]);
+	}
+
+	const Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < churnCount; i++)
+	{
+		blocks[i] = allocator->Alloc();
+	}
+	const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+	printf("  random holes at 99%% full: %6.1f ns/Alloc\n", elapsed.count() / churnCount);
+
+	for (size_t i = 0; i < allocatedCount; i++)
+	{
+		const bool freeResult = allocator->Free(blocks[i]);
+		assert(freeResult);
+	}
+	assert(allocator->m_freeBlockNum == blockNum);
+
+	allocator->Destroy();
+
+	HeapFree(GetProcessHeap(), 0, blocks);
+	HeapFree(GetProcessHeap(), 0, pMemory);
+}
+
+void ConcurrentFixedSizeAllocator_Benchmark()
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const size_t blockSize = 16;
+	const size_t blockNum = 64 * 1024;
+	const size_t burstSize = 16;
+	const size_t burstsPerThread = 64 * 1024;
+
+	void* pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize(blockSize, blockNum));
+	assert(pMemory);
+
+	FixedSizeAllocator* allocator = CreateFixedSizeAllocator(blockSize, blockNum, pMemory, true);
+
+	const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	printf("Concurrent FixedSizeAllocator throughput, bursts of %zu Alloc/Free pairs:\n", burstSize);
+
+	// Every thread allocates a burst of blocks and frees them again, all threads share the one pool
+	for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+	{
+		std::vector<std::thread> workers;
+		workers.reserve(numThreads);
+
+		const Clock::time_point start = Clock::now();
+		for (unsigned int t = 0; t < numThreads; t++)
+		{
+			workers.emplace_back([allocator]()
+			{
+				void* burst[burstSize];
+				for (size_t i = 0; i < burstsPerThread; i++)
+				{
+					for (size_t j = 0; j < burstSize; j++)
+						burst[j] = allocator->Alloc();
+					for (size_t j = 0; j < burstSize; j++)
+						allocator->Free(burst[j]);
+				}
+			});
+		}
+		for (std::thread& worker : workers)
+			worker.join();
+		const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+		const double pairCount = static_cast<double>(numThreads) * burstsPerThread * burstSize;
+		printf("  %2u threads: %7.1f M Alloc/Free pairs per second\n", numThreads, pairCount / elapsed.count() / 1e6);
+	}
+	assert(allocator->m_freeBlockNum == blockNum);
+
+	allocator->Destroy();
+
+	HeapFree(GetProcessHeap(), 0, pMemory);
+}
+
+void LinearAllocator_Benchmark()
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const size_t requestCount = 4096;
+	const size_t allocationsPerRequest = 256;
+	const size_t maxAllocationSize = 512;
+
+	// The same scratch pattern for both: every request allocates objects of mixed sizes and drops them all at its end
+	size_t sizes[allocationsPerRequest];
+	size_t requestSize = 0;
+	std::default_random_engine engine;
+	for (size_t& size : sizes)
+	{
+		size = 1 + engine() % maxAllocationSize;
+		requestSize += (size + LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT - 1) & ~(LINEAR_ALLOCATOR_DEFAULT_ALIGNMENT - 1);
+	}
+
+	printf("Scratch memory, %zu allocations of up to %zu bytes per request:\n", allocationsPerRequest, maxAllocationSize);
+
+	void* ptrs[allocationsPerRequest];
+	Clock::time_point start = Clock::now();
+	for (size_t request = 0; request < requestCount; request++)
+	{
+		for (size_t i = 0; i < allocationsPerRequest; i++)
+			ptrs[i] = malloc(sizes[i]);
+		for (size_t i = 0; i < allocationsPerRequest; i++)
+			free(ptrs[i]);
+	}
+	std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+	printf("  malloc/free:             %6.1f ns/allocation\n", elapsed.count() / (requestCount * allocationsPerRequest));
+
+	LinearAllocator* pScratch;
+	{
+		ScopedSpinLock lock(g_HeapManagerLock);
+		pScratch = CreateLinearAllocator(g_pHeapManager, requestSize);
+	}
+	assert(pScratch);
+
+	start = Clock::now();
+	for (size_t request = 0; request < requestCount; request++)
+	{
+		const LinearAllocator::Marker marker = pScratch->GetMarker();
+		for (size_t i = 0; i < allocationsPerRequest; i++)
+			ptrs[i] = pScratch->Alloc(sizes[i]);
+		pScratch->FreeToMarker(marker);
+	}
+	elapsed = Clock::now() - start;
+	printf("  LinearAllocator/rewind:  %6.1f ns/allocation\n", elapsed.count() / (requestCount * allocationsPerRequest));
+	assert(ptrs[allocationsPerRequest - 1] != nullptr);
+
+	ScopedSpinLock lock(g_HeapManagerLock);
+	pScratch->Destroy();
+}
+
+// Inserts i_count keys into i_map and erases them again, i_rounds times, and returns the nanoseconds per insert/erase pair
+template <class Map>
+double timeInsertErase(Map& i_map, int i_count, int i_rounds)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const Clock::time_point start = Clock::now();
+	for (int round = 0; round < i_rounds; round++)
+	{
+		for (int i = 0; i < i_count; i++)
+			i_map.emplace(i, i);
+		for (int i = 0; i < i_count; i++)
+			i_map.erase(i);
+	}
+	const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+	return elapsed.count() / (static_cast<double>(i_count) * i_rounds);
+}
+
+// Same for push_back / pop_front on a list
+template <class List>
+double timePushPop(List& i_list, int i_count, int i_rounds)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const Clock::time_point start = Clock::now();
+	for (int round = 0; round < i_rounds; round++)
+	{
+		for (int i = 0; i < i_count; i++)
+			i_list.push_back(i);
+		for (int i = 0; i < i_count; i++)
+			i_list.pop_front();
+	}
+	const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+	return elapsed.count() / (static_cast<double>(i_count) * i_rounds);
+}
+
+void ContainerAllocator_Benchmark()
+{
+	const int count = 1000;
+	const int rounds = 200;
+
+	printf("Container node throughput, %d nodes per round:\n", count);
+
+	{
+		std::unordered_map<int, int> standardMap;
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator<std::pair<const int, int>>> systemMap;
+		std::pmr::unordered_map<int, int> poolMap(GetSizeClassMemoryResource());
+		printf("  unordered_map insert/erase, std::allocator:          %6.1f ns\n", timeInsertErase(standardMap, count, rounds));
+		printf("  unordered_map insert/erase, Allocator<T>:            %6.1f ns\n", timeInsertErase(systemMap, count, rounds));
+		printf("  unordered_map insert/erase, SizeClassMemoryResource: %6.1f ns\n", timeInsertErase(poolMap, count, rounds));
+	}
+
+	{
+		// The list's own FixedSizeAllocator, sized for every node it ever holds at once
+		const size_t nodeSize = 32;
+		void* pMemory = HeapAlloc(GetProcessHeap(), 0, GetFixedSizeAllocatorSize(nodeSize, count));
+		assert(pMemory);
+		FixedSizeAllocator* pAllocator = CreateFixedSizeAllocator(nodeSize, count, pMemory);
+		FixedSizeMemoryResource nodeResource(pAllocator, nullptr, GetSizeClassMemoryResource());
+
+		std::list<int> standardList;
+		std::list<int, Allocator<int>> systemList;
+		std::pmr::list<int> fixedSizeList(&nodeResource);
+		printf("  list push/pop, std::allocator:                       %6.1f ns\n", timePushPop(standardList, count, rounds));
+		printf("  list push/pop, Allocator<T>:                         %6.1f ns\n", timePushPop(systemList, count, rounds));
+		printf("  list push/pop, FixedSizeMemoryResource:              %6.1f ns\n", timePushPop(fixedSizeList, count, rounds));
+
+		pAllocator->Destroy();
+		HeapFree(GetProcessHeap(), 0, pMemory);
+	}
+}
+
+void ObjectPool_Benchmark()
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const size_t objectCount = 16384;
+	const int rounds = 50;
+
+	printf("Object pool, %zu objects of %zu bytes per round:\n", objectCount, sizeof(PooledOrder));
+
+	// The pools get a heap of their own, big enough for the largest of them
+	const size_t sizeHeap = ObjectPool<PooledOrder>::GetSize(objectCount) + 64 * 1024;
+	void * pHeapMemory = HeapAlloc(GetProcessHeap(), 0, sizeHeap);
+	assert(pHeapMemory);
+	HeapManager * pHeapManager = CreateHeapManager(pHeapMemory, sizeHeap, 0);
+
+	std::vector<PooledOrder *> orders(objectCount);
+
+	Clock::time_point start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (size_t i = 0; i < objectCount; i++)
+			orders[i] = new PooledOrder(static_cast<int>(i), 1.0);
+		for (size_t i = 0; i < objectCount; i++)
+			delete orders[i];
+	}
+	std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+	printf("  new/delete:                       %6.1f ns/object\n", elapsed.count() / (objectCount * rounds));
+
+	ObjectPool<PooledOrder> * pPool = CreateObjectPool<PooledOrder>(pHeapManager, objectCount);
+	assert(pPool);
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (size_t i = 0; i < objectCount; i++)
+			orders[i] = pPool->Create(static_cast<int>(i), 1.0);
+		for (size_t i = 0; i < objectCount; i++)
+			pPool->Destroy(orders[i]);
+	}
+	elapsed = Clock::now() - start;
+	printf("  ObjectPool Create/Destroy:        %6.1f ns/object\n", elapsed.count() / (objectCount * rounds));
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		pPool->CreateBatch(orders.data(), objectCount, 0, 1.0);
+		pPool->DestroyBatch(orders.data(), objectCount);
+	}
+	elapsed = Clock::now() - start;
+	printf("  ObjectPool batches:               %6.1f ns/object\n", elapsed.count() / (objectCount * rounds));
+
+	// A sweep over every other object, through the pointers in creation order or the pool's BitArray
+	pPool->CreateBatch(orders.data(), objectCount, 0, 1.0);
+	std::shuffle(orders.begin(), orders.end(), std::default_random_engine());
+	pPool->DestroyBatch(orders.data(), objectCount / 2);
+	orders.erase(orders.begin(), orders.begin() + objectCount / 2);
+
+	double total = 0.0;
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (PooledOrder * pOrder : orders)
+			total += pOrder->m_price;
+	}
+	elapsed = Clock::now() - start;
+	printf("  sweep through shuffled pointers:  %6.1f ns/object\n", elapsed.count() / (objectCount / 2 * rounds));
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		pPool->ForEachLive([&](PooledOrder & i_order) { total += i_order.m_price; });
+	}
+	elapsed = Clock::now() - start;
+	printf("  sweep with ForEachLive:           %6.1f ns/object\n", elapsed.count() / (objectCount / 2 * rounds));
+	assert(total == objectCount * rounds);
+
+	DestroyObjectPool(pPool);
+
+	// Recycled objects skip the constructor and destructor, and keep what their vectors have grown to
+	ObjectPool<PooledOrder, true> * pRecyclingPool = CreateObjectPool<PooledOrder, true>(pHeapManager, objectCount);
+	assert(pRecyclingPool);
+	orders.resize(objectCount);
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		pRecyclingPool->CreateBatch(orders.data(), objectCount);
+		for (size_t i = 0; i < objectCount; i++)
+			orders[i]->m_fills.push_back(round);
+		pRecyclingPool->DestroyBatch(orders.data(), objectCount);
+	}
+	elapsed = Clock::now() - start;
+	printf("  keep-constructed with one fill:   %6.1f ns/object\n", elapsed.count() / (objectCount * rounds));
+
+	DestroyObjectPool(pRecyclingPool);
+	Destroy(pHeapManager);
+	HeapFree(GetProcessHeap(), 0, pHeapMemory);
+}